@@ -0,0 +1,350 @@
+#include "backend.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+
+namespace {
+// fp_st is an array type, which cannot be stored in a std::vector directly.
+struct FieldElement {
+  fp_st v;
+};
+
+// how AddAffineBatch computes each sum.
+enum class AffineSum : uint8_t { kAdd, kDouble, kFirst, kSecond, kInfinity };
+
+void LimbsToBn(bn_t r, const uint64_t k[4]) {
+  const dig_t digits[4] = {k[0], k[1], k[2], k[3]};
+  bn_read_raw(r, digits, 4);
+}
+}  // namespace
+
+void shf::RelicBackend::NormalizeBatch(Element* const* points, std::size_t n) {
+  // only points that are neither normalized nor at infinity need an inverse.
+  std::vector<ep_st*> todo;
+  todo.reserve(n);
+  for (std::size_t i = 0; i < n; ++i) {
+    ep_st* p = points[i];
+    if (!p->norm && !fp_is_zero(p->z)) todo.push_back(p);
+  }
+  if (todo.empty()) return;
+
+  // prefix[i] = z_0 * ... * z_i
+  const std::size_t m = todo.size();
+  std::vector<FieldElement> prefix(m);
+  fp_copy(prefix[0].v, todo[0]->z);
+  for (std::size_t i = 1; i < m; ++i)
+    fp_mul(prefix[i].v, prefix[i - 1].v, todo[i]->z);
+
+  fp_t inv, zinv, t;
+  fp_inv(inv, prefix[m - 1].v);
+  for (std::size_t i = m; i-- > 0;) {
+    ep_st* p = todo[i];
+    // inv = 1/(z_0 * ... * z_i) here
+    if (i) {
+      fp_mul(zinv, inv, prefix[i - 1].v);
+      fp_mul(inv, inv, p->z);
+    } else {
+      fp_copy(zinv, inv);
+    }
+    // Jacobian coordinates: (X/Z^2, Y/Z^3)
+    fp_sqr(t, zinv);
+    fp_mul(p->x, p->x, t);
+    fp_mul(t, t, zinv);
+    fp_mul(p->y, p->y, t);
+    fp_set_dig(p->z, 1);
+    p->norm = 1;
+  }
+}
+
+// relic's default ep_mul (LWNAF) and ep_mul_gen (COMBS) branch on and index
+// tables by the scalar, so the constant-time operations use the regular
+// recoding in ep_mul_lwreg instead. ep_mul_lwreg reads its input as an affine
+// point, so projective inputs are normalized first.
+void shf::RelicBackend::Mul(Element& r, const Element& a, const uint64_t k[4]) {
+  bn_t t;
+  ep_t n;
+  bn_new(t);
+  ep_new(n);
+  LimbsToBn(t, k);
+  ep_norm(n, &a);
+  ep_mul_lwreg(&r, n, t);
+  ep_free(n);
+  bn_free(t);
+}
+
+void shf::RelicBackend::MulGenerator(Element& r, const uint64_t k[4]) {
+  ep_t g;
+  ep_new(g);
+  ep_curve_get_gen(g);
+  Mul(r, *g, k);
+  ep_free(g);
+}
+
+void shf::RelicBackend::MulVartime(Element& r, const Element& a,
+                                   const uint64_t k[4]) {
+  bn_t t;
+  bn_new(t);
+  LimbsToBn(t, k);
+  ep_mul_lwnaf(&r, &a, t);
+  bn_free(t);
+}
+
+void shf::RelicBackend::MulGeneratorVartime(Element& r, const uint64_t k[4]) {
+  bn_t t;
+  bn_new(t);
+  LimbsToBn(t, k);
+  ep_mul_gen(&r, t);
+  bn_free(t);
+}
+
+void shf::RelicBackend::MulAdd2(Element& r, const uint64_t k[4],
+                                const Element& a, const uint64_t l[4],
+                                const Element& b) {
+  // relic's simultaneous multiplications are all variable time.
+  ep_t t;
+  ep_new(t);
+  Mul(*t, b, l);
+  Mul(r, a, k);
+  ep_add(&r, &r, t);
+  ep_free(t);
+}
+
+void shf::RelicBackend::MulAdd2Vartime(Element& r, const uint64_t k[4],
+                                       const Element& a, const uint64_t l[4],
+                                       const Element& b) {
+  bn_t s, t;
+  bn_new(s);
+  bn_new(t);
+  LimbsToBn(s, k);
+  LimbsToBn(t, l);
+  ep_mul_sim(&r, &a, s, &b, t);
+  bn_free(s);
+  bn_free(t);
+}
+
+// relic has no batched multiplication; this only converts the scalar once.
+void shf::RelicBackend::MulMany(Element* r, const uint64_t k[4],
+                                const Element* a, std::size_t n) {
+  bn_t t;
+  ep_t p;
+  bn_new(t);
+  ep_new(p);
+  LimbsToBn(t, k);
+  for (std::size_t i = 0; i < n; ++i) {
+    ep_norm(p, &a[i]);
+    ep_mul_lwreg(&r[i], p, t);
+  }
+  ep_free(p);
+  bn_free(t);
+}
+
+void shf::RelicBackend::MulGeneratorMany(Element* r, const uint64_t* k,
+                                         std::size_t n) {
+  for (std::size_t i = 0; i < n; ++i) MulGenerator(r[i], k + 4 * i);
+}
+
+shf::RelicBackend::Batch::Batch() {
+  for (auto& p : m_points) ep_set_infty(&p);
+}
+
+void shf::RelicBackend::Batch::Load(const Element* const points[kLanes]) {
+  for (std::size_t i = 0; i < kLanes; ++i) ep_copy(&m_points[i], points[i]);
+}
+
+void shf::RelicBackend::Batch::Store(Element* const points[kLanes]) const {
+  for (std::size_t i = 0; i < kLanes; ++i) ep_copy(points[i], &m_points[i]);
+}
+
+void shf::RelicBackend::Batch::AddMixed(const Affine Q[kLanes],
+                                        uint32_t skip) {
+  Element q;
+  for (std::size_t i = 0; i < kLanes; ++i) {
+    if ((skip >> i) & 1) continue;
+    FromAffine(q, Q[i]);
+    ep_add(&m_points[i], &m_points[i], &q);
+  }
+}
+
+void shf::RelicBackend::Batch::Double() {
+  for (auto& p : m_points) ep_dbl(&p, &p);
+}
+
+void shf::RelicBackend::WriteCompressed(uint8_t* dest, const Element& a) {
+  ep_write_bin(dest, kFieldBytes + 1, &a, 1);
+}
+
+bool shf::RelicBackend::ReadCompressed(Element& r, const uint8_t* bytes) {
+  if ((bytes[0] & ~1) != 2) return false;
+  ep_read_bin(&r, bytes, kFieldBytes + 1);
+  return ep_is_valid(&r) == 1;
+}
+
+void shf::RelicBackend::WriteAffine(uint8_t* x, uint8_t* y, const Element& a) {
+  ep_t t;
+  ep_new(t);
+  ep_norm(t, &a);
+  fp_write_bin(x, kFieldBytes, t->x);
+  fp_write_bin(y, kFieldBytes, t->y);
+  ep_free(t);
+}
+
+bool shf::RelicBackend::ReadAffine(Element& r, const uint8_t* x,
+                                   const uint8_t* y) {
+  fp_read_bin(r.x, x, kFieldBytes);
+  fp_read_bin(r.y, y, kFieldBytes);
+  fp_set_dig(r.z, 1);
+  r.norm = 1;
+  return ep_is_valid(&r) == 1;
+}
+
+void shf::RelicBackend::ToAffine(Affine& r, const Element& a) {
+  if (ep_is_infty(&a)) {
+    std::fill(r.x, r.x + RLC_FP_DIGS, 0);
+    std::fill(r.y, r.y + RLC_FP_DIGS, 0);
+    return;
+  }
+  ep_t t;
+  ep_new(t);
+  ep_norm(t, &a);
+  std::copy(t->x, t->x + RLC_FP_DIGS, r.x);
+  std::copy(t->y, t->y + RLC_FP_DIGS, r.y);
+  ep_free(t);
+}
+
+bool shf::RelicBackend::IsInfinity(const Affine& a) {
+  const auto is_zero = [](dig_t d) { return d == 0; };
+  return std::all_of(a.x, a.x + RLC_FP_DIGS, is_zero) &&
+         std::all_of(a.y, a.y + RLC_FP_DIGS, is_zero);
+}
+
+void shf::RelicBackend::NegateAffine(Affine& r, const Affine& a) {
+  std::copy(a.x, a.x + RLC_FP_DIGS, r.x);
+  // fp_neg maps 0 to p, which would no longer encode infinity.
+  if (IsInfinity(a))
+    std::copy(a.y, a.y + RLC_FP_DIGS, r.y);
+  else
+    fp_neg(r.y, a.y);
+}
+
+void shf::RelicBackend::AddAffineBatch(Affine* r, const Affine* a,
+                                        const Affine* b, std::size_t n) {
+  if (!n) return;
+
+  // the same slope computation as p256::AddAffineBatch, with relic's field
+  // arithmetic.
+  std::vector<AffineSum> kinds(n);
+  std::vector<FieldElement> prefix(n);
+  fp_t acc, t, u, lambda, x, y, one;
+  fp_set_dig(acc, 1);
+  fp_set_dig(one, 1);
+  for (std::size_t i = 0; i < n; ++i) {
+    AffineSum kind;
+    if (IsInfinity(a[i]))
+      kind = AffineSum::kSecond;
+    else if (IsInfinity(b[i]))
+      kind = AffineSum::kFirst;
+    else if (fp_cmp(a[i].x, b[i].x) != RLC_EQ)
+      kind = AffineSum::kAdd;
+    else if (fp_cmp(a[i].y, b[i].y) == RLC_EQ)
+      kind = AffineSum::kDouble;
+    else
+      kind = AffineSum::kInfinity;
+    kinds[i] = kind;
+    if (kind == AffineSum::kAdd) {
+      fp_sub(t, b[i].x, a[i].x);
+      fp_mul(acc, acc, t);
+    } else if (kind == AffineSum::kDouble) {
+      fp_dbl(t, a[i].y);
+      fp_mul(acc, acc, t);
+    }
+    fp_copy(prefix[i].v, acc);
+  }
+
+  fp_t inv, dinv;
+  fp_inv(inv, acc);
+  for (std::size_t i = n; i-- > 0;) {
+    switch (kinds[i]) {
+      case AffineSum::kFirst:
+        r[i] = a[i];
+        continue;
+      case AffineSum::kSecond:
+        r[i] = b[i];
+        continue;
+      case AffineSum::kInfinity:
+        r[i] = {};
+        continue;
+      default:
+        break;
+    }
+    // inv = 1/prefix[i] here
+    if (i)
+      fp_mul(dinv, inv, prefix[i - 1].v);
+    else
+      fp_copy(dinv, inv);
+    if (kinds[i] == AffineSum::kAdd) {
+      fp_sub(t, b[i].x, a[i].x);
+      fp_mul(inv, inv, t);
+      fp_sub(u, b[i].y, a[i].y);
+    } else {
+      fp_dbl(t, a[i].y);
+      fp_mul(inv, inv, t);
+      // 3x^2 + a with a = -3 on P-256.
+      fp_sqr(t, a[i].x);
+      fp_sub(t, t, one);
+      fp_dbl(u, t);
+      fp_add(u, u, t);
+    }
+    fp_mul(lambda, u, dinv);
+    fp_sqr(x, lambda);
+    fp_sub(x, x, a[i].x);
+    fp_sub(x, x, b[i].x);
+    fp_sub(t, a[i].x, x);
+    fp_mul(y, lambda, t);
+    fp_sub(y, y, a[i].y);
+    fp_copy(r[i].x, x);
+    fp_copy(r[i].y, y);
+  }
+}
+
+void shf::RelicBackend::FromAffine(Element& r, const Affine& a) {
+  if (IsInfinity(a)) {
+    ep_set_infty(&r);
+    return;
+  }
+  fp_zero(r.x);
+  fp_zero(r.y);
+  std::copy(a.x, a.x + RLC_FP_DIGS, r.x);
+  std::copy(a.y, a.y + RLC_FP_DIGS, r.y);
+  fp_set_dig(r.z, 1);
+  r.norm = 1;
+}
+
+void shf::P256Backend::WriteAffine(uint8_t* x, uint8_t* y, const Element& a) {
+  const p256::Affine A = p256::ToAffine(a);
+  A.x.Write(x);
+  A.y.Write(y);
+}
+
+bool shf::P256Backend::ReadAffine(Element& r, const uint8_t* x,
+                                  const uint8_t* y) {
+  bool x_reduced = false, y_reduced = false;
+  const p256::Affine A = {p256::Fe::Read(x, &x_reduced),
+                          p256::Fe::Read(y, &y_reduced)};
+  if (!x_reduced || !y_reduced || !p256::IsOnCurve(A)) return false;
+  r = p256::FromAffine(A);
+  return true;
+}
+
+void shf::P256Backend::Print(const Element& a) {
+  if (p256::IsInfinity(a)) {
+    std::printf("infinity\n");
+    return;
+  }
+  uint8_t x[kFieldBytes], y[kFieldBytes];
+  WriteAffine(x, y, a);
+  for (const uint8_t b : x) std::printf("%02X", b);
+  std::printf("\n");
+  for (const uint8_t b : y) std::printf("%02X", b);
+  std::printf("\n");
+}
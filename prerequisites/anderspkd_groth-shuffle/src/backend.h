@@ -0,0 +1,241 @@
+#ifndef SHF_BACKEND_H
+#define SHF_BACKEND_H
+
+#include <gmp.h>
+
+#include <cstddef>
+#include <cstdint>
+
+extern "C" {
+#include "include/relic/relic.h"
+}
+
+#include "p256.h"
+#include "p256_batch.h"
+
+namespace shf {
+
+/**
+ * @brief Point arithmetic backends.
+ *
+ * A backend supplies an <code>Element</code> type and static functions that
+ * operate on it. <code>shf::Point</code> stores a single Element and forwards
+ * all arithmetic to <code>PointBackend</code>, which is selected at compile
+ * time, so there is no dispatch cost. Scalars are passed as four 64-bit limbs,
+ * least significant first.
+ *
+ * Mul, MulGenerator and MulAdd2 run in constant time and are used for secret
+ * scalars. Their Vartime variants may branch on the scalars and are only used
+ * for public scalars (see shf::PublicScalar). MulAdd2 computes k*a + l*b.
+ * MulMany multiplies n points by the same secret scalar, also in constant
+ * time; r may alias a. MulGeneratorMany computes r[i] = k[i]*G for n scalars
+ * given as 4n limbs, in constant time.
+ *
+ * Backends also supply a compact <code>Affine</code> type of exactly two field
+ * elements for bulk storage. The point at infinity is stored as x = y = 0,
+ * which is not on the curve. Converting to Affine costs an inversion unless the
+ * point is already normalized.
+ *
+ * AddAffineBatch(r, a, b, n) sets r[i] = a[i] + b[i] for n pairs of Affine
+ * points, sharing one inversion between all of them; r may alias a or b. It
+ * runs in variable time.
+ *
+ * A backend's <code>Batch</code> holds <code>Batch::kLanes</code> points that
+ * are updated in lockstep: Load and Store take one pointer per lane and
+ * AddMixed(Q, skip) adds Q[i] to lane i unless bit i of skip is set. Q[i] must
+ * be finite unless lane i is skipped.
+ *
+ * The in-tree P-256 backend is the default. Configuring with
+ * <code>-DSHF_RELIC_BACKEND=ON</code> switches back to relic. Both backends
+ * produce identical serializations.
+ */
+
+/**
+ * @brief Point arithmetic using relic's generic prime curve modules.
+ */
+struct RelicBackend {
+  using Element = ep_st;
+
+  struct Affine {
+    dig_t x[RLC_FP_DIGS];
+    dig_t y[RLC_FP_DIGS];
+  };
+
+  static constexpr std::size_t kFieldBytes = RLC_FP_BYTES;
+
+  static void Infinity(Element& r) { ep_set_infty(&r); };
+  static void Generator(Element& r) { ep_curve_get_gen(&r); };
+  static bool IsInfinity(const Element& a) { return ep_is_infty(&a) == 1; };
+  static bool IsNormalized(const Element& a) { return a.norm != 0; };
+
+  static void NormalizeBatch(Element* const* points, std::size_t n);
+
+  static void Add(Element& r, const Element& a, const Element& b) {
+    ep_add(&r, &a, &b);
+  };
+  static void Sub(Element& r, const Element& a, const Element& b) {
+    ep_sub(&r, &a, &b);
+  };
+  static void Negate(Element& r, const Element& a) { ep_neg(&r, &a); };
+  static void Double(Element& r, const Element& a) { ep_dbl(&r, &a); };
+
+  static void Mul(Element& r, const Element& a, const uint64_t k[4]);
+  static void MulGenerator(Element& r, const uint64_t k[4]);
+  static void MulVartime(Element& r, const Element& a, const uint64_t k[4]);
+  static void MulGeneratorVartime(Element& r, const uint64_t k[4]);
+  static void MulAdd2(Element& r, const uint64_t k[4], const Element& a,
+                      const uint64_t l[4], const Element& b);
+  static void MulAdd2Vartime(Element& r, const uint64_t k[4], const Element& a,
+                             const uint64_t l[4], const Element& b);
+  static void MulMany(Element* r, const uint64_t k[4], const Element* a,
+                      std::size_t n);
+  static void MulGeneratorMany(Element* r, const uint64_t* k, std::size_t n);
+
+  /**
+   * @brief Lanes for batched updates. relic has no vectorized field
+   * arithmetic, so the lanes are updated one after another.
+   */
+  class Batch {
+   public:
+    static constexpr std::size_t kLanes = 8;
+
+    Batch();
+
+    void Load(const Element* const points[kLanes]);
+    void Store(Element* const points[kLanes]) const;
+    void AddMixed(const Affine Q[kLanes], uint32_t skip);
+    void Double();
+
+    static bool Vectorized() { return false; };
+
+   private:
+    Element m_points[kLanes];
+  };
+
+  static bool Equal(const Element& a, const Element& b) {
+    return ep_cmp(&a, &b) == RLC_EQ;
+  };
+
+  static void WriteCompressed(uint8_t* dest, const Element& a);
+  static bool ReadCompressed(Element& r, const uint8_t* bytes);
+  static void WriteAffine(uint8_t* x, uint8_t* y, const Element& a);
+  static bool ReadAffine(Element& r, const uint8_t* x, const uint8_t* y);
+
+  static void ToAffine(Affine& r, const Element& a);
+  static void FromAffine(Element& r, const Affine& a);
+  static bool IsInfinity(const Affine& a);
+  static void NegateAffine(Affine& r, const Affine& a);
+  static void AddAffineBatch(Affine* r, const Affine* a, const Affine* b,
+                             std::size_t n);
+
+  static void Print(const Element& a) { ep_print(&a); };
+};
+
+/**
+ * @brief Point arithmetic using the in-tree P-256 implementation in p256.h.
+ */
+struct P256Backend {
+  using Element = p256::Jacobian;
+  using Affine = p256::Affine;
+
+  static constexpr std::size_t kFieldBytes = p256::kFieldBytes;
+
+  static void Infinity(Element& r) { r = p256::Infinity(); };
+  static void Generator(Element& r) { r = p256::Generator(); };
+  static bool IsInfinity(const Element& a) { return p256::IsInfinity(a); };
+  static bool IsNormalized(const Element& a) { return p256::IsNormalized(a); };
+
+  static void NormalizeBatch(Element* const* points, std::size_t n) {
+    p256::NormalizeBatch(points, n);
+  };
+
+  static void Add(Element& r, const Element& a, const Element& b) {
+    r = p256::Add(a, b);
+  };
+  static void Sub(Element& r, const Element& a, const Element& b) {
+    r = p256::Add(a, p256::Negate(b));
+  };
+  static void Negate(Element& r, const Element& a) { r = p256::Negate(a); };
+  static void Double(Element& r, const Element& a) { r = p256::Double(a); };
+
+  static void Mul(Element& r, const Element& a, const uint64_t k[4]) {
+    r = p256::Mul(a, k);
+  };
+  static void MulGenerator(Element& r, const uint64_t k[4]) {
+    r = p256::MulGenerator(k);
+  };
+  static void MulVartime(Element& r, const Element& a, const uint64_t k[4]) {
+    r = p256::MulVartime(a, k);
+  };
+  static void MulGeneratorVartime(Element& r, const uint64_t k[4]) {
+    r = p256::MulGeneratorVartime(k);
+  };
+  static void MulAdd2(Element& r, const uint64_t k[4], const Element& a,
+                      const uint64_t l[4], const Element& b) {
+    r = p256::MulAdd2(k, a, l, b);
+  };
+  static void MulAdd2Vartime(Element& r, const uint64_t k[4], const Element& a,
+                             const uint64_t l[4], const Element& b) {
+    r = p256::MulAdd2Vartime(k, a, l, b);
+  };
+  static void MulMany(Element* r, const uint64_t k[4], const Element* a,
+                      std::size_t n) {
+    p256::MulMany(r, k, a, n);
+  };
+  static void MulGeneratorMany(Element* r, const uint64_t* k, std::size_t n) {
+    p256::MulGeneratorMany(r, k, n);
+  };
+
+  using Batch = p256::Batch;
+
+  static bool Equal(const Element& a, const Element& b) {
+    return p256::Equal(a, b);
+  };
+
+  static void WriteCompressed(uint8_t* dest, const Element& a) {
+    p256::WriteCompressed(dest, a);
+  };
+  static bool ReadCompressed(Element& r, const uint8_t* bytes) {
+    return p256::ReadCompressed(r, bytes);
+  };
+  static void WriteAffine(uint8_t* x, uint8_t* y, const Element& a);
+  static bool ReadAffine(Element& r, const uint8_t* x, const uint8_t* y);
+
+  static void ToAffine(Affine& r, const Element& a) {
+    if (p256::IsInfinity(a))
+      r = {p256::Fe::Zero(), p256::Fe::Zero()};
+    else if (p256::IsNormalized(a))
+      r = {a.X, a.Y};
+    else
+      r = p256::ToAffine(a);
+  };
+  static void FromAffine(Element& r, const Affine& a) {
+    if (IsInfinity(a))
+      r = p256::Infinity();
+    else
+      r = p256::FromAffine(a);
+  };
+  static bool IsInfinity(const Affine& a) {
+    return a.x.IsZero() && a.y.IsZero();
+  };
+  static void NegateAffine(Affine& r, const Affine& a) { r = {a.x, -a.y}; };
+  static void AddAffineBatch(Affine* r, const Affine* a, const Affine* b,
+                             std::size_t n) {
+    p256::AddAffineBatch(r, a, b, n);
+  };
+
+  static void Print(const Element& a);
+};
+
+#if defined(SHF_RELIC_BACKEND)
+using PointBackend = RelicBackend;
+#else
+using PointBackend = P256Backend;
+#endif
+
+static_assert(sizeof(PointBackend::Affine) == 2 * PointBackend::kFieldBytes,
+              "affine points must be stored without padding");
+
+}  // namespace shf
+
+#endif  // SHF_BACKEND_H
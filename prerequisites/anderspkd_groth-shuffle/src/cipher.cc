@@ -1,17 +1,101 @@
 #include "cipher.h"
 
+#include <algorithm>
+#include <stdexcept>
+
+#include "thread_pool.h"
+
 shf::SecretKey shf::CreateSecretKey() { return shf::Scalar::CreateRandom(); }
 
 shf::PublicKey shf::CreatePublicKey(const shf::SecretKey& sk) {
-  return shf::Point::Generator() * sk;
+  return shf::Point::MulGenerator(sk);
 }
 
 shf::Ctxt shf::Encrypt(const shf::PublicKey& pk, const shf::Point& m,
                      const shf::Scalar& r) {
-  const auto U = shf::Point::Generator() * r;
+  const auto U = shf::Point::MulGenerator(r);
+  return {U, m + r * pk};
+}
+
+shf::Ctxt shf::Encrypt(const shf::PublicKey& pk, const shf::Point& m,
+                     const shf::PublicScalar& r) {
+  const auto U = shf::Point::MulGenerator(r);
   return {U, m + r * pk};
 }
 
+shf::Ctxt shf::Encrypt(const shf::PrecomputedPublicKey& pk, const shf::Point& m,
+                     const shf::Scalar& r) {
+  const auto U = shf::Point::MulGenerator(r);
+  return {U, m + pk.Mul(r)};
+}
+
+std::vector<shf::Ctxt> shf::ReEncrypt(const shf::PrecomputedPublicKey& pk,
+                                    const std::vector<shf::Ctxt>& Es,
+                                    const shf::ScalarVec& rs) {
+  const std::size_t n = Es.size();
+  if (rs.size() != n) throw std::invalid_argument("invalid randomness size");
+
+  std::vector<Ctxt> randomized(n);
+  std::vector<Point> rG(n), rpk(n);
+  Point::MulGeneratorMany(rs.data(), rG.data(), n);
+  pk.MulMany(rs.data(), rpk.data(), n);
+  for (std::size_t i = 0; i < n; ++i)
+    randomized[i] = {Es[i].U + rG[i], Es[i].V + rpk[i]};
+  // the result is hashed and serialized right away, so pay for one inversion
+  // here rather than one per point later.
+  NormalizeBatch(randomized);
+  return randomized;
+}
+
+// ciphertexts are re-randomized and converted to affine this many at a time,
+// and pieces of at least kParallelCtxts go to the threads of the default pool.
+static constexpr std::size_t kCtxtChunk = 512;
+static constexpr std::size_t kParallelCtxts = 4 * kCtxtChunk;
+
+static shf::CtxtVector ReEncryptRange(const shf::PrecomputedPublicKey& pk,
+                                      const shf::CtxtVector& Es,
+                                      const shf::ScalarVec& rs,
+                                      std::size_t first, std::size_t last) {
+  using shf::Point;
+  shf::CtxtVector randomized;
+  randomized.Reserve(last - first);
+  std::vector<shf::Ctxt> chunk(kCtxtChunk);
+  std::vector<Point> rG(kCtxtChunk), rpk(kCtxtChunk);
+  for (std::size_t i = first; i < last; i += kCtxtChunk) {
+    const std::size_t m = std::min(last - i, kCtxtChunk);
+    // the multiplications of a chunk run in lockstep; see PointBatch.
+    Point::MulGeneratorMany(rs.data() + i, rG.data(), m);
+    pk.MulMany(rs.data() + i, rpk.data(), m);
+    for (std::size_t j = 0; j < m; ++j)
+      chunk[j] = {Es.U()[i + j] + rG[j], Es.V()[i + j] + rpk[j]};
+    randomized.Append(chunk.data(), m);
+  }
+  return randomized;
+}
+
+shf::CtxtVector shf::ReEncrypt(const shf::PrecomputedPublicKey& pk,
+                               const shf::CtxtVector& Es,
+                               const shf::ScalarVec& rs) {
+  const std::size_t n = Es.Size();
+  if (rs.size() != n) throw std::invalid_argument("invalid randomness size");
+
+  ThreadPool& pool = DefaultThreadPool();
+  const std::size_t parts = pool.Parts(n, kParallelCtxts);
+  if (parts == 1) return ReEncryptRange(pk, Es, rs, 0, n);
+  CtxtVector randomized;
+  randomized.Reserve(n);
+  return pool.ParallelReduce(
+      parts, std::move(randomized),
+      [&](std::size_t part) {
+        return ReEncryptRange(pk, Es, rs, part * n / parts,
+                              (part + 1) * n / parts);
+      },
+      [](CtxtVector all, const CtxtVector& part) {
+        all.Append(part);
+        return all;
+      });
+}
+
 shf::Ctxt shf::Encrypt(const shf::PublicKey& pk, const shf::Point& m) {
   return Encrypt(pk, m, shf::Scalar::CreateRandom());
 }
@@ -20,6 +104,20 @@ shf::Point shf::Decrypt(const shf::SecretKey& sk, const shf::Ctxt& ctxt) {
   return ctxt.V - sk * ctxt.U;
 }
 
+std::vector<shf::Point> shf::Decrypt(const shf::SecretKey& sk,
+                                     const shf::CtxtVector& Es) {
+  std::vector<Point> ms = MulMany(sk, Es.U());
+  const std::size_t n = ms.size();
+  ThreadPool& pool = DefaultThreadPool();
+  const std::size_t parts = pool.Parts(n, kParallelCtxts);
+  pool.ParallelFor(parts, [&](std::size_t part) {
+    const std::size_t last = (part + 1) * n / parts;
+    for (std::size_t i = part * n / parts; i < last; ++i)
+      ms[i] = Es.V()[i] - ms[i];
+  });
+  return ms;
+}
+
 shf::Ctxt shf::Add(const shf::Ctxt& E0, const shf::Ctxt& E1) {
   return {E0.U + E1.U, E0.V + E1.V};
 }
@@ -28,11 +126,128 @@ shf::Ctxt shf::Multiply(const shf::Scalar& s, const shf::Ctxt& E) {
   return {s * E.U, s * E.V};
 }
 
-shf::Ctxt shf::Dot(const std::vector<shf::Scalar>& as,
+shf::Ctxt shf::Multiply(const shf::PublicScalar& s, const shf::Ctxt& E) {
+  return {s * E.U, s * E.V};
+}
+
+shf::Ctxt shf::Dot(const shf::ScalarVec& as,
                  const std::vector<shf::Ctxt>& Es) {
-  shf::Ctxt E = shf::Multiply(as[0], Es[0]);
-  const auto n = as.size();
-  for (std::size_t i = 1; i < n; ++i)
-    E = shf::Add(E, shf::Multiply(as[i], Es[i]));
-  return E;
+  const auto UV = shf::MultiExp({UColumn(Es), VColumn(Es)}, as);
+  return {UV[0], UV[1]};
+}
+
+shf::Ctxt shf::Dot(const shf::ScalarVec& as, const shf::CtxtVector& Es) {
+  const auto UV = shf::MultiExp({UColumn(Es), VColumn(Es)}, as);
+  return {UV[0], UV[1]};
+}
+
+shf::Ctxt shf::Dot(const shf::PublicScalarVec& as, const shf::CtxtVector& Es) {
+  const auto UV = shf::MultiExp({UColumn(Es), VColumn(Es)}, as);
+  return {UV[0], UV[1]};
+}
+
+shf::Ctxt shf::SumCtxts(const std::vector<shf::Ctxt>& Es) {
+  return {SumPoints(UColumn(Es)), SumPoints(VColumn(Es))};
+}
+
+shf::Ctxt shf::SumCtxts(const shf::CtxtVector& Es) {
+  return {SumPoints(UColumn(Es)), SumPoints(VColumn(Es))};
+}
+
+void shf::NormalizeBatch(std::vector<shf::Ctxt>& Es) {
+  std::vector<Point*> ptrs;
+  ptrs.reserve(2 * Es.size());
+  for (auto& E : Es) {
+    ptrs.push_back(&E.U);
+    ptrs.push_back(&E.V);
+  }
+  Point::NormalizeBatch(ptrs.data(), ptrs.size());
+}
+
+shf::PointColumn shf::UColumn(const std::vector<shf::Ctxt>& Es) {
+  return {Es.empty() ? nullptr : &Es[0].U, Es.size(), sizeof(Ctxt)};
+}
+
+shf::PointColumn shf::VColumn(const std::vector<shf::Ctxt>& Es) {
+  return {Es.empty() ? nullptr : &Es[0].V, Es.size(), sizeof(Ctxt)};
+}
+
+shf::CtxtVector::CtxtVector(const std::vector<shf::Ctxt>& Es) {
+  Append(Es.data(), Es.size());
+}
+
+shf::CtxtVector::CtxtVector(shf::AffinePointVec U, shf::AffinePointVec V)
+    : m_U(std::move(U)), m_V(std::move(V)) {
+  if (m_U.Size() != m_V.Size())
+    throw std::invalid_argument("ciphertext columns differ in size");
+}
+
+void shf::CtxtVector::Append(const shf::Ctxt* Es, std::size_t n) {
+  // split into columns a chunk at a time; AffinePointVec normalizes each.
+  std::vector<Point> U, V;
+  U.reserve(std::min(n, kCtxtChunk));
+  V.reserve(std::min(n, kCtxtChunk));
+  for (std::size_t i = 0; i < n; i += kCtxtChunk) {
+    const std::size_t end = std::min(n, i + kCtxtChunk);
+    U.clear();
+    V.clear();
+    for (std::size_t j = i; j < end; ++j) {
+      U.push_back(Es[j].U);
+      V.push_back(Es[j].V);
+    }
+    m_U.Append(U.data(), U.size());
+    m_V.Append(V.data(), V.size());
+  }
+}
+
+void shf::CtxtVector::Append(const shf::CtxtVector& Es) {
+  m_U.Append(Es.m_U);
+  m_V.Append(Es.m_V);
+}
+
+void shf::CtxtVector::Reserve(std::size_t n) {
+  m_U.Reserve(n);
+  m_V.Reserve(n);
+}
+
+std::vector<shf::Ctxt> shf::CtxtVector::ToCtxts() const {
+  std::vector<Ctxt> Es;
+  Es.reserve(Size());
+  for (std::size_t i = 0; i < Size(); ++i) Es.push_back((*this)[i]);
+  return Es;
+}
+
+shf::CtxtVector shf::CtxtVector::Permute(
+    const std::vector<std::size_t>& perm) const {
+  return {m_U.Permute(perm), m_V.Permute(perm)};
+}
+
+shf::CtxtVector shf::CtxtVector::Permute(
+    const std::vector<uint32_t>& perm) const {
+  return {m_U.Permute(perm), m_V.Permute(perm)};
+}
+
+void shf::CtxtVector::Write(uint8_t* dest) const {
+  const std::size_t m = Point::ByteSize();
+  for (std::size_t i = 0; i < Size(); ++i) {
+    m_U[i].Write(dest + 2 * i * m);
+    m_V[i].Write(dest + (2 * i + 1) * m);
+  }
+}
+
+shf::CtxtVector shf::CtxtVector::Read(const uint8_t* bytes, std::size_t n) {
+  const std::size_t m = Point::ByteSize();
+  CtxtVector Es;
+  Es.Reserve(n);
+  std::vector<Ctxt> chunk;
+  chunk.reserve(std::min(n, kCtxtChunk));
+  for (std::size_t i = 0; i < n; i += kCtxtChunk) {
+    const std::size_t end = std::min(n, i + kCtxtChunk);
+    chunk.clear();
+    for (std::size_t j = i; j < end; ++j)
+      chunk.push_back({Point::Read(bytes + 2 * j * m),
+                       Point::Read(bytes + (2 * j + 1) * m)});
+    Es.Append(chunk.data(), chunk.size());
+  }
+  return Es;
 }
@@ -4,6 +4,7 @@
 #include <vector>
 
 #include "curve.h"
+#include "msm.h"
 
 namespace shf {
 
@@ -12,12 +13,129 @@ struct Ctxt {
   Point V;
 };
 
+/**
+ * @brief A list of ciphertexts stored as two columns.
+ *
+ * The U and V components are kept in separate AffinePointVecs, so each
+ * ciphertext takes 128 bytes and column-wise kernels (multiexps over U or V,
+ * re-encryption, serialization) read contiguous memory. Elements are converted
+ * to Ctxt when read.
+ */
+class CtxtVector {
+ public:
+  CtxtVector() = default;
+
+  CtxtVector(const std::vector<Ctxt>& Es);
+
+  /**
+   * @brief Create a vector from its columns.
+   * @throws std::invalid_argument if the columns differ in size.
+   */
+  CtxtVector(AffinePointVec U, AffinePointVec V);
+
+  /**
+   * @brief Append ciphertexts, normalizing them in batches.
+   * @param Es the ciphertexts to append
+   * @param n the number of ciphertexts
+   */
+  void Append(const Ctxt* Es, std::size_t n);
+
+  /**
+   * @brief Append the ciphertexts of another vector as they are.
+   */
+  void Append(const CtxtVector& Es);
+
+  void Reserve(std::size_t n);
+
+  std::size_t Size() const { return m_U.Size(); };
+
+  bool Empty() const { return m_U.Empty(); };
+
+  Ctxt operator[](std::size_t i) const { return {m_U[i], m_V[i]}; };
+
+  const AffinePointVec& U() const { return m_U; };
+
+  const AffinePointVec& V() const { return m_V; };
+
+  std::vector<Ctxt> ToCtxts() const;
+
+  /**
+   * @brief Reorder the ciphertexts without converting them.
+   * @param perm the new order: element i of the result is ciphertext perm[i]
+   * @return the permuted vector.
+   */
+  CtxtVector Permute(const std::vector<std::size_t>& perm) const;
+  CtxtVector Permute(const std::vector<uint32_t>& perm) const;
+
+  /**
+   * @brief The size of the serialized vector: U and V of every ciphertext in
+   * turn, each written with Point::Write.
+   */
+  std::size_t ByteSize() const { return 2 * Size() * Point::ByteSize(); };
+
+  void Write(uint8_t* dest) const;
+
+  /**
+   * @brief Read a vector written by Write.
+   * @param bytes the serialized ciphertexts
+   * @param n the number of ciphertexts
+   * @return the ciphertexts.
+   * @throws std::invalid_argument if a point is invalid.
+   */
+  static CtxtVector Read(const uint8_t* bytes, std::size_t n);
+
+ private:
+  AffinePointVec m_U;
+  AffinePointVec m_V;
+};
+
 using SecretKey = Scalar;
 using PublicKey = Point;
 
 SecretKey CreateSecretKey();
 PublicKey CreatePublicKey(const SecretKey& sk);
 
+/**
+ * @brief A public key together with a fixed-base table for it.
+ *
+ * Encrypting under a PrecomputedPublicKey replaces the variable-base
+ * multiplication r*pk with table lookups. Building the table costs a few
+ * hundred point additions, so it pays off as soon as a handful of ciphertexts
+ * are encrypted or re-randomized under the same key.
+ */
+class PrecomputedPublicKey {
+ public:
+  /**
+   * @brief Precompute a table for a public key.
+   * @param pk the public key
+   * @param width the window width in bits of the table, between 1 and 15
+   */
+  PrecomputedPublicKey(const PublicKey& pk, std::size_t width = 8)
+      : m_pk(pk), m_table(pk, width){};
+
+  const PublicKey& Key() const { return m_pk; };
+
+  /**
+   * @brief Multiply the public key by a scalar using the table, in constant
+   * time.
+   * @param r the scalar
+   * @return r*pk.
+   */
+  Point Mul(const Scalar& r) const { return m_table.Mul(r); };
+
+  /**
+   * @brief Multiply the public key by many scalars in constant time. See
+   * FixedBasePoint::MulMany.
+   */
+  void MulMany(const Scalar* rs, Point* out, std::size_t n) const {
+    m_table.MulMany(rs, out, n);
+  };
+
+ private:
+  PublicKey m_pk;
+  FixedBasePoint m_table;
+};
+
 /**
  * @brief Encrypt a message using provided randomness.
  * @param pk the public key
@@ -35,6 +153,45 @@ Ctxt Encrypt(const PublicKey& pk, const Point& m, const Scalar& r);
  */
 Ctxt Encrypt(const PublicKey& pk, const Point& m);
 
+/**
+ * @brief Encrypt a message using public randomness, in variable time.
+ *
+ * Only for recomputing ciphertexts whose randomness is public, e.g. in a
+ * verifier.
+ */
+Ctxt Encrypt(const PublicKey& pk, const Point& m, const PublicScalar& r);
+
+/**
+ * @brief Encrypt a message using provided randomness and a precomputed key.
+ * @param pk the public key
+ * @param m the message
+ * @param r randomness
+ * @return a fresh encryption of m.
+ */
+Ctxt Encrypt(const PrecomputedPublicKey& pk, const Point& m, const Scalar& r);
+
+/**
+ * @brief Re-randomize a list of ciphertexts.
+ * @param pk the public key the ciphertexts are encrypted under
+ * @param Es the ciphertexts
+ * @param rs randomness, one scalar per ciphertext
+ * @return a list E' with E'[i] = Es[i] + Enc(pk, 0 ; rs[i]). The points of
+ * the result are normalized.
+ */
+std::vector<Ctxt> ReEncrypt(const PrecomputedPublicKey& pk,
+                            const std::vector<Ctxt>& Es,
+                            const ScalarVec& rs);
+
+/**
+ * @brief Re-randomize a list of ciphertexts.
+ * @param pk the public key the ciphertexts are encrypted under
+ * @param Es the ciphertexts
+ * @param rs randomness, one scalar per ciphertext
+ * @return a list E' with E'[i] = Es[i] + Enc(pk, 0 ; rs[i]).
+ */
+CtxtVector ReEncrypt(const PrecomputedPublicKey& pk, const CtxtVector& Es,
+                     const ScalarVec& rs);
+
 /**
  * @brief Decrypt an encrypted message.
  * @param sk the decryption key
@@ -43,6 +200,18 @@ Ctxt Encrypt(const PublicKey& pk, const Point& m);
  */
 Point Decrypt(const SecretKey& sk, const Ctxt& ctxt);
 
+/**
+ * @brief Decrypt a list of ciphertexts.
+ *
+ * Multiplies all U components by sk with MulMany, which is considerably
+ * faster than decrypting the ciphertexts one at a time.
+ *
+ * @param sk the decryption key
+ * @param Es the ciphertexts
+ * @return the plaintexts, in order.
+ */
+std::vector<Point> Decrypt(const SecretKey& sk, const CtxtVector& Es);
+
 /**
  * @brief Multiply a scalar unto a ciphertext
  * @param s the scalar
@@ -51,6 +220,8 @@ Point Decrypt(const SecretKey& sk, const Ctxt& ctxt);
  */
 Ctxt Multiply(const Scalar& s, const Ctxt& E);
 
+Ctxt Multiply(const PublicScalar& s, const Ctxt& E);
+
 /**
  * @brief Homomorphically add two ciphertexts.
  * @param E0 the first ciphertext. An encryption of <code>m1</code>
@@ -61,11 +232,56 @@ Ctxt Add(const Ctxt& E0, const Ctxt& E1);
 
 /**
  * @brief Compute a "dot" product between a list of ciphertexts and scalars.
+ *
+ * Constant time in the scalars, except for the PublicScalarVec overload. See
+ * MultiExp.
+ *
  * @param as the scalars
  * @param Es the ciphertexts
  * @return a ciphertext E defined as E = sum_i as[i]*Es[i].
  */
-Ctxt Dot(const std::vector<shf::Scalar>& as, const std::vector<Ctxt>& Es);
+Ctxt Dot(const shf::ScalarVec& as, const std::vector<Ctxt>& Es);
+
+Ctxt Dot(const shf::ScalarVec& as, const CtxtVector& Es);
+
+Ctxt Dot(const shf::PublicScalarVec& as, const CtxtVector& Es);
+
+/**
+ * @brief Homomorphically add a list of ciphertexts. See SumPoints.
+ * @param Es the ciphertexts
+ * @return a ciphertext E defined as E = sum_i Es[i].
+ */
+Ctxt SumCtxts(const std::vector<Ctxt>& Es);
+
+Ctxt SumCtxts(const CtxtVector& Es);
+
+/**
+ * @brief Normalize the points of a list of ciphertexts.
+ *
+ * All U and V components share a single field inversion. See
+ * Point::NormalizeBatch.
+ *
+ * @param Es the ciphertexts to normalize
+ */
+void NormalizeBatch(std::vector<Ctxt>& Es);
+
+/**
+ * @brief View the U components of a list of ciphertexts as a column.
+ * @param Es the ciphertexts
+ * @return a column of points suitable for MultiExp.
+ */
+PointColumn UColumn(const std::vector<Ctxt>& Es);
+
+/**
+ * @brief View the V components of a list of ciphertexts as a column.
+ * @param Es the ciphertexts
+ * @return a column of points suitable for MultiExp.
+ */
+PointColumn VColumn(const std::vector<Ctxt>& Es);
+
+inline PointColumn UColumn(const CtxtVector& Es) { return Es.U(); };
+
+inline PointColumn VColumn(const CtxtVector& Es) { return Es.V(); };
 
 }  // namespace mh
 
@@ -2,35 +2,147 @@
 
 #include <stdexcept>
 
+#include "msm.h"
+#include "thread_pool.h"
+
+// keys are generated in pieces of at least this many points, one per thread
+// of the default pool.
+static constexpr std::size_t kParallelKey = 2048;
+
 shf::CommitKey shf::CreateCommitKey(const std::size_t size) {
   if (size == 0) throw std::invalid_argument("cannot create a key of size 0");
 
   CommitKey ck;
-  ck.G.reserve(size);
   ck.H = Point::CreateRandom();
-  for (std::size_t i = 0; i < size; ++i)
-    ck.G.emplace_back(Point::CreateRandom());
+  const ScalarVec gs = Scalar::CreateRandomBatch(size);
+  ThreadPool& pool = DefaultThreadPool();
+  const std::size_t parts = pool.Parts(size, kParallelKey);
+  ck.G.Reserve(size);
+  ck.G = pool.ParallelReduce(
+      parts, std::move(ck.G),
+      [&](std::size_t part) {
+        const std::size_t first = part * size / parts;
+        std::vector<Point> G((part + 1) * size / parts - first);
+        Point::MulGeneratorMany(gs.data() + first, G.data(), G.size());
+        return AffinePointVec(G);
+      },
+      [](AffinePointVec all, const AffinePointVec& part) {
+        all.Append(part);
+        return all;
+      });
   return ck;
 }
 
+void shf::Precompute(shf::CommitKey& ck, const shf::PrecomputeOptions& options) {
+  auto precomputed = std::make_shared<PrecomputedCommitKey>();
+  const std::size_t width =
+      options.width ? options.width : MultiExpWindowSize(ck.Size());
+  if (FixedBaseTable::ByteSize(ck.Size(), width) <= options.max_bytes)
+    precomputed->G = FixedBaseTable(ck.G, width);
+  precomputed->H = FixedBasePoint(ck.H, options.h_width);
+  ck.precomputed = std::move(precomputed);
+}
+
+// CommitG and CommitH take either secret or public scalars; overload
+// resolution then picks the matching multiplications. The table for G is read
+// by digit, so it only serves public scalars.
+static inline shf::Point CommitG(const shf::CommitKey& ck,
+                                 const shf::ScalarVec& m) {
+  return shf::MultiExp(ck.G, m);
+}
+
+static inline shf::Point CommitG(const shf::CommitKey& ck,
+                                 const shf::PublicScalarVec& m) {
+  const auto& pre = ck.precomputed;
+  if (pre && pre->G.Size() >= m.size()) return pre->G.MultiExp(m);
+  return shf::MultiExp(ck.G, m);
+}
+
+template <typename ScalarT>
+static inline shf::Point CommitH(const shf::CommitKey& ck, const ScalarT& r) {
+  const auto& pre = ck.precomputed;
+  if (pre && !pre->H.Empty()) return pre->H.Mul(r);
+  return r * ck.H;
+}
+
 shf::Point shf::Commit(const shf::CommitKey& ck, const shf::Scalar& r,
-                     const std::vector<shf::Scalar>& m) {
-  const std::size_t n = m.size();
-  Point C;
-  for (std::size_t i = 0; i < n; ++i) C += m[i] * ck.G[i];
-  return C + r * ck.H;
+                     const shf::ScalarVec& m) {
+  return CommitG(ck, m) + CommitH(ck, r);
+}
+
+shf::Point shf::Commit(const shf::CommitKey& ck, const shf::PublicScalar& r,
+                       const shf::PublicScalarVec& m) {
+  return CommitG(ck, m) + CommitH(ck, r);
 }
 
 shf::CommitmentAndRandomness shf::Commit(const shf::CommitKey& ck,
-                                       const std::vector<shf::Scalar>& m) {
+                                       const shf::ScalarVec& m) {
   const auto r = Scalar::CreateRandom();
   const auto C = Commit(ck, r, m);
   return {C, r};
 }
 
+shf::Point shf::Commit(const shf::CommitKey& ck, const shf::Scalar& r,
+                       const std::vector<std::size_t>& m) {
+  return MultiExpSmall(ck.G, m) + CommitH(ck, r);
+}
+
+shf::CommitmentAndRandomness shf::Commit(const shf::CommitKey& ck,
+                                         const std::vector<std::size_t>& m) {
+  const auto r = Scalar::CreateRandom();
+  return {Commit(ck, r, m), r};
+}
+
+shf::Point shf::Commit(const shf::CommitKey& ck, const shf::Scalar& r,
+                       const std::vector<uint32_t>& m) {
+  return MultiExpSmall(ck.G, m) + CommitH(ck, r);
+}
+
+shf::CommitmentAndRandomness shf::Commit(const shf::CommitKey& ck,
+                                         const std::vector<uint32_t>& m) {
+  const auto r = Scalar::CreateRandom();
+  return {Commit(ck, r, m), r};
+}
+
+shf::Point shf::Commit(const shf::CommitKey& ck, const shf::Scalar& r,
+                       const shf::Scalar& m) {
+  return m * ck.G[0] + CommitH(ck, r);
+}
+
+shf::CommitmentAndRandomness shf::Commit(const shf::CommitKey& ck,
+                                         const shf::Scalar& m) {
+  const auto r = Scalar::CreateRandom();
+  return {Commit(ck, r, m), r};
+}
+
+shf::CommitmentAndDot shf::CommitAndDot(const shf::CommitKey& ck,
+                                        const shf::Scalar& r,
+                                        const shf::ScalarVec& m,
+                                        const shf::CtxtVector& Es) {
+  const auto R = MultiExp({ck.G, UColumn(Es), VColumn(Es)}, m);
+  return {R[0] + CommitH(ck, r), r, {R[1], R[2]}};
+}
+
+shf::CommitmentAndDot shf::CommitAndDot(const shf::CommitKey& ck,
+                                        const shf::ScalarVec& m,
+                                        const shf::CtxtVector& Es) {
+  return CommitAndDot(ck, Scalar::CreateRandom(), m, Es);
+}
+
+shf::CommitmentAndDot shf::CommitAndDot(const shf::CommitKey& ck,
+                                        const shf::PublicScalar& r,
+                                        const shf::PublicScalarVec& m,
+                                        const shf::CtxtVector& Es) {
+  const auto& pre = ck.precomputed;
+  const auto R = pre && pre->G.Size() >= m.size()
+                     ? pre->G.MultiExp(m, {UColumn(Es), VColumn(Es)})
+                     : MultiExp({ck.G, UColumn(Es), VColumn(Es)}, m);
+  return {R[0] + CommitH(ck, r), r, {R[1], R[2]}};
+}
+
 bool shf::CheckCommitment(const shf::CommitKey& ck, const shf::Point& comm,
                          const shf::Scalar& r,
-                         const std::vector<shf::Scalar>& m) {
+                         const shf::ScalarVec& m) {
   const auto comm_ = Commit(ck, r, m);
   return comm_ == comm;
 }
@@ -1,34 +1,180 @@
 #ifndef SHF_COMMIT_H
 #define SHF_COMMIT_H
 
+#include <memory>
 #include <vector>
 
+#include "cipher.h"
 #include "curve.h"
+#include "msm.h"
 
 namespace shf {
 
+/**
+ * @brief Options for precomputing fixed-base tables for a commit key.
+ */
+struct PrecomputeOptions {
+  /**
+   * @brief Window width in bits of the table for G, between 1 and 15.
+   *
+   * Wider windows mean fewer additions per commitment and a smaller table for
+   * G (about Size()*(256/width) points). 0 picks the width MultiExp would use.
+   * The table is read by digit, so only commitments to public values use it.
+   */
+  std::size_t width = 0;
+
+  /**
+   * @brief Window width in bits of the table for H, between 1 and 15.
+   *
+   * The table for H holds about (256/h_width)*2^(h_width-1) points.
+   */
+  std::size_t h_width = 8;
+
+  /**
+   * @brief Upper bound in bytes on the size of the table for G.
+   *
+   * If the table would be larger, it is not built and commitments fall back to
+   * a plain multiexp against G. H is precomputed regardless.
+   *
+   * The default of 0 builds no table for G. It only serves commitments to
+   * public values, saves a few percent on those, and takes far longer to build
+   * than a commitment (seconds for 20000 generators), so it has to be asked
+   * for.
+   */
+  std::size_t max_bytes = 0;
+};
+
+/**
+ * @brief Fixed-base tables for the generators of a commit key.
+ */
+struct PrecomputedCommitKey {
+  FixedBaseTable G;
+  FixedBasePoint H;
+
+  std::size_t ByteSize() const { return G.ByteSize() + H.ByteSize(); };
+};
+
 struct CommitKey {
-  std::vector<Point> G;
+  AffinePointVec G;
   Point H;
 
-  std::size_t Size() const { return G.size(); };
+  /**
+   * @brief Optional fixed-base tables for G and H. See Precompute.
+   *
+   * Shared between copies of the key, since the tables never change.
+   */
+  std::shared_ptr<const PrecomputedCommitKey> precomputed;
+
+  std::size_t Size() const { return G.Size(); };
 };
 
 CommitKey CreateCommitKey(const std::size_t size);
 
+/**
+ * @brief Build fixed-base tables for a commit key.
+ *
+ * After this, commitments under the key (and its copies) use the tables
+ * instead of variable-base multiplications against G and H. Commitments to
+ * secret values only use the table for H, which is constant time. With the
+ * default options only the table for H is built.
+ *
+ * @param ck the commit key
+ * @param options table widths and memory bound
+ */
+void Precompute(CommitKey& ck, const PrecomputeOptions& options = {});
+
 struct CommitmentAndRandomness {
   Point C;
   Scalar r;
 };
 
 CommitmentAndRandomness Commit(const CommitKey& ck,
-                               const std::vector<Scalar>& m);
+                               const ScalarVec& m);
 
 Point Commit(const CommitKey& ck, const Scalar& r,
-             const std::vector<Scalar>& m);
+             const ScalarVec& m);
+
+/**
+ * @brief Commit to a vector of small non-negative integers, such as a
+ * permutation.
+ *
+ * Uses MultiExpSmall for G, so it is much cheaper than committing to the same
+ * values as Scalars. The bit length of the largest value is not kept secret.
+ *
+ * @param ck the commit key
+ * @param m the messages, each below 2^32
+ * @return the commitment and its randomness.
+ */
+CommitmentAndRandomness Commit(const CommitKey& ck,
+                               const std::vector<std::size_t>& m);
+
+Point Commit(const CommitKey& ck, const Scalar& r,
+             const std::vector<std::size_t>& m);
+
+CommitmentAndRandomness Commit(const CommitKey& ck,
+                               const std::vector<uint32_t>& m);
+
+Point Commit(const CommitKey& ck, const Scalar& r,
+             const std::vector<uint32_t>& m);
+
+/**
+ * @brief Commit to a single value with the first generator of G.
+ *
+ * The randomness term goes through the H table when ck is precomputed.
+ */
+CommitmentAndRandomness Commit(const CommitKey& ck, const Scalar& m);
+
+Point Commit(const CommitKey& ck, const Scalar& r, const Scalar& m);
+
+/**
+ * @brief Recompute a commitment to public values in variable time. Used by
+ * verifiers.
+ */
+Point Commit(const CommitKey& ck, const PublicScalar& r,
+             const PublicScalarVec& m);
+
+/**
+ * @brief A commitment to a vector m together with Dot(m, Es).
+ */
+struct CommitmentAndDot {
+  Point C;
+  Scalar r;
+  Ctxt E;
+};
+
+/**
+ * @brief Commit to a vector and multiply it onto a list of ciphertexts.
+ *
+ * Computes Commit(ck, r, m) and Dot(m, Es) with a single multiexp over the
+ * columns ck.G, Es.U and Es.V, so the scalars in m are only processed once.
+ *
+ * @param ck the commit key
+ * @param r the commitment randomness
+ * @param m the messages
+ * @param Es the ciphertexts
+ * @return the commitment, r and Dot(m, Es).
+ */
+CommitmentAndDot CommitAndDot(const CommitKey& ck, const Scalar& r,
+                              const ScalarVec& m, const CtxtVector& Es);
+
+/**
+ * @brief Like CommitAndDot, but with fresh commitment randomness.
+ */
+CommitmentAndDot CommitAndDot(const CommitKey& ck, const ScalarVec& m,
+                              const CtxtVector& Es);
+
+/**
+ * @brief Like CommitAndDot, but for public values and in variable time. Used
+ * by verifiers.
+ *
+ * If the key has a table for G, the shifted bases join the bucket pass over
+ * Es.U and Es.V (see FixedBaseTable::MultiExp), so it is still a single pass.
+ */
+CommitmentAndDot CommitAndDot(const CommitKey& ck, const PublicScalar& r,
+                              const PublicScalarVec& m, const CtxtVector& Es);
 
 bool CheckCommitment(const CommitKey& ck, const Point& comm, const Scalar& r,
-                     const std::vector<Scalar>& m);
+                     const ScalarVec& m);
 
 }  // namespace mh
 
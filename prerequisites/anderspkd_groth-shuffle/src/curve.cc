@@ -1,16 +1,20 @@
 #include "curve.h"
 
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
 #include <iostream>
+#include <mutex>
 #include <stdexcept>
 
-static int k_relic_initialized = 0;
-static bn_t k_curve_order;
+#include "thread_pool.h"
 
-void shf::CurveInit() {
-  if (k_relic_initialized) {
-    return;
-  }
+static std::once_flag k_relic_initialized;
+
+// relic is built without MULTI, so all threads share one RNG state.
+static std::mutex k_relic_rand_mutex;
 
+static void RelicInit() {
   core_init();
   if (err_get_code() != RLC_OK) {
     throw std::runtime_error("relic core_init() failed");
@@ -22,190 +26,418 @@ void shf::CurveInit() {
     throw std::runtime_error("relic ec_param_set_any() failed");
   }
 
-  bn_new(k_curve_order);
-  ec_curve_get_ord(k_curve_order);
+  // scalars, and by default points, are hardcoded to P-256, so relic must
+  // agree on the curve.
+  if (ep_param_get() != NIST_P256) {
+    core_clean();
+    throw std::runtime_error("relic is not configured for NIST P-256");
+  }
+}
+
+void shf::CurveInit() {
+  // a call that throws leaves the flag unset, so the next call retries.
+  std::call_once(k_relic_initialized, RelicInit);
+}
 
-  k_relic_initialized = 1;
+// The generator random scalars are read from, seeded from relic's RNG the
+// first time a thread needs it.
+static shf::Prg& ThreadPrg() {
+  static thread_local shf::Prg prg = [] {
+    uint8_t seed[shf::Prg::SeedSize()];
+    {
+      std::lock_guard<std::mutex> lock(k_relic_rand_mutex);
+      rand_bytes(seed, sizeof(seed));
+    }
+    return shf::Prg(seed);
+  }();
+  return prg;
 }
 
 shf::Point shf::Point::Generator() {
   Point g;
-  ec_curve_get_gen(g.m_internal);
+  PointBackend::Generator(g.m_internal);
   return g;
 }
 
+shf::Point shf::Point::MulGenerator(const shf::Scalar& scalar) {
+  uint64_t k[4];
+  scalar.GetLimbs(k);
+  Point r;
+  PointBackend::MulGenerator(r.m_internal, k);
+  return r;
+}
+
+shf::Point shf::Point::MulGenerator(const shf::PublicScalar& scalar) {
+  uint64_t k[4];
+  scalar.GetLimbs(k);
+  Point r;
+  PointBackend::MulGeneratorVartime(r.m_internal, k);
+  return r;
+}
+
 shf::Point shf::Point::CreateRandom() {
+  return MulGenerator(Scalar::CreateRandom());
+}
+
+shf::Point shf::Point::Read(const uint8_t* bytes) {
   Point p;
-  ec_rand(p.m_internal);
+  if (!bytes[0] && !PointBackend::ReadCompressed(p.m_internal, bytes + 1))
+    throw std::invalid_argument("invalid point encoding");
   return p;
 }
 
-shf::Point shf::Point::Read(const uint8_t* bytes) {
+shf::Point shf::Point::ReadUncompressed(const uint8_t* bytes) {
+  const std::size_t n = PointBackend::kFieldBytes;
+  if (bytes[0] != 0x04)
+    throw std::invalid_argument("expected uncompressed point prefix 0x04");
+
   Point p;
-  if (!bytes[0]) ec_read_bin(p.m_internal, bytes + 1, ByteSize() - 1);
+  const uint8_t* xy = bytes + 1;
+  if (std::all_of(xy, xy + 2 * n, [](uint8_t b) { return b == 0; })) return p;
+  if (!PointBackend::ReadAffine(p.m_internal, xy, xy + n))
+    throw std::invalid_argument("invalid point encoding");
   return p;
 }
 
-shf::Point::Point() {
-  ec_new(m_internal);
-  ec_set_infty(m_internal);
+shf::Point::Point() { PointBackend::Infinity(m_internal); }
+
+bool shf::Point::IsInfinity() const {
+  return PointBackend::IsInfinity(m_internal);
+}
+
+void shf::Point::NormalizeBatch(shf::Point* const* points, std::size_t n) {
+  std::vector<PointBackend::Element*> elements;
+  elements.reserve(n);
+  for (std::size_t i = 0; i < n; ++i) elements.push_back(&points[i]->m_internal);
+  PointBackend::NormalizeBatch(elements.data(), n);
 }
 
-shf::Point::~Point() { ec_free(m_internal); }
+void shf::NormalizeBatch(std::vector<shf::Point>& points) {
+  std::vector<Point*> ptrs;
+  ptrs.reserve(points.size());
+  for (auto& p : points) ptrs.push_back(&p);
+  Point::NormalizeBatch(ptrs.data(), ptrs.size());
+}
+
+// points are normalized this many at a time when converted to affine, which
+// bounds the temporary memory while keeping the inversion cost negligible.
+static constexpr std::size_t kAffineChunk = 1024;
 
-shf::Point::Point(const shf::Point& other) {
-  ec_new(m_internal);
-  ec_copy(m_internal, other.m_internal);
+shf::AffinePointVec::AffinePointVec(const std::vector<shf::Point>& points) {
+  Append(points.data(), points.size());
 }
 
-shf::Point::Point(shf::Point&& other) {
-  ec_new(m_internal);
-  ec_copy(m_internal, other.m_internal);
+void shf::AffinePointVec::Append(const shf::Point* points, std::size_t n) {
+  m_points.reserve(m_points.size() + n);
+  std::vector<Point> chunk;
+  for (std::size_t i = 0; i < n; i += kAffineChunk) {
+    const std::size_t m = std::min(kAffineChunk, n - i);
+    chunk.assign(points + i, points + i + m);
+    shf::NormalizeBatch(chunk);
+    for (const auto& p : chunk) {
+      m_points.emplace_back();
+      p.ToAffine(m_points.back());
+    }
+  }
 }
 
-shf::Point& shf::Point::operator=(const shf::Point& other) {
-  ec_copy(m_internal, other.m_internal);
-  return *this;
+void shf::AffinePointVec::Append(const shf::AffinePointVec& points) {
+  m_points.insert(m_points.end(), points.m_points.begin(),
+                  points.m_points.end());
 }
 
-shf::Point& shf::Point::operator=(shf::Point&& other) {
-  ec_copy(m_internal, other.m_internal);
-  return *this;
+std::vector<shf::Point> shf::AffinePointVec::ToPoints() const {
+  std::vector<Point> points;
+  points.reserve(Size());
+  for (std::size_t i = 0; i < Size(); ++i) points.emplace_back((*this)[i]);
+  return points;
 }
 
-bool shf::Point::IsInfinity() const { return ec_is_infty(m_internal) == 1; }
+template <typename Index>
+static std::vector<shf::PointBackend::Affine> PermuteAffine(
+    const std::vector<shf::PointBackend::Affine>& points,
+    const std::vector<Index>& perm) {
+  if (perm.size() != points.size())
+    throw std::invalid_argument("invalid permutation size");
+  std::vector<shf::PointBackend::Affine> permuted;
+  permuted.reserve(points.size());
+  for (const auto idx : perm) permuted.push_back(points[idx]);
+  return permuted;
+}
+
+shf::AffinePointVec shf::AffinePointVec::Permute(
+    const std::vector<std::size_t>& perm) const {
+  AffinePointVec permuted;
+  permuted.m_points = PermuteAffine(m_points, perm);
+  return permuted;
+}
+
+shf::AffinePointVec shf::AffinePointVec::Permute(
+    const std::vector<uint32_t>& perm) const {
+  AffinePointVec permuted;
+  permuted.m_points = PermuteAffine(m_points, perm);
+  return permuted;
+}
 
 shf::Point shf::Point::operator+(const shf::Point& other) const {
   Point r;
-  ec_add(r.m_internal, m_internal, other.m_internal);
+  PointBackend::Add(r.m_internal, m_internal, other.m_internal);
   return r;
 }
 
 shf::Point shf::Point::operator-(const shf::Point& other) const {
   Point r;
-  ec_sub(r.m_internal, m_internal, other.m_internal);
+  PointBackend::Sub(r.m_internal, m_internal, other.m_internal);
+  return r;
+}
+
+shf::Point shf::Point::operator-() const {
+  Point r;
+  PointBackend::Negate(r.m_internal, m_internal);
+  return r;
+}
+
+shf::Point shf::Point::Double() const {
+  Point r;
+  PointBackend::Double(r.m_internal, m_internal);
   return r;
 }
 
 shf::Point& shf::Point::operator+=(const shf::Point& other) {
-  ec_add(m_internal, m_internal, other.m_internal);
+  PointBackend::Add(m_internal, m_internal, other.m_internal);
   return *this;
 }
 
 shf::Point& shf::Point::operator-=(const shf::Point& other) {
-  ec_sub(m_internal, m_internal, other.m_internal);
+  PointBackend::Sub(m_internal, m_internal, other.m_internal);
   return *this;
 }
 
 shf::Point shf::Point::operator*(const shf::Scalar& scalar) const {
+  uint64_t k[4];
+  scalar.GetLimbs(k);
   Point r;
-  ec_mul(r.m_internal, m_internal, scalar.m_internal);
+  PointBackend::Mul(r.m_internal, m_internal, k);
   return r;
 }
 
-bool shf::Point::operator==(const shf::Point& other) const {
-  return ec_cmp(m_internal, other.m_internal) == RLC_EQ;
+shf::Point shf::Point::MulVartime(const shf::PublicScalar& scalar) const {
+  uint64_t k[4];
+  scalar.GetLimbs(k);
+  Point r;
+  PointBackend::MulVartime(r.m_internal, m_internal, k);
+  return r;
 }
 
-void shf::Point::Write(uint8_t* dest) const {
-  if (IsInfinity())
-    dest[0] = 1;
-  else {
-    dest[0] = 0;
-    ec_write_bin(dest + 1, ByteSize() - 1, m_internal, 1);
-  }
+shf::Point shf::Point::MulAdd2(const shf::Scalar& a, const shf::Point& P,
+                               const shf::Scalar& b, const shf::Point& Q) {
+  uint64_t k[4], l[4];
+  a.GetLimbs(k);
+  b.GetLimbs(l);
+  Point r;
+  PointBackend::MulAdd2(r.m_internal, k, P.m_internal, l, Q.m_internal);
+  return r;
 }
 
-shf::Scalar::Scalar() {
-  bn_new(m_internal);
-  bn_zero(m_internal);
+shf::Point shf::Point::MulAdd2(const shf::PublicScalar& a, const shf::Point& P,
+                               const shf::PublicScalar& b,
+                               const shf::Point& Q) {
+  uint64_t k[4], l[4];
+  a.GetLimbs(k);
+  b.GetLimbs(l);
+  Point r;
+  PointBackend::MulAdd2Vartime(r.m_internal, k, P.m_internal, l, Q.m_internal);
+  return r;
 }
 
-shf::Scalar::~Scalar() { bn_free(m_internal); }
+void shf::Point::MulMany(const shf::Scalar& scalar, const shf::Point* points,
+                         shf::Point* out, std::size_t n) {
+  uint64_t k[4];
+  scalar.GetLimbs(k);
+  std::vector<PointBackend::Element> elements;
+  elements.reserve(n);
+  for (std::size_t i = 0; i < n; ++i) elements.push_back(points[i].m_internal);
+  PointBackend::MulMany(elements.data(), k, elements.data(), n);
+  for (std::size_t i = 0; i < n; ++i) out[i].m_internal = elements[i];
+}
 
-shf::Scalar::Scalar(const shf::Scalar& other) {
-  bn_new(m_internal);
-  bn_copy(m_internal, other.m_internal);
+void shf::Point::MulGeneratorMany(const shf::Scalar* scalars, shf::Point* out,
+                                  std::size_t n) {
+  std::vector<uint64_t> limbs(4 * n);
+  for (std::size_t i = 0; i < n; ++i) scalars[i].GetLimbs(limbs.data() + 4 * i);
+  std::vector<PointBackend::Element> elements(n);
+  PointBackend::MulGeneratorMany(elements.data(), limbs.data(), n);
+  for (std::size_t i = 0; i < n; ++i) out[i].m_internal = elements[i];
 }
 
-shf::Scalar::Scalar(shf::Scalar&& other) {
-  bn_new(m_internal);
-  bn_copy(m_internal, other.m_internal);
+void shf::PointBatch::Load(const shf::Point* const points[kLanes]) {
+  const PointBackend::Element* elements[kLanes];
+  for (std::size_t i = 0; i < kLanes; ++i) elements[i] = &points[i]->m_internal;
+  m_batch.Load(elements);
 }
 
-shf::Scalar& shf::Scalar::operator=(const shf::Scalar& other) {
-  bn_copy(m_internal, other.m_internal);
-  return *this;
+void shf::PointBatch::Store(shf::Point* const points[kLanes]) const {
+  PointBackend::Element* elements[kLanes];
+  for (std::size_t i = 0; i < kLanes; ++i) elements[i] = &points[i]->m_internal;
+  m_batch.Store(elements);
 }
 
-shf::Scalar& shf::Scalar::operator=(shf::Scalar&& other) {
-  bn_copy(m_internal, other.m_internal);
-  return *this;
+void shf::PointBatch::Add(const PointBackend::Affine Q[kLanes],
+                          uint32_t skip) {
+  for (std::size_t i = 0; i < kLanes; ++i)
+    if (PointBackend::IsInfinity(Q[i])) skip |= UINT32_C(1) << i;
+  m_batch.AddMixed(Q, skip);
 }
 
-bool shf::Scalar::IsZero() const { return bn_is_zero(m_internal) == 1; }
+bool shf::Point::operator==(const shf::Point& other) const {
+  return PointBackend::Equal(m_internal, other.m_internal);
+}
+
+void shf::Point::Write(uint8_t* dest) const {
+  if (IsInfinity()) {
+    // the rest is zeroed so the encoding is fully determined, e.g. for hashing.
+    dest[0] = 1;
+    std::memset(dest + 1, 0, ByteSize() - 1);
+  } else {
+    dest[0] = 0;
+    PointBackend::WriteCompressed(dest + 1, m_internal);
+  }
+}
+
+void shf::Point::WriteUncompressed(uint8_t* dest) const {
+  const std::size_t n = PointBackend::kFieldBytes;
+  dest[0] = 0x04;
+  if (IsInfinity())
+    std::fill(dest + 1, dest + 1 + 2 * n, 0);
+  else
+    PointBackend::WriteAffine(dest + 1, dest + 1 + n, m_internal);
+}
+
+bool shf::Scalar::IsZero() const { return m_internal.IsZero(); }
 
 shf::Scalar shf::Scalar::operator+(const shf::Scalar& other) const {
   Scalar r;
-  bn_add(r.m_internal, m_internal, other.m_internal);
-  bn_mod(r.m_internal, r.m_internal, k_curve_order);
+  r.m_internal = m_internal + other.m_internal;
   return r;
 }
 
 shf::Scalar shf::Scalar::operator-(const shf::Scalar& other) const {
   Scalar r;
-  bn_sub(r.m_internal, m_internal, other.m_internal);
-  bn_mod(r.m_internal, r.m_internal, k_curve_order);
+  r.m_internal = m_internal - other.m_internal;
   return r;
 }
 
 shf::Scalar shf::Scalar::operator*(const shf::Scalar& other) const {
   Scalar r;
-  bn_mul(r.m_internal, m_internal, other.m_internal);
-  bn_mod(r.m_internal, r.m_internal, k_curve_order);
+  r.m_internal = m_internal * other.m_internal;
   return r;
 }
 
 shf::Scalar shf::Scalar::operator-() const {
   Scalar r;
-  bn_sub(r.m_internal, k_curve_order, m_internal);
+  r.m_internal = -m_internal;
   return r;
 }
 
 shf::Scalar& shf::Scalar::operator+=(const shf::Scalar& other) {
-  bn_add(m_internal, m_internal, other.m_internal);
-  bn_mod(m_internal, m_internal, k_curve_order);
+  m_internal += other.m_internal;
+  return *this;
+}
+
+shf::Scalar& shf::Scalar::operator-=(const shf::Scalar& other) {
+  m_internal -= other.m_internal;
   return *this;
 }
 
 shf::Scalar& shf::Scalar::operator*=(const shf::Scalar& other) {
-  bn_mul(m_internal, m_internal, other.m_internal);
-  bn_mod(m_internal, m_internal, k_curve_order);
+  m_internal *= other.m_internal;
   return *this;
 }
 
 bool shf::Scalar::operator==(const shf::Scalar& other) const {
-  return bn_cmp(m_internal, other.m_internal) == RLC_EQ;
+  return m_internal == other.m_internal;
 }
 
-void shf::Scalar::Write(uint8_t* dest) const {
-  bn_write_bin(dest, ByteSize(), m_internal);
+void shf::Scalar::Write(uint8_t* dest) const { m_internal.Write(dest); }
+
+void shf::Scalar::GetLimbs(uint64_t limbs[4]) const {
+  const p256::Fn c = m_internal.Canonical();
+  for (std::size_t i = 0; i < 4; ++i) limbs[i] = c.v[i];
+}
+
+void shf::Scalar::Print() const {
+  uint8_t bytes[ByteSize()];
+  Write(bytes);
+  for (const uint8_t b : bytes) std::printf("%02X", b);
+  std::printf("\n");
 }
 
 shf::Scalar shf::Scalar::CreateRandom() {
+  // rejection sampling; a 256-bit integer is below the order except with
+  // probability about 2^-32.
+  uint8_t bytes[ByteSize()];
   Scalar s;
-  bn_rand_mod(s.m_internal, k_curve_order);
+  bool reduced = false;
+  while (!reduced) {
+    ThreadPrg().Fill(bytes, ByteSize());
+    s.m_internal = p256::Fn::Read(bytes, &reduced);
+  }
   return s;
 }
 
+// CreateRandomBatch draws each run of kRandomStream scalars from its own fork
+// of the Prg, so the runs can be generated in parallel and in any order, and
+// reads kRandomChunk scalars per Fill.
+static constexpr std::size_t kRandomStream = 4096;
+static constexpr std::size_t kRandomChunk = 64;
+
+std::vector<shf::Scalar> shf::Scalar::CreateRandomBatch(std::size_t n,
+                                                        shf::Prg& prg) {
+  std::vector<Scalar> scalars(n);
+  if (!n) return scalars;
+
+  // the forks are taken from a generator keyed with the next block of prg, so
+  // every call gets fresh streams.
+  uint8_t seed[Prg::SeedSize()];
+  prg.Fill(seed, sizeof(seed));
+  const Prg base(seed);
+
+  const std::size_t runs = (n + kRandomStream - 1) / kRandomStream;
+  DefaultThreadPool().ParallelFor(runs, [&](std::size_t run) {
+    uint8_t bytes[kRandomChunk * ByteSize()];
+    Prg stream = base.Fork(run);
+    const std::size_t last = std::min(n, (run + 1) * kRandomStream);
+    for (std::size_t first = run * kRandomStream; first < last;
+         first += kRandomChunk) {
+      const std::size_t m = std::min(kRandomChunk, last - first);
+      stream.Fill(bytes, m * ByteSize());
+      for (std::size_t i = 0; i < m; ++i) {
+        uint8_t* b = bytes + i * ByteSize();
+        bool reduced = false;
+        scalars[first + i].m_internal = p256::Fn::Read(b, &reduced);
+        // see CreateRandom.
+        while (!reduced) {
+          stream.Fill(b, ByteSize());
+          scalars[first + i].m_internal = p256::Fn::Read(b, &reduced);
+        }
+      }
+    }
+  });
+  return scalars;
+}
+
+std::vector<shf::Scalar> shf::Scalar::CreateRandomBatch(std::size_t n) {
+  return CreateRandomBatch(n, ThreadPrg());
+}
+
 shf::Scalar shf::Scalar::CreateFromInt(unsigned int v) {
   Scalar s;
-  bn_set_dig(s.m_internal, (dig_t)v);
+  s.m_internal = p256::Fn::FromInt(v);
   return s;
 }
 
 shf::Scalar shf::Scalar::Read(const uint8_t* bytes) {
   Scalar s;
-  bn_read_bin(s.m_internal, bytes, ByteSize());
+  s.m_internal = p256::Fn::Read(bytes);
   return s;
 }
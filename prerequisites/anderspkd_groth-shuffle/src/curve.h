@@ -1,42 +1,87 @@
 #ifndef SHF_CURVE_H
 #define SHF_CURVE_H
 
-#include <gmp.h>
-
 #include <cstdint>
+#include <type_traits>
+#include <vector>
 
-extern "C" {
-#include "include/relic/relic.h"
-}
+#include "backend.h"
+#include "prg.h"
 
 namespace shf {
 
 /**
  * @brief Initializes relic. Must be called before anything else.
+ *
+ * Calls after the first successful one return at once, and concurrent calls
+ * wait for a single initialization.
+ *
+ * Concurrency: once CurveInit has returned, the library may be used from any
+ * number of threads, under the standard library's rule that an object may be
+ * read by several threads at once but written by only one, with no readers at
+ * the same time. Keys, commit keys and their tables are only read after they
+ * are built, so threads can share them; a Hash, Prg, Transcript or Shuffler
+ * belongs to one thread at a time. relic is built without MULTI, so it has one
+ * context for the whole process. After initialization the library only reads
+ * it, except for relic's RNG, which is used behind a lock and only to seed a
+ * Prg per thread. Large loops inside the library run on DefaultThreadPool
+ * (see thread_pool.h).
  */
 void CurveInit();
 
-class Point;
-
+/**
+ * @brief An integer modulo the order of the curve group.
+ *
+ * Backed by a fixed-width Montgomery representation specialized for the P-256
+ * group order (see p256.h), so arithmetic never allocates or divides.
+ */
 class Scalar {
  public:
-  // internal access needed for scalar multiplications.
-  friend class Point;
-
+  /**
+   * @brief Sample a uniformly random scalar from the calling thread's Prg
+   * (see CreateRandomBatch).
+   */
   static Scalar CreateRandom();
   static Scalar CreateFromInt(unsigned int v);
+
+  /**
+   * @brief Sample n uniformly random scalars from a Prg.
+   *
+   * The Prg output is read in bulk, 32 bytes per scalar, and the rare values
+   * at or above the group order are redrawn, so the scalars are unbiased.
+   * Only one block is read from prg itself: runs of scalars come from forks of
+   * a generator seeded with it (see Prg::Fork), so the result does not depend
+   * on the order in which the runs are generated.
+   *
+   * @param n the number of scalars
+   * @param prg the generator to read from
+   */
+  static std::vector<Scalar> CreateRandomBatch(std::size_t n, Prg& prg);
+
+  /**
+   * @brief Sample n uniformly random scalars for secret use.
+   *
+   * Reads from a Prg that each thread seeds once from relic's RNG, so the
+   * hash DRBG only runs for the seed.
+   */
+  static std::vector<Scalar> CreateRandomBatch(std::size_t n);
+
+  /**
+   * @brief Read a 32-byte big-endian integer, reduced modulo the group order.
+   */
   static Scalar Read(const uint8_t* bytes);
 
   static constexpr std::size_t ByteSize() { return 32; };
 
-  Scalar();
-  ~Scalar();
+  Scalar() : m_internal(p256::Fn::Zero()){};
 
-  Scalar(const Scalar& other);
-  Scalar(Scalar&& other);
+  // Scalars are plain 32-byte values: copies and moves are memberwise and
+  // vectors of them can be relocated with memcpy.
+  Scalar(const Scalar& other) = default;
+  Scalar(Scalar&& other) = default;
 
-  Scalar& operator=(const Scalar& other);
-  Scalar& operator=(Scalar&& other);
+  Scalar& operator=(const Scalar& other) = default;
+  Scalar& operator=(Scalar&& other) = default;
 
   bool IsZero() const;
 
@@ -53,36 +98,136 @@ class Scalar {
   bool operator==(const Scalar& other) const;
   bool operator!=(const Scalar& other) const { return !(*this == other); };
 
+  /**
+   * @brief Write the scalar as a 32-byte big-endian integer.
+   */
   void Write(uint8_t* dest) const;
 
-  void Print() const { bn_print(m_internal); }
+  /**
+   * @brief Get the integer this scalar represents.
+   * @param limbs receives four 64-bit limbs, least significant first
+   */
+  void GetLimbs(uint64_t limbs[4]) const;
+
+  void Print() const;
 
  private:
-  bn_t m_internal;
+  p256::Fn m_internal;
+};
+
+/**
+ * @brief A scalar that is known to everyone, such as a challenge or a value
+ * from a proof.
+ *
+ * Multiplying a point by a Scalar runs in constant time. Multiplying by a
+ * PublicScalar uses variable-time algorithms instead, which are faster but
+ * leak the scalar through timing. Verifiers only handle public values and use
+ * PublicScalar throughout; a Scalar only becomes public through the explicit
+ * constructor. A PublicScalar can be used wherever a Scalar is expected.
+ */
+class PublicScalar : public Scalar {
+ public:
+  PublicScalar() = default;
+
+  explicit PublicScalar(const Scalar& s) : Scalar(s){};
 };
 
+/**
+ * @brief A vector of public scalars.
+ */
+using PublicScalarVec = std::vector<PublicScalar>;
+
 class Point {
  public:
   static Point Generator();
+
+  /**
+   * @brief Multiply the generator by a scalar.
+   *
+   * Uses the fixed-base table the backend precomputes for the generator, which
+   * is several times faster than <code>Generator() * scalar</code>.
+   *
+   * @param scalar the scalar
+   * @return scalar*G.
+   */
+  static Point MulGenerator(const Scalar& scalar);
+
+  /**
+   * @brief Multiply the generator by a public scalar in variable time.
+   */
+  static Point MulGenerator(const PublicScalar& scalar);
+
+  /**
+   * @brief Multiply the generator by many scalars.
+   *
+   * The scalars walk the generator table in lockstep through a PointBatch.
+   * Constant time, like MulGenerator.
+   *
+   * @param scalars the scalars
+   * @param out receives scalars[i]*G for each i
+   * @param n the number of scalars
+   */
+  static void MulGeneratorMany(const Scalar* scalars, Point* out,
+                               std::size_t n);
+
   static Point CreateRandom();
   static Point Read(const uint8_t* bytes);
 
-  static std::size_t ByteSize() { return 2 + RLC_FP_BYTES; };
+  /**
+   * @brief Read a point in SEC1 uncompressed form (0x04 || x || y).
+   *
+   * An all-zero x and y is read as the point at infinity, mirroring
+   * WriteUncompressed.
+   *
+   * @param bytes the UncompressedByteSize() bytes to read
+   * @return the point.
+   * @throws std::invalid_argument if the bytes do not encode a point.
+   */
+  static Point ReadUncompressed(const uint8_t* bytes);
+
+  static constexpr std::size_t ByteSize() {
+    return 2 + PointBackend::kFieldBytes;
+  };
+
+  static constexpr std::size_t UncompressedByteSize() {
+    return 1 + 2 * PointBackend::kFieldBytes;
+  };
 
   Point();
-  ~Point();
 
-  Point(const Point& other);
-  Point(Point&& other);
+  // Points hold their coordinates inline, so copies and moves are memberwise
+  // like Scalar.
+  Point(const Point& other) = default;
+  Point(Point&& other) = default;
 
-  Point& operator=(const Point& other);
-  Point& operator=(Point&& other);
+  Point& operator=(const Point& other) = default;
+  Point& operator=(Point&& other) = default;
 
   bool IsInfinity() const;
 
+  /**
+   * @brief Normalize a list of points to affine coordinates.
+   *
+   * Uses Montgomery's simultaneous inversion, so the whole list costs a single
+   * field inversion plus three multiplications per point. Normalized points
+   * are cheaper to serialize, hash, compare and add.
+   *
+   * @param points pointers to the points to normalize
+   * @param n the number of points
+   */
+  static void NormalizeBatch(Point* const* points, std::size_t n);
+
   Point operator+(const Point& other) const;
   Point operator-(const Point& other) const;
 
+  Point operator-() const;
+
+  /**
+   * @brief Double this point.
+   * @return 2*P, computed with a dedicated doubling formula.
+   */
+  Point Double() const;
+
   Point& operator+=(const Point& other);
   Point& operator-=(const Point& other);
 
@@ -91,16 +236,212 @@ class Point {
     return point * scalar;
   };
 
+  /**
+   * @brief Multiply this point by a public scalar in variable time.
+   */
+  Point MulVartime(const PublicScalar& scalar) const;
+
+  Point operator*(const PublicScalar& scalar) const {
+    return MulVartime(scalar);
+  };
+
+  /**
+   * @brief Compute a*P + b*Q with a single chain of doublings.
+   *
+   * Cheaper than computing the two products separately. Constant time, like
+   * <code>a * P</code>.
+   */
+  static Point MulAdd2(const Scalar& a, const Point& P, const Scalar& b,
+                       const Point& Q);
+
+  /**
+   * @brief Compute a*P + b*Q for public a and b in variable time, using
+   * interleaved NAFs.
+   */
+  static Point MulAdd2(const PublicScalar& a, const Point& P,
+                       const PublicScalar& b, const Point& Q);
+  friend Point operator*(const PublicScalar& scalar, const Point& point) {
+    return point.MulVartime(scalar);
+  };
+
+  /**
+   * @brief Multiply many points by the same scalar.
+   *
+   * The scalar is recoded once and the backend shares work between the points
+   * (see PointBackend::MulMany). Constant time in the scalar.
+   *
+   * @param scalar the scalar
+   * @param points the points
+   * @param out receives scalar*points[i] for each i. May alias points.
+   * @param n the number of points
+   */
+  static void MulMany(const Scalar& scalar, const Point* points, Point* out,
+                      std::size_t n);
+
   bool operator==(const Point& other) const;
   bool operator!=(const Point& other) const { return !(*this == other); }
 
+  /**
+   * @brief Write ByteSize() bytes: a zero byte and the SEC1 compressed point,
+   * or a one byte and zeros for the point at infinity.
+   */
   void Write(uint8_t* dest) const;
 
-  void Print() const { ec_print(m_internal); }
+  /**
+   * @brief Write this point in SEC1 uncompressed form (0x04 || x || y).
+   *
+   * The point at infinity is written with x and y set to zero.
+   *
+   * @param dest where to write UncompressedByteSize() bytes
+   */
+  void WriteUncompressed(uint8_t* dest) const;
+
+  /**
+   * @brief Convert to the backend's compact affine form.
+   *
+   * Costs a field inversion unless the point is normalized.
+   */
+  void ToAffine(PointBackend::Affine& dest) const {
+    PointBackend::ToAffine(dest, m_internal);
+  };
+
+  static Point FromAffine(const PointBackend::Affine& a) {
+    Point p;
+    PointBackend::FromAffine(p.m_internal, a);
+    return p;
+  };
+
+  void Print() const { PointBackend::Print(m_internal); }
 
  private:
-  ec_t m_internal;
+  friend class PointBatch;
+
+  PointBackend::Element m_internal;
 };
 
+/**
+ * @brief PointBatch::kLanes points that are updated in lockstep.
+ *
+ * Backends with vectorized field arithmetic run all lanes through one
+ * instruction stream (see p256::Batch). Points are converted to and from the
+ * lane representation by Load and Store, so a batch pays off for sequences of
+ * additions such as fixed-base multiplications and bucket accumulation.
+ */
+class PointBatch {
+ public:
+  static constexpr std::size_t kLanes = PointBackend::Batch::kLanes;
+
+  /**
+   * @brief Set lane i to *points[i].
+   */
+  void Load(const Point* const points[kLanes]);
+
+  /**
+   * @brief Write lane i to *points[i].
+   */
+  void Store(Point* const points[kLanes]) const;
+
+  /**
+   * @brief Add Q[i] to lane i, except for the lanes whose bit is set in skip.
+   *
+   * Lanes where Q[i] is infinity are skipped as well, so which of the Q[i] are
+   * infinity is not kept secret.
+   */
+  void Add(const PointBackend::Affine Q[kLanes], uint32_t skip);
+
+  void Double() { m_batch.Double(); };
+
+  /**
+   * @brief Whether the backend updates the lanes with vector instructions.
+   * If not, a batch is no faster than updating the points one by one.
+   */
+  static bool Vectorized() { return PointBackend::Batch::Vectorized(); };
+
+ private:
+  PointBackend::Batch m_batch;
+};
+
+/**
+ * @brief A vector of points stored in affine coordinates.
+ *
+ * Each point takes exactly two field elements (64 bytes), a third less than a
+ * Point. Elements are converted to Point when read; the result is normalized,
+ * so adding it uses the cheaper mixed formulas. Meant for large vectors of
+ * points that are read many times, like commitment keys and precomputed
+ * tables.
+ */
+class AffinePointVec {
+ public:
+  AffinePointVec() = default;
+
+  AffinePointVec(const std::vector<Point>& points);
+
+  /**
+   * @brief Append points, normalizing them in batches.
+   * @param points the points to append
+   * @param n the number of points
+   */
+  void Append(const Point* points, std::size_t n);
+
+  /**
+   * @brief Append the points of another vector as they are.
+   */
+  void Append(const AffinePointVec& points);
+
+  void Reserve(std::size_t n) { m_points.reserve(n); };
+
+  std::size_t Size() const { return m_points.size(); };
+
+  bool Empty() const { return m_points.empty(); };
+
+  Point operator[](std::size_t i) const {
+    return Point::FromAffine(m_points[i]);
+  };
+
+  std::vector<Point> ToPoints() const;
+
+  /**
+   * @brief Reorder the points without converting them.
+   * @param perm the new order: element i of the result is point perm[i]
+   * @return the permuted vector.
+   * @throws std::invalid_argument if perm has the wrong size.
+   */
+  AffinePointVec Permute(const std::vector<std::size_t>& perm) const;
+  AffinePointVec Permute(const std::vector<uint32_t>& perm) const;
+
+  std::size_t ByteSize() const {
+    return m_points.size() * sizeof(PointBackend::Affine);
+  };
+
+  const PointBackend::Affine* Data() const { return m_points.data(); };
+
+ private:
+  std::vector<PointBackend::Affine> m_points;
+};
+
+/**
+ * @brief Storage for vectors of scalars.
+ *
+ * A Scalar is exactly its 32-byte Montgomery representation, so a plain vector
+ * is already packed and needs no conversion in kernels.
+ */
+using ScalarVec = std::vector<Scalar>;
+
+static_assert(sizeof(Scalar) == Scalar::ByteSize(),
+              "scalars must be stored without overhead");
+
+static_assert(sizeof(PublicScalar) == sizeof(Scalar),
+              "public scalars must be stored like scalars");
+
+static_assert(std::is_trivially_copyable<Scalar>::value &&
+                  std::is_trivially_copyable<Point>::value,
+              "scalars and points must be cheap to copy and relocate");
+
+/**
+ * @brief Normalize a list of points with a single field inversion.
+ * @param points the points to normalize
+ */
+void NormalizeBatch(std::vector<Point>& points);
+
 }  // namespace mh
 #endif  // SHF_CURVE_H
@@ -0,0 +1,306 @@
+#ifndef SHF_FP256_H
+#define SHF_FP256_H
+
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+namespace shf {
+
+__extension__ typedef unsigned __int128 uint128_t;
+
+/**
+ * @brief Arithmetic modulo a fixed 256-bit odd modulus.
+ *
+ * Elements are four 64-bit limbs (least significant first) in Montgomery form
+ * with R = 2^256. <code>Params</code> supplies the modulus and its Montgomery
+ * constants as <code>static constexpr</code> members:
+ *
+ *   kModulus  the modulus M
+ *   kN0       -M^-1 mod 2^64
+ *   kR2       R^2 mod M
+ *   kOne      R mod M
+ *
+ * Since all constants are known at compile time, the compiler specializes the
+ * reduction for each modulus (for P-256's field, kN0 == 1 and one limb of the
+ * modulus is zero). Multiplication uses MULX/ADX when the target has them.
+ *
+ * All operations run in time independent of the values of their operands,
+ * except for the ones explicitly marked as variable time.
+ */
+template <typename Params>
+struct Fp256 {
+  uint64_t v[4];
+
+  static constexpr std::size_t ByteSize() { return 32; };
+
+  static Fp256 Zero() { return {{0, 0, 0, 0}}; };
+
+  static Fp256 One() {
+    return {{Params::kOne[0], Params::kOne[1], Params::kOne[2],
+             Params::kOne[3]}};
+  };
+
+  /**
+   * @brief Convert a small integer into Montgomery form.
+   */
+  static Fp256 FromInt(uint64_t x) {
+    Fp256 r = {{x, 0, 0, 0}};
+    return r * R2();
+  };
+
+  /**
+   * @brief Read a big-endian integer and convert it to Montgomery form.
+   * @param bytes the 32 bytes to read
+   * @param reduced if not null, set to whether the integer was less than M
+   * @return the element, reduced modulo M.
+   */
+  static Fp256 Read(const uint8_t* bytes, bool* reduced = nullptr) {
+    Fp256 r;
+    for (std::size_t i = 0; i < 4; ++i) {
+      uint64_t limb = 0;
+      const uint8_t* p = bytes + 8 * (3 - i);
+      for (std::size_t j = 0; j < 8; ++j) limb = (limb << 8) | p[j];
+      r.v[i] = limb;
+    }
+    uint64_t borrow = SubModulus(r.v);
+    if (reduced) *reduced = borrow != 0;
+    // borrow means r < M, in which case the subtraction is undone.
+    CondAddModulus(r.v, borrow);
+    return r * R2();
+  };
+
+  /**
+   * @brief Write the canonical big-endian integer of this element.
+   */
+  void Write(uint8_t* dest) const {
+    const Fp256 c = Canonical();
+    for (std::size_t i = 0; i < 4; ++i) {
+      uint64_t limb = c.v[i];
+      uint8_t* p = dest + 8 * (3 - i);
+      for (std::size_t j = 8; j-- > 0;) {
+        p[j] = static_cast<uint8_t>(limb);
+        limb >>= 8;
+      }
+    }
+  };
+
+  /**
+   * @brief Leave Montgomery form.
+   * @return the limbs of the canonical integer this element represents.
+   */
+  Fp256 Canonical() const {
+    const Fp256 one = {{1, 0, 0, 0}};
+    return *this * one;
+  };
+
+  bool IsZero() const { return (v[0] | v[1] | v[2] | v[3]) == 0; };
+
+  bool operator==(const Fp256& o) const {
+    return ((v[0] ^ o.v[0]) | (v[1] ^ o.v[1]) | (v[2] ^ o.v[2]) |
+            (v[3] ^ o.v[3])) == 0;
+  };
+  bool operator!=(const Fp256& o) const { return !(*this == o); };
+
+  Fp256 operator+(const Fp256& o) const {
+    Fp256 r;
+    unsigned char c = 0;
+    c = AddCarry(c, v[0], o.v[0], &r.v[0]);
+    c = AddCarry(c, v[1], o.v[1], &r.v[1]);
+    c = AddCarry(c, v[2], o.v[2], &r.v[2]);
+    c = AddCarry(c, v[3], o.v[3], &r.v[3]);
+    // subtract M if the sum overflowed or is at least M.
+    uint64_t t[4] = {r.v[0], r.v[1], r.v[2], r.v[3]};
+    const uint64_t borrow = SubModulus(t);
+    const uint64_t keep = Mask(borrow & ~static_cast<uint64_t>(c));
+    for (std::size_t i = 0; i < 4; ++i)
+      r.v[i] = (r.v[i] & keep) | (t[i] & ~keep);
+    return r;
+  };
+
+  Fp256 operator-(const Fp256& o) const {
+    Fp256 r;
+    unsigned char b = 0;
+    b = SubBorrow(b, v[0], o.v[0], &r.v[0]);
+    b = SubBorrow(b, v[1], o.v[1], &r.v[1]);
+    b = SubBorrow(b, v[2], o.v[2], &r.v[2]);
+    b = SubBorrow(b, v[3], o.v[3], &r.v[3]);
+    CondAddModulus(r.v, b);
+    return r;
+  };
+
+  Fp256 operator-() const { return Zero() - *this; };
+
+  Fp256 operator*(const Fp256& o) const {
+    Fp256 r;
+    MontMul(r.v, v, o.v);
+    return r;
+  };
+
+  Fp256& operator+=(const Fp256& o) { return *this = *this + o; };
+  Fp256& operator-=(const Fp256& o) { return *this = *this - o; };
+  Fp256& operator*=(const Fp256& o) { return *this = *this * o; };
+
+  Fp256 Square() const { return *this * *this; };
+
+  Fp256 Double() const { return *this + *this; };
+
+  /**
+   * @brief Raise to a fixed power.
+   * @param e the exponent as four limbs, least significant first. The
+   * exponent is public; the base may be secret.
+   */
+  Fp256 Pow(const uint64_t e[4]) const {
+    Fp256 r = One();
+    for (std::size_t i = 4; i-- > 0;) {
+      for (std::size_t j = 64; j-- > 0;) {
+        r = r.Square();
+        if ((e[i] >> j) & 1) r = r * *this;
+      }
+    }
+    return r;
+  };
+
+  /**
+   * @brief Invert this element using Fermat's little theorem.
+   * @return 1/x, or 0 if x is 0.
+   */
+  Fp256 Invert() const {
+    uint64_t e[4] = {Params::kModulus[0] - 2, Params::kModulus[1],
+                     Params::kModulus[2], Params::kModulus[3]};
+    return Pow(e);
+  };
+
+  /**
+   * @brief Select between two elements in constant time.
+   * @return a if bit == 0 and b if bit == 1.
+   */
+  static Fp256 Select(uint64_t bit, const Fp256& a, const Fp256& b) {
+    const uint64_t m = Mask(bit);
+    Fp256 r;
+    for (std::size_t i = 0; i < 4; ++i) r.v[i] = (a.v[i] & ~m) | (b.v[i] & m);
+    return r;
+  };
+
+  static Fp256 R2() {
+    return {{Params::kR2[0], Params::kR2[1], Params::kR2[2], Params::kR2[3]}};
+  };
+
+  // all ones if bit is 1 and zero if bit is 0.
+  static uint64_t Mask(uint64_t bit) { return 0 - (bit & 1); };
+
+  static unsigned char AddCarry(unsigned char c, uint64_t a, uint64_t b,
+                                uint64_t* out) {
+#if defined(__ADX__)
+    unsigned long long o;
+    c = _addcarryx_u64(c, a, b, &o);
+    *out = o;
+    return c;
+#elif defined(__x86_64__)
+    unsigned long long o;
+    c = _addcarry_u64(c, a, b, &o);
+    *out = o;
+    return c;
+#else
+    const uint128_t t = (uint128_t)a + b + c;
+    *out = static_cast<uint64_t>(t);
+    return static_cast<unsigned char>(t >> 64);
+#endif
+  };
+
+  static unsigned char SubBorrow(unsigned char b, uint64_t x, uint64_t y,
+                                 uint64_t* out) {
+#if defined(__x86_64__)
+    unsigned long long o;
+    b = _subborrow_u64(b, x, y, &o);
+    *out = o;
+    return b;
+#else
+    const uint128_t t = (uint128_t)x - y - b;
+    *out = static_cast<uint64_t>(t);
+    return static_cast<unsigned char>((t >> 64) & 1);
+#endif
+  };
+
+  // hi:lo = a * b
+  static uint64_t MulWide(uint64_t a, uint64_t b, uint64_t* hi) {
+#if defined(__BMI2__)
+    unsigned long long h;
+    const uint64_t lo = _mulx_u64(a, b, &h);
+    *hi = h;
+    return lo;
+#else
+    const uint128_t t = (uint128_t)a * b;
+    *hi = static_cast<uint64_t>(t >> 64);
+    return static_cast<uint64_t>(t);
+#endif
+  };
+
+  // t -= M, returning the borrow.
+  static uint64_t SubModulus(uint64_t t[4]) {
+    unsigned char b = 0;
+    b = SubBorrow(b, t[0], Params::kModulus[0], &t[0]);
+    b = SubBorrow(b, t[1], Params::kModulus[1], &t[1]);
+    b = SubBorrow(b, t[2], Params::kModulus[2], &t[2]);
+    b = SubBorrow(b, t[3], Params::kModulus[3], &t[3]);
+    return b;
+  };
+
+  // t += M if bit is 1.
+  static void CondAddModulus(uint64_t t[4], uint64_t bit) {
+    const uint64_t m = Mask(bit);
+    unsigned char c = 0;
+    c = AddCarry(c, t[0], Params::kModulus[0] & m, &t[0]);
+    c = AddCarry(c, t[1], Params::kModulus[1] & m, &t[1]);
+    c = AddCarry(c, t[2], Params::kModulus[2] & m, &t[2]);
+    c = AddCarry(c, t[3], Params::kModulus[3] & m, &t[3]);
+  };
+
+  // r = a * b / R mod M (CIOS). r may alias a or b.
+  static void MontMul(uint64_t r[4], const uint64_t a[4], const uint64_t b[4]) {
+    uint64_t t[6] = {0, 0, 0, 0, 0, 0};
+    for (std::size_t i = 0; i < 4; ++i) {
+      // t += a * b[i]
+      uint64_t carry = 0;
+      for (std::size_t j = 0; j < 4; ++j) {
+        uint64_t hi;
+        const uint64_t lo = MulWide(a[j], b[i], &hi);
+        unsigned char c = AddCarry(0, t[j], lo, &t[j]);
+        hi += c;
+        c = AddCarry(0, t[j], carry, &t[j]);
+        carry = hi + c;
+      }
+      unsigned char c = AddCarry(0, t[4], carry, &t[4]);
+      t[5] = c;
+
+      // t = (t + m*M) / 2^64, with m chosen so the low limb vanishes.
+      const uint64_t m = t[0] * Params::kN0;
+      uint64_t hi;
+      uint64_t lo = MulWide(m, Params::kModulus[0], &hi);
+      c = AddCarry(0, t[0], lo, &lo);
+      carry = hi + c;
+      for (std::size_t j = 1; j < 4; ++j) {
+        lo = MulWide(m, Params::kModulus[j], &hi);
+        c = AddCarry(0, t[j], lo, &t[j - 1]);
+        hi += c;
+        c = AddCarry(0, t[j - 1], carry, &t[j - 1]);
+        carry = hi + c;
+      }
+      c = AddCarry(0, t[4], carry, &t[3]);
+      t[4] = t[5] + c;
+    }
+
+    // t < 2M, so a single conditional subtraction reduces it.
+    uint64_t s[4] = {t[0], t[1], t[2], t[3]};
+    const uint64_t borrow = SubModulus(s);
+    const uint64_t keep = Mask(borrow & ~t[4]);
+    for (std::size_t i = 0; i < 4; ++i) r[i] = (t[i] & keep) | (s[i] & ~keep);
+  };
+};
+
+}  // namespace shf
+
+#endif  // SHF_FP256_H
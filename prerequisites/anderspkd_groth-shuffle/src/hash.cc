@@ -1,9 +1,13 @@
 #include "hash.h"
 
+#include <algorithm>
 #include <cstring>
+#include <stdexcept>
 #include <vector>
 
-static const uint64_t keccakf_rndc[24] = {
+#include "thread_pool.h"
+
+static const uint64_t kRoundConstants[24] = {
     0x0000000000000001ULL, 0x0000000000008082ULL, 0x800000000000808aULL,
     0x8000000080008000ULL, 0x000000000000808bULL, 0x0000000080000001ULL,
     0x8000000080008081ULL, 0x8000000000008009ULL, 0x000000000000008aULL,
@@ -13,50 +17,273 @@ static const uint64_t keccakf_rndc[24] = {
     0x000000000000800aULL, 0x800000008000000aULL, 0x8000000080008081ULL,
     0x8000000000008080ULL, 0x0000000080000001ULL, 0x8000000080008008ULL};
 
-static const unsigned int keccakf_rotc[24] = {1,  3,  6,  10, 15, 21, 28, 36,
-                                              45, 55, 2,  14, 27, 41, 56, 8,
-                                              25, 43, 62, 18, 39, 61, 20, 44};
+// constant rotations, which compile to a single rorx with BMI2.
+static inline uint64_t Rol(uint64_t x, unsigned n) {
+  return (x << n) | (x >> (64 - n));
+}
+
+// Lanes are named by column (a, e, i, o, u) after row (b, g, k, m, s), so
+// lane x + 5*y of the state is "bgkms"[y] "aeiou"[x].
+#define KECCAK_LANES(X)                                                    \
+  X(ba, 0) X(be, 1) X(bi, 2) X(bo, 3) X(bu, 4) X(ga, 5) X(ge, 6) X(gi, 7)  \
+  X(go, 8) X(gu, 9) X(ka, 10) X(ke, 11) X(ki, 12) X(ko, 13) X(ku, 14)      \
+  X(ma, 15) X(me, 16) X(mi, 17) X(mo, 18) X(mu, 19) X(sa, 20) X(se, 21)    \
+  X(si, 22) X(so, 23) X(su, 24)
 
-static const unsigned int keccakf_piln[24] = {10, 7,  11, 17, 18, 3,  5,  16,
-                                              8,  21, 24, 4,  15, 23, 19, 13,
-                                              12, 2,  20, 14, 22, 9,  6,  1};
+// One round from state A to state E, with theta's column parities of E
+// computed on the way for the next round. Lanes be, bi, go, ki, mi and sa are
+// kept complemented, which turns most of chi's and-nots into plain ands and
+// ors (the "lane complementing" transform of the Keccak implementation
+// overview).
+#define KECCAK_ROUND(i, A, E)                  \
+  Da = Cu ^ Rol(Ce, 1);                        \
+  De = Ca ^ Rol(Ci, 1);                        \
+  Di = Ce ^ Rol(Co, 1);                        \
+  Do = Ci ^ Rol(Cu, 1);                        \
+  Du = Co ^ Rol(Ca, 1);                        \
+                                               \
+  B0 = A##ba ^ Da;                             \
+  B1 = Rol(A##ge ^ De, 44);                    \
+  B2 = Rol(A##ki ^ Di, 43);                    \
+  B3 = Rol(A##mo ^ Do, 21);                    \
+  B4 = Rol(A##su ^ Du, 14);                    \
+  E##ba = B0 ^ (B1 | B2) ^ kRoundConstants[i]; \
+  E##be = B1 ^ (~B2 | B3);                     \
+  E##bi = B2 ^ (B3 & B4);                      \
+  E##bo = B3 ^ (B4 | B0);                      \
+  E##bu = B4 ^ (B0 & B1);                      \
+  Ca = E##ba;                                  \
+  Ce = E##be;                                  \
+  Ci = E##bi;                                  \
+  Co = E##bo;                                  \
+  Cu = E##bu;                                  \
+                                               \
+  B0 = Rol(A##bo ^ Do, 28);                    \
+  B1 = Rol(A##gu ^ Du, 20);                    \
+  B2 = Rol(A##ka ^ Da, 3);                     \
+  B3 = Rol(A##me ^ De, 45);                    \
+  B4 = Rol(A##si ^ Di, 61);                    \
+  E##ga = B0 ^ (B1 | B2);                      \
+  E##ge = B1 ^ (B2 & B3);                      \
+  E##gi = B2 ^ (B3 | ~B4);                     \
+  E##go = B3 ^ (B4 | B0);                      \
+  E##gu = B4 ^ (B0 & B1);                      \
+  Ca ^= E##ga;                                 \
+  Ce ^= E##ge;                                 \
+  Ci ^= E##gi;                                 \
+  Co ^= E##go;                                 \
+  Cu ^= E##gu;                                 \
+                                               \
+  B0 = Rol(A##be ^ De, 1);                     \
+  B1 = Rol(A##gi ^ Di, 6);                     \
+  B2 = Rol(A##ko ^ Do, 25);                    \
+  B3 = Rol(A##mu ^ Du, 8);                     \
+  B4 = Rol(A##sa ^ Da, 18);                    \
+  E##ka = B0 ^ (B1 | B2);                      \
+  E##ke = B1 ^ (B2 & B3);                      \
+  E##ki = B2 ^ (~B3 & B4);                     \
+  E##ko = ~B3 ^ (B4 | B0);                     \
+  E##ku = B4 ^ (B0 & B1);                      \
+  Ca ^= E##ka;                                 \
+  Ce ^= E##ke;                                 \
+  Ci ^= E##ki;                                 \
+  Co ^= E##ko;                                 \
+  Cu ^= E##ku;                                 \
+                                               \
+  B0 = Rol(A##bu ^ Du, 27);                    \
+  B1 = Rol(A##ga ^ Da, 36);                    \
+  B2 = Rol(A##ke ^ De, 10);                    \
+  B3 = Rol(A##mi ^ Di, 15);                    \
+  B4 = Rol(A##so ^ Do, 56);                    \
+  E##ma = B0 ^ (B1 & B2);                      \
+  E##me = B1 ^ (B2 | B3);                      \
+  E##mi = B2 ^ (~B3 | B4);                     \
+  E##mo = ~B3 ^ (B4 & B0);                     \
+  E##mu = B4 ^ (B0 | B1);                      \
+  Ca ^= E##ma;                                 \
+  Ce ^= E##me;                                 \
+  Ci ^= E##mi;                                 \
+  Co ^= E##mo;                                 \
+  Cu ^= E##mu;                                 \
+                                               \
+  B0 = Rol(A##bi ^ Di, 62);                    \
+  B1 = Rol(A##go ^ Do, 55);                    \
+  B2 = Rol(A##ku ^ Du, 39);                    \
+  B3 = Rol(A##ma ^ Da, 41);                    \
+  B4 = Rol(A##se ^ De, 2);                     \
+  E##sa = B0 ^ (~B1 & B2);                     \
+  E##se = ~B1 ^ (B2 | B3);                     \
+  E##si = B2 ^ (B3 & B4);                      \
+  E##so = B3 ^ (B4 | B0);                      \
+  E##su = B4 ^ (B0 & B1);                      \
+  Ca ^= E##sa;                                 \
+  Ce ^= E##se;                                 \
+  Ci ^= E##si;                                 \
+  Co ^= E##so;                                 \
+  Cu ^= E##su;
 
-static inline uint64_t rotl64(uint64_t x, uint64_t y) {
-  return (x << y) | (x >> ((sizeof(uint64_t) * 8) - y));
+// The whole permutation, for lanes of type Lane, which may be a SIMD vector
+// holding the same lane of several states. LOAD(i) reads lane i and
+// STORE(i, v) writes it.
+#define KECCAK_DECLARE(name, i) \
+  Lane A##name = LOAD(i);       \
+  Lane E##name;
+#define KECCAK_STORE(name, i) STORE(i, A##name);
+#define KECCAK_PERMUTE()                                  \
+  KECCAK_LANES(KECCAK_DECLARE)                            \
+  Abe = ~Abe;                                             \
+  Abi = ~Abi;                                             \
+  Ago = ~Ago;                                             \
+  Aki = ~Aki;                                             \
+  Ami = ~Ami;                                             \
+  Asa = ~Asa;                                             \
+  Lane Ca = Aba ^ Aga ^ Aka ^ Ama ^ Asa;                  \
+  Lane Ce = Abe ^ Age ^ Ake ^ Ame ^ Ase;                  \
+  Lane Ci = Abi ^ Agi ^ Aki ^ Ami ^ Asi;                  \
+  Lane Co = Abo ^ Ago ^ Ako ^ Amo ^ Aso;                  \
+  Lane Cu = Abu ^ Agu ^ Aku ^ Amu ^ Asu;                  \
+  Lane Da, De, Di, Do, Du, B0, B1, B2, B3, B4;            \
+  for (std::size_t round = 0; round < 24; round += 2) {   \
+    KECCAK_ROUND(round, A, E)                             \
+    KECCAK_ROUND(round + 1, E, A)                         \
+  }                                                       \
+  Abe = ~Abe;                                             \
+  Abi = ~Abi;                                             \
+  Ago = ~Ago;                                             \
+  Aki = ~Aki;                                             \
+  Ami = ~Ami;                                             \
+  Asa = ~Asa;                                             \
+  KECCAK_LANES(KECCAK_STORE)
+
+static void keccakf(uint64_t state[25]) {
+  using Lane = uint64_t;
+#define LOAD(i) state[i]
+#define STORE(i, v) state[i] = v
+  KECCAK_PERMUTE()
+#undef LOAD
+#undef STORE
 }
 
-static inline void keccakf(uint64_t state[25]) {
-  uint64_t t;
-  uint64_t bc[5];
+// Multi-buffer permutations: the same lane of several states is kept in one
+// vector, so every instruction advances all of them. The kernels are compiled
+// for AVX2 and AVX-512 regardless of -march and picked at runtime, as in
+// p256_batch.cc.
+#if defined(__x86_64__)
+#define SHF_HAVE_KECCAK_KERNELS 1
+#define SHF_AVX2 __attribute__((target("avx2")))
+#define SHF_AVX512 __attribute__((target("avx512f")))
 
-  for (std::size_t round = 0; round < 24; ++round) {
-    for (std::size_t i = 0; i < 5; ++i)
-      bc[i] = state[i] ^ state[i + 5] ^ state[i + 10] ^ state[i + 15] ^
-              state[i + 20];
+typedef uint64_t Lanes4 __attribute__((vector_size(32)));
+typedef uint64_t Lanes8 __attribute__((vector_size(64)));
 
-    for (std::size_t i = 0; i < 5; ++i) {
-      t = bc[(i + 4) % 5] ^ rotl64(bc[(i + 1) % 5], 1);
-      for (std::size_t j = 0; j < 25; j += 5) state[j + i] ^= t;
-    }
+SHF_AVX2 static inline Lanes4 Rol(Lanes4 x, unsigned n) {
+  return (x << n) | (x >> (64 - n));
+}
 
-    t = state[1];
-    for (std::size_t i = 0; i < 24; ++i) {
-      const uint64_t v = keccakf_piln[i];
-      bc[0] = state[v];
-      state[v] = rotl64(t, keccakf_rotc[i]);
-      t = bc[0];
-    }
+// compiles to vprolq.
+SHF_AVX512 static inline Lanes8 Rol(Lanes8 x, unsigned n) {
+  return (x << n) | (x >> (64 - n));
+}
 
-    for (std::size_t j = 0; j < 25; j += 5) {
-      for (std::size_t i = 0; i < 5; ++i) bc[i] = state[j + i];
-      for (std::size_t i = 0; i < 5; ++i)
-        state[j + i] ^= (~bc[(i + 1) % 5]) & bc[(i + 2) % 5];
-    }
+SHF_AVX2 static void KeccakX4(uint64_t* const* states) {
+  using Lane = Lanes4;
+#define LOAD(i) Lane{states[0][i], states[1][i], states[2][i], states[3][i]}
+#define STORE(i, v) \
+  for (std::size_t k = 0; k < 4; ++k) states[k][i] = v[k]
+  KECCAK_PERMUTE()
+#undef LOAD
+#undef STORE
+}
+
+SHF_AVX512 static void KeccakX8(uint64_t* const* states) {
+  using Lane = Lanes8;
+#define LOAD(i)                                                            \
+  Lane{states[0][i], states[1][i], states[2][i], states[3][i],             \
+       states[4][i], states[5][i], states[6][i], states[7][i]}
+#define STORE(i, v) \
+  for (std::size_t k = 0; k < 8; ++k) states[k][i] = v[k]
+  KECCAK_PERMUTE()
+#undef LOAD
+#undef STORE
+}
+
+static std::size_t KeccakLanes() {
+  static const std::size_t lanes = __builtin_cpu_supports("avx512f")  ? 8
+                                   : __builtin_cpu_supports("avx2") ? 4
+                                                                    : 1;
+  return lanes;
+}
+
+#else
+
+static std::size_t KeccakLanes() { return 1; }
+
+#endif  // __x86_64__
 
-    state[0] ^= keccakf_rndc[round];
+#undef KECCAK_PERMUTE
+#undef KECCAK_STORE
+#undef KECCAK_DECLARE
+#undef KECCAK_ROUND
+#undef KECCAK_LANES
+
+// Permute n states, as many at a time as the CPU allows.
+static void KeccakMany(uint64_t* const* states, std::size_t n) {
+  std::size_t i = 0;
+#if defined(SHF_HAVE_KECCAK_KERNELS)
+  const std::size_t lanes = KeccakLanes();
+  if (lanes == 8)
+    for (; i + 8 <= n; i += 8) KeccakX8(states + i);
+  if (lanes >= 4)
+    for (; i + 4 <= n; i += 4) KeccakX4(states + i);
+#endif
+  for (; i < n; ++i) keccakf(states[i]);
+}
+
+const char* shf::HashKernel() {
+  switch (KeccakLanes()) {
+    case 8:
+      return "avx512";
+    case 4:
+      return "avx2";
+    default:
+      return "scalar";
   }
 }
 
+static inline uint64_t LoadLane(const uint8_t* p) {
+  uint64_t lane;
+  std::memcpy(&lane, p, sizeof(lane));
+  return lane;
+}
+
+// Before the fix, the word path of Update built each lane from byte 0 and
+// seven copies of byte 1.
+static inline uint64_t LoadLegacyLane(const uint8_t* p) {
+  return uint64_t(p[0]) | uint64_t(p[1]) * 0x0101010101010100ULL;
+}
+
+shf::Hash shf::Hash::Legacy() {
+  Hash hash;
+  hash.mLegacy = true;
+  return hash;
+}
+
+bool shf::Hash::Fresh() const {
+  return Position() == 0 &&
+         std::all_of(mState, mState + kStateSize,
+                     [](uint64_t lane) { return lane == 0; });
+}
+
+void shf::Hash::Permute() {
+  keccakf(mState);
+  mWordIndex = 0;
+}
+
+void shf::Hash::AbsorbLane(uint64_t lane) {
+  if (mWordIndex == kCutoff) Permute();
+  mState[mWordIndex++] ^= lane;
+}
+
 shf::Hash& shf::Hash::Update(const uint8_t* bytes, std::size_t nbytes) {
   unsigned int old_tail = (8 - mByteIndex) & 7;
   const uint8_t* p = bytes;
@@ -70,33 +297,27 @@ shf::Hash& shf::Hash::Update(const uint8_t* bytes, std::size_t nbytes) {
     nbytes -= old_tail;
     while (old_tail--) mSaved |= (uint64_t)(*(p++)) << ((mByteIndex++) * 8);
 
-    mState[mWordIndex] ^= mSaved;
+    AbsorbLane(mSaved);
     mByteIndex = 0;
     mSaved = 0;
-
-    if (++mWordIndex == kCutoff) {
-      keccakf(mState);
-      mWordIndex = 0;
-    }
   }
 
   std::size_t words = nbytes / sizeof(uint64_t);
   unsigned int tail = nbytes - words * sizeof(uint64_t);
 
-  for (std::size_t i = 0; i < words; ++i) {
-    const uint64_t t =
-        (uint64_t)(p[0]) | ((uint64_t)(p[1]) << 8 * 1) |
-        ((uint64_t)(p[1]) << 8 * 2) | ((uint64_t)(p[1]) << 8 * 3) |
-        ((uint64_t)(p[1]) << 8 * 4) | ((uint64_t)(p[1]) << 8 * 5) |
-        ((uint64_t)(p[1]) << 8 * 6) | ((uint64_t)(p[1]) << 8 * 7);
-
-    mState[mWordIndex] ^= t;
-
-    if (++mWordIndex == kCutoff) {
-      keccakf(mState);
-      mWordIndex = 0;
+  if (mLegacy) {
+    for (; words; --words, p += sizeof(uint64_t)) AbsorbLane(LoadLegacyLane(p));
+  } else {
+    // fill up the current block, then absorb whole blocks at a time.
+    for (; words && mWordIndex % kCutoff; --words, p += sizeof(uint64_t))
+      AbsorbLane(LoadLane(p));
+    for (; words >= kCutoff; words -= kCutoff) {
+      if (mWordIndex == kCutoff) Permute();
+      for (std::size_t i = 0; i < kCutoff; ++i, p += sizeof(uint64_t))
+        mState[i] ^= LoadLane(p);
+      mWordIndex = kCutoff;
     }
-    p += sizeof(uint64_t);
+    for (; words; --words, p += sizeof(uint64_t)) AbsorbLane(LoadLane(p));
   }
 
   while (tail--) mSaved |= (uint64_t)(*(p++)) << ((mByteIndex++) * 8);
@@ -105,12 +326,9 @@ shf::Hash& shf::Hash::Update(const uint8_t* bytes, std::size_t nbytes) {
 }
 
 shf::Hash& shf::Hash::Update(const shf::Point& point) {
-  // TODO: figure out if this data can be allocated automatically.
-  uint8_t* data = new uint8_t[Point::ByteSize()];
+  uint8_t data[Point::ByteSize()];
   point.Write(data);
-  Update(data, Point::ByteSize());
-  delete[] data;
-  return *this;
+  return Update(data, sizeof(data));
 }
 
 shf::Hash& shf::Hash::Update(const shf::Scalar& scalar) {
@@ -121,30 +339,124 @@ shf::Hash& shf::Hash::Update(const shf::Scalar& scalar) {
   return *this;
 }
 
-shf::Digest shf::Hash::Finalize() {
+// number of points normalized together when hashing a list. Large enough that
+// the inversion is amortized, small enough that the copy stays in cache.
+static constexpr std::size_t kNormalizeChunk = 1024;
+
+shf::Hash& shf::Hash::Update(const std::vector<shf::Point>& points) {
+  std::vector<Point> chunk;
+  chunk.reserve(kNormalizeChunk);
+  for (std::size_t i = 0; i < points.size(); i += kNormalizeChunk) {
+    const std::size_t end = std::min(points.size(), i + kNormalizeChunk);
+    chunk.assign(points.begin() + i, points.begin() + end);
+    NormalizeBatch(chunk);
+    for (const auto& p : chunk) Update(p);
+  }
+  return *this;
+}
+
+shf::Hash& shf::Hash::Update(const std::vector<shf::Ctxt>& ctxts) {
+  std::vector<Point> chunk;
+  chunk.reserve(kNormalizeChunk);
+  for (std::size_t i = 0; i < ctxts.size(); i += kNormalizeChunk / 2) {
+    const std::size_t end = std::min(ctxts.size(), i + kNormalizeChunk / 2);
+    chunk.clear();
+    for (std::size_t j = i; j < end; ++j) {
+      chunk.emplace_back(ctxts[j].U);
+      chunk.emplace_back(ctxts[j].V);
+    }
+    NormalizeBatch(chunk);
+    for (const auto& p : chunk) Update(p);
+  }
+  return *this;
+}
+
+// ciphertexts serialized together before a single Update.
+static constexpr std::size_t kSerializeChunk = 64;
+
+// write ciphertexts begin to end as U, V pairs.
+static void WriteCtxts(uint8_t* dest, const shf::CtxtVector& ctxts,
+                       std::size_t begin, std::size_t end) {
+  const std::size_t m = shf::Point::ByteSize();
+  for (std::size_t j = begin; j < end; ++j) {
+    ctxts.U()[j].Write(dest + 2 * (j - begin) * m);
+    ctxts.V()[j].Write(dest + (2 * (j - begin) + 1) * m);
+  }
+}
+
+shf::Hash& shf::Hash::Update(const shf::CtxtVector& ctxts) {
+  uint8_t data[kSerializeChunk * 2 * Point::ByteSize()];
+  for (std::size_t i = 0; i < ctxts.Size(); i += kSerializeChunk) {
+    const std::size_t end = std::min(ctxts.Size(), i + kSerializeChunk);
+    WriteCtxts(data, ctxts, i, end);
+    Update(data, 2 * (end - i) * Point::ByteSize());
+  }
+  return *this;
+}
+
+void shf::Hash::Pad() {
+  if (mWordIndex == kCutoff) Permute();
   uint64_t t = (uint64_t)(((uint64_t)(0x02 | (1 << 2))) << ((mByteIndex)*8));
   mState[mWordIndex] ^= mSaved ^ t;
   mState[kCutoff - 1] ^= 0x8000000000000000ULL;
+}
+
+shf::Digest shf::Hash::Squeeze() const {
+  // lanes are little-endian, as on the x86 targets this library needs for
+  // AES-NI anyway.
+  shf::Digest digest;
+  std::memcpy(digest.data(), mState, digest.size());
+  return digest;
+}
+
+shf::Digest shf::Hash::Finalize() {
+  Pad();
   keccakf(mState);
+  return Squeeze();
+}
 
-  for (std::size_t i = 0; i < kStateSize; ++i) {
-    const unsigned int t1 = (uint32_t)mState[i];
-    const unsigned int t2 = (uint32_t)((mState[i] >> 16) >> 16);
-    mStateBytes[i * 8 + 0] = (uint8_t)t1;
-    mStateBytes[i * 8 + 1] = (uint8_t)(t1 >> 8);
-    mStateBytes[i * 8 + 2] = (uint8_t)(t1 >> 16);
-    mStateBytes[i * 8 + 3] = (uint8_t)(t1 >> 24);
-    mStateBytes[i * 8 + 4] = (uint8_t)t2;
-    mStateBytes[i * 8 + 5] = (uint8_t)(t2 >> 8);
-    mStateBytes[i * 8 + 6] = (uint8_t)(t2 >> 16);
-    mStateBytes[i * 8 + 7] = (uint8_t)(t2 >> 24);
-  }
+void shf::Hash::UpdateMany(shf::Hash* const* hashes,
+                           const uint8_t* const* data, std::size_t nbytes,
+                           std::size_t n) {
+  std::vector<uint64_t*> states;
+  for (std::size_t first = 0; first < n;) {
+    // hashes advance together while they sit at the same position in their
+    // blocks, which is the case for fresh hashes or copies of one hash.
+    std::size_t last = first + 1;
+    while (last < n && hashes[last]->Position() == hashes[first]->Position())
+      ++last;
 
-  // truncate
-  shf::Digest digest = {0};
-  for (std::size_t i = 0; i < digest.size(); ++i) digest[i] = mStateBytes[i];
+    // absorb up to the end of the current block, which leaves the
+    // permutation pending, then permute the whole group together.
+    const Hash& lead = *hashes[first];
+    std::size_t offset = 0;
+    while (offset < nbytes) {
+      if (lead.mWordIndex == kCutoff) {
+        states.clear();
+        for (std::size_t i = first; i < last; ++i)
+          states.push_back(hashes[i]->mState);
+        KeccakMany(states.data(), states.size());
+        for (std::size_t i = first; i < last; ++i) hashes[i]->mWordIndex = 0;
+      }
+      const std::size_t room = kCutoff * sizeof(uint64_t) - lead.Position();
+      const std::size_t m = std::min(room, nbytes - offset);
+      for (std::size_t i = first; i < last; ++i)
+        hashes[i]->Update(data[i] + offset, m);
+      offset += m;
+    }
+    first = last;
+  }
+}
 
-  return digest;
+void shf::Hash::FinalizeMany(shf::Digest* digests, shf::Hash* const* hashes,
+                             std::size_t n) {
+  std::vector<uint64_t*> states(n);
+  for (std::size_t i = 0; i < n; ++i) {
+    hashes[i]->Pad();
+    states[i] = hashes[i]->mState;
+  }
+  KeccakMany(states.data(), n);
+  for (std::size_t i = 0; i < n; ++i) digests[i] = hashes[i]->Squeeze();
 }
 
 bool shf::DigestEquals(const shf::Digest& a, const shf::Digest& b) {
@@ -153,8 +465,96 @@ bool shf::DigestEquals(const shf::Digest& a, const shf::Digest& b) {
   return equal == 0;
 }
 
-shf::Scalar shf::ScalarFromHash(const shf::Hash& hash) {
+shf::PublicScalar shf::ScalarFromHash(const shf::Hash& hash) {
   auto copy(hash);
   const auto d = copy.Finalize();
-  return shf::Scalar::Read(d.data());
+  return shf::PublicScalar(shf::Scalar::Read(d.data()));
+}
+
+shf::Transcript::Transcript(shf::Hash& hash, shf::TranscriptVersion version)
+    : m_hash(hash), m_version(version) {
+  if (!m_hash.Fresh())
+    throw std::invalid_argument("transcript hash has already absorbed input");
+  m_hash.mLegacy = m_version == TranscriptVersion::kV1;
+  if (m_version != TranscriptVersion::kV1) {
+    const uint8_t tag = static_cast<uint8_t>(m_version);
+    m_hash.Update(&tag, 1);
+  }
+}
+
+const shf::Digest* shf::Transcript::Bind(const shf::CtxtVector& Es) {
+  if (m_version == TranscriptVersion::kV1) {
+    m_hash.Update(Es);
+    return nullptr;
+  }
+  if (m_version == TranscriptVersion::kV3)
+    m_digests.push_back(TreeDigest(Es));
+  else
+    m_digests.push_back(Hash().Update(Es).Finalize());
+  const Digest& d = m_digests.back();
+  m_hash.Update(d.data(), d.size());
+  return &d;
+}
+
+// leaves hashed side by side, enough to fill the widest Keccak kernel.
+static constexpr std::size_t kTreeLanes = 8;
+
+// hash leaves first to first + count, which all hold len ciphertexts, into
+// digests.
+static void HashLeaves(shf::Digest* digests, const shf::CtxtVector& Es,
+                       std::size_t chunk, std::size_t first,
+                       std::size_t count, std::size_t len) {
+  constexpr std::size_t m = 2 * shf::Point::ByteSize();
+  static const uint8_t kLeafTag = 0;
+  shf::Hash hashes[kTreeLanes];
+  shf::Hash* ptrs[kTreeLanes];
+  std::vector<uint8_t> buffer(count * kSerializeChunk * m);
+  const uint8_t* data[kTreeLanes];
+  for (std::size_t i = 0; i < count; ++i) {
+    ptrs[i] = &hashes[i];
+    hashes[i].Update(&kLeafTag, 1);
+    data[i] = buffer.data() + i * kSerializeChunk * m;
+  }
+  for (std::size_t j = 0; j < len; j += kSerializeChunk) {
+    const std::size_t k = std::min(len - j, kSerializeChunk);
+    for (std::size_t i = 0; i < count; ++i) {
+      const std::size_t begin = (first + i) * chunk + j;
+      WriteCtxts(buffer.data() + i * kSerializeChunk * m, Es, begin,
+                 begin + k);
+    }
+    shf::Hash::UpdateMany(ptrs, data, k * m, count);
+  }
+  shf::Hash::FinalizeMany(digests + first, ptrs, count);
+}
+
+static inline void WriteLE64(uint8_t* dest, uint64_t x) {
+  for (std::size_t i = 0; i < 8; ++i) dest[i] = static_cast<uint8_t>(x >> (8 * i));
+}
+
+shf::Digest shf::TreeDigest(const shf::CtxtVector& Es, std::size_t chunk) {
+  if (chunk == 0) throw std::invalid_argument("chunk must be positive");
+  const std::size_t n = Es.Size();
+  const std::size_t full = n / chunk;
+  const std::size_t leaves = full + (n % chunk != 0);
+
+  // groups of kTreeLanes full leaves, then the short leaf if there is one,
+  // spread over the default pool.
+  std::vector<Digest> digests(leaves);
+  const std::size_t groups = (full + kTreeLanes - 1) / kTreeLanes;
+  DefaultThreadPool().ParallelFor(
+      groups + (full < leaves), [&](std::size_t g) {
+        if (g < groups)
+          HashLeaves(digests.data(), Es, chunk, g * kTreeLanes,
+                     std::min(kTreeLanes, full - g * kTreeLanes), chunk);
+        else
+          HashLeaves(digests.data(), Es, chunk, full, 1, n - full * chunk);
+      });
+
+  uint8_t header[17] = {1};
+  WriteLE64(header + 1, n);
+  WriteLE64(header + 9, chunk);
+  Hash root;
+  root.Update(header, sizeof(header));
+  for (const auto& d : digests) root.Update(d.data(), d.size());
+  return root.Finalize();
 }
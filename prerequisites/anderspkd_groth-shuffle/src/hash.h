@@ -3,7 +3,10 @@
 
 #include <array>
 #include <cstdint>
+#include <deque>
+#include <vector>
 
+#include "cipher.h"
 #include "curve.h"
 
 namespace shf {
@@ -18,25 +21,177 @@ class Hash {
 
   Hash(){};
 
+  /**
+   * @brief A hash that absorbs whole words the way Update did before it was
+   * fixed to SHA3-256: bytes 1 to 7 of every 8-byte word that Update read in
+   * one piece were all taken from byte 1. kV1 transcripts use it, and
+   * callers of the sigma protocols in zkp.h can pass it, so that proofs
+   * made before the fix still verify.
+   */
+  static Hash Legacy();
+
   Hash& Update(const uint8_t* data, std::size_t n);
   Hash& Update(const Point& point);
   Hash& Update(const Scalar& scalar);
 
+  /**
+   * @brief Update the hash with a list of points.
+   *
+   * Equivalent to calling Update on each point in turn, but normalizes the
+   * points in chunks so they share field inversions.
+   */
+  Hash& Update(const std::vector<Point>& points);
+
+  /**
+   * @brief Update the hash with a list of ciphertexts.
+   *
+   * Equivalent to calling Update on U and then V of each ciphertext in turn,
+   * but normalizes the points in chunks so they share field inversions.
+   */
+  Hash& Update(const std::vector<Ctxt>& ctxts);
+
+  /**
+   * @brief Update the hash with a list of ciphertexts.
+   *
+   * Hashes the same bytes as the std::vector<Ctxt> overload. The points are
+   * stored in affine form, so no inversions are needed.
+   */
+  Hash& Update(const CtxtVector& ctxts);
+
   Digest Finalize();
 
+  /**
+   * @brief Update n hashes with a message of nbytes bytes each.
+   *
+   * Equivalent to hashes[i]->Update(data[i], nbytes) for every i, but runs
+   * of hashes at the same position in their blocks, such as fresh hashes or
+   * copies of one hash, compute their Keccak permutations side by side in
+   * SIMD lanes: eight at a time with AVX-512, four with AVX2 (see
+   * HashKernel).
+   */
+  static void UpdateMany(Hash* const* hashes, const uint8_t* const* data,
+                         std::size_t nbytes, std::size_t n);
+
+  /**
+   * @brief Finalize n hashes, with their last permutations side by side.
+   *
+   * Equivalent to digests[i] = hashes[i]->Finalize() for every i.
+   */
+  static void FinalizeMany(Digest* digests, Hash* const* hashes,
+                           std::size_t n);
+
  private:
   static constexpr std::size_t kCapacity = 512 / (8 * sizeof(uint64_t));
   static constexpr std::size_t kStateSize = 25;
   static constexpr std::size_t kCutoff = kStateSize - (kCapacity & ~0x80000000);
 
   uint64_t mState[kStateSize] = {0};
-  uint8_t mStateBytes[kStateSize * 8] = {0};
   uint64_t mSaved = 0;
   unsigned int mByteIndex = 0;
   unsigned int mWordIndex = 0;
+  bool mLegacy = false;
+
+  // A full block is permuted when the next lane arrives or in Finalize, so
+  // UpdateMany can permute several hashes together.
+  void Permute();
+  void AbsorbLane(uint64_t lane);
+  void Pad();
+  Digest Squeeze() const;
+  std::size_t Position() const { return mWordIndex * 8 + mByteIndex; };
+  // Whether nothing has been absorbed since construction.
+  bool Fresh() const;
+
+  friend class Transcript;
 };
 
-Scalar ScalarFromHash(const Hash& hash);
+/**
+ * @brief The kernel Hash::UpdateMany and Hash::FinalizeMany use on this CPU:
+ * "avx512", "avx2" or "scalar".
+ */
+const char* HashKernel();
+
+/**
+ * @brief Derive a challenge from the current hash state. Challenges are public.
+ */
+PublicScalar ScalarFromHash(const Hash& hash);
+
+/**
+ * @brief Versions of the Fiat-Shamir transcript of a shuffle proof. Prover and
+ * verifier must use the same one.
+ */
+enum class TranscriptVersion : uint8_t {
+  /**
+   * Sub-protocols hash their whole statement, including ciphertext vectors
+   * that are already in the transcript. Words are absorbed as by
+   * Hash::Legacy.
+   */
+  kV1 = 1,
+  /**
+   * The transcript starts with the version byte. Ciphertext vectors are
+   * hashed once, on their own, and the transcript absorbs their digest.
+   * Sub-protocols that refer to such a vector again absorb the digest instead.
+   * Everything is hashed with SHA3-256.
+   */
+  kV2 = 2,
+  /**
+   * As kV2, but ciphertext vectors are bound by their TreeDigest, so the
+   * chunks of long vectors can be hashed in parallel.
+   */
+  kV3 = 3,
+};
+
+/**
+ * @brief Ciphertexts per leaf of TreeDigest in kV3 transcripts.
+ */
+constexpr std::size_t kTreeChunk = 4096;
+
+/**
+ * @brief A two-level hash of a ciphertext vector.
+ *
+ * The vector is split into chunks of chunk ciphertexts, the last one possibly
+ * shorter. Leaf i is SHA3-256 of a zero byte followed by the ciphertexts of
+ * chunk i, serialized as by Hash::Update. The root is SHA3-256 of a one
+ * byte, the number of ciphertexts and chunk as 8-byte little-endian integers,
+ * and the leaf digests in order. Leaves are hashed side by side with
+ * Hash::UpdateMany, and groups of leaves on DefaultThreadPool.
+ *
+ * @throws std::invalid_argument if chunk is 0.
+ */
+Digest TreeDigest(const CtxtVector& Es, std::size_t chunk = kTreeChunk);
+
+/**
+ * @brief A Fiat-Shamir transcript: a hash plus the digests of the statement
+ * vectors bound into it.
+ *
+ * The transcript writes into the caller's hash, so it must not outlive it.
+ * A kV1 transcript switches the hash to Hash::Legacy absorption and later
+ * versions switch it to SHA3-256, so the hash must be fresh.
+ */
+class Transcript {
+ public:
+  /**
+   * @throws std::invalid_argument if hash has already absorbed some input.
+   */
+  Transcript(Hash& hash, TranscriptVersion version);
+
+  TranscriptVersion Version() const { return m_version; };
+
+  Hash& GetHash() { return m_hash; };
+
+  /**
+   * @brief Absorb a ciphertext vector that later sub-protocols refer to again.
+   * @param Es the ciphertexts
+   * @return under kV2 and kV3, the digest the sub-protocols absorb in place
+   * of Es. It lives as long as the transcript. Under kV1, nullptr, and the
+   * sub-protocols hash Es again.
+   */
+  const Digest* Bind(const CtxtVector& Es);
+
+ private:
+  Hash& m_hash;
+  TranscriptVersion m_version;
+  std::deque<Digest> m_digests;
+};
 
 }  // namespace mh
 
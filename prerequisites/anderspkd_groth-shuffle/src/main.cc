@@ -2,6 +2,7 @@
 
 #include "shuffler.h"
 #include "curve.h"
+#include "thread_pool.h"
 
 #include <iostream>
 #include <vector>
@@ -12,6 +13,7 @@
 #include <algorithm>
 #include <cstring>
 #include <map>
+#include <utility>
 
 const size_t SCALAR_BYTE_SIZE = 32;
 const size_t POINT_BYTE_SIZE = 65; // Uncompressed Kyber format
@@ -72,11 +74,9 @@ static std::vector<uint8_t> base64_decode(const std::string& in) {
 
 // Adapter for Scalars (Relic/SHF Scalar to Kyber bytes)
 std::vector<uint8_t> relic_to_kyber_scalar(const shf::Scalar& s) {
+    // Both use 32-byte big-endian integers.
     std::vector<uint8_t> kyber_bytes(SCALAR_BYTE_SIZE);
-    // Get a constant pointer to the underlying bn_t representation of the scalar.
-    const bn_t* src_ptr = reinterpret_cast<const bn_t*>(&s);
-    // Write the bignum into the byte vector in big-endian format.
-    bn_write_bin(kyber_bytes.data(), SCALAR_BYTE_SIZE, *src_ptr);
+    s.Write(kyber_bytes.data());
     return kyber_bytes;
 }
 
@@ -85,66 +85,23 @@ shf::Scalar kyber_to_relic_scalar(const std::vector<uint8_t>& kyber_bytes) {
     if (kyber_bytes.size() != SCALAR_BYTE_SIZE) {
         throw std::runtime_error("Invalid Kyber scalar size.");
     }
-    bn_t temp_scalar;
-    bn_new(temp_scalar);
-    // Rehad binary data into te Relic bignum format.
-    bn_read_bin(temp_scalar, kyber_bytes.data(), kyber_bytes.size());
-
-    shf::Scalar result;
-    // Assumes shf::Scalar is compatible with bn_t for copying.
-    bn_copy(*reinterpret_cast<bn_t*>(&result), temp_scalar);
-    bn_free(temp_scalar);
-    return result;
+    return shf::Scalar::Read(kyber_bytes.data());
 }
 
 shf::Point kyber_to_relic_point(const std::vector<uint8_t>& kyber_bytes) {
-    if (kyber_bytes.size() != 65) {
+    if (kyber_bytes.size() != shf::Point::UncompressedByteSize()) {
         throw std::runtime_error("Invalid Kyber point size. Expected 65 bytes.");
     }
     if (kyber_bytes[0] != 0x04) {
         throw std::runtime_error("Invalid Kyber point format. Expected uncompressed prefix 0x04.");
     }
-    ec_t temp_point;
-    ec_new(temp_point);
-    ec_read_bin(temp_point, kyber_bytes.data(), kyber_bytes.size());
-    shf::Point result;
-    ec_copy(*reinterpret_cast<ec_t*>(&result), temp_point);
-    ec_free(temp_point);
-    return result;
+    return shf::Point::ReadUncompressed(kyber_bytes.data());
 }
 
 std::vector<uint8_t> relic_to_kyber_point(const shf::Point& p) {
-    // Create a temporary point to hold the normalized (affine) version.
-    ec_t norm_point;
-    ec_new(norm_point);
-
-    // Get a pointer to the source point (which may be in Jacobian coordinates).
-    const ep_st* src_ptr = reinterpret_cast<const ep_st*>(&p);
-
-    // Normalize the source point into our temporary point.
-    ec_norm(norm_point, src_ptr);
-
-    std::vector<uint8_t> kyber_bytes(65);
-    kyber_bytes[0] = 0x04;
-
-    if (ec_is_infty(norm_point)) {
-        std::memset(kyber_bytes.data() + 1, 0, 64);
-    } else {
-        bn_t x, y;
-        bn_new(x);
-        bn_new(y);
-        // Get coordinates from the affine point.
-        ec_get_x(x, norm_point);
-        ec_get_y(y, norm_point);
-        bn_write_bin(kyber_bytes.data() + 1, 32, x);
-        bn_write_bin(kyber_bytes.data() + 33, 32, y);
-        bn_free(x);
-        bn_free(y);
-    }
-
-    // Clean up the temporary point.
-    ec_free(norm_point);
-
+    // Kyber uses the uncompressed encoding, with infinity as 0x04 || 0^64.
+    std::vector<uint8_t> kyber_bytes(shf::Point::UncompressedByteSize());
+    p.WriteUncompressed(kyber_bytes.data());
     return kyber_bytes;
 }
 
@@ -152,24 +109,29 @@ std::vector<uint8_t> relic_to_kyber_point(const shf::Point& p) {
 // Various methods to write and read from files between Kyber and relic.
 
 // Writes a file containing base64 encoded ciphertexts (C1,C2), one per line.
-void write_ciphertexts_to_file_kyber(const std::vector<shf::Ctxt>& ctxts, const std::string& filename) {
+void write_ciphertexts_to_file_kyber(const shf::CtxtVector& ctxts, const std::string& filename) {
     std::ofstream outfile(filename);
     if (!outfile.is_open()) {
         std::cerr << "Error: Could not open file " << filename << " for writing." << std::endl;
         return;
     }
     outfile << "c1_base64,c2_base64\n";
-    for (const auto& ctxt : ctxts) {
-        std::vector<uint8_t> u_kyber = relic_to_kyber_point(ctxt.U);
-        std::vector<uint8_t> v_kyber = relic_to_kyber_point(ctxt.V);
+    // CtxtVector stores affine points, so writing them needs no inversions.
+    for (std::size_t i = 0; i < ctxts.Size(); ++i) {
+        std::vector<uint8_t> u_kyber = relic_to_kyber_point(ctxts.U()[i]);
+        std::vector<uint8_t> v_kyber = relic_to_kyber_point(ctxts.V()[i]);
         outfile << base64_encode(u_kyber) << "," << base64_encode(v_kyber) << "\n";
     }
     outfile.close();
 }
 
 // Reads a file containing base64 encoded ciphertexts (C1,C2), one per line.
-std::vector<shf::Ctxt> read_ciphertexts_from_file(const std::string& filename) {
-    std::vector<shf::Ctxt> loaded_ctxts;
+shf::CtxtVector read_ciphertexts_from_file(const std::string& filename) {
+    // Parsed ciphertexts are moved into the CtxtVector a chunk at a time.
+    const std::size_t kChunk = 1024;
+    shf::CtxtVector loaded_ctxts;
+    std::vector<shf::Ctxt> chunk;
+    chunk.reserve(kChunk);
     std::ifstream infile(filename);
     if (!infile.is_open()) {
         throw std::runtime_error("Error: Could not open file " + filename + " for reading.");
@@ -186,16 +148,21 @@ std::vector<shf::Ctxt> read_ciphertexts_from_file(const std::string& filename) {
         std::vector<uint8_t> v_bytes = base64_decode(v_base64);
         shf::Point U = kyber_to_relic_point(u_bytes);
         shf::Point V = kyber_to_relic_point(v_bytes);
-        loaded_ctxts.push_back({U, V});
+        chunk.push_back({U, V});
+        if (chunk.size() == kChunk) {
+            loaded_ctxts.Append(chunk.data(), chunk.size());
+            chunk.clear();
+        }
     }
+    loaded_ctxts.Append(chunk.data(), chunk.size());
     infile.close();
-    std::cout << "Successfully read " << loaded_ctxts.size() << " ciphertexts from " << filename << std::endl;
+    std::cout << "Successfully read " << loaded_ctxts.Size() << " ciphertexts from " << filename << std::endl;
     return loaded_ctxts;
 }
 
 // Reads a file containing base64 encoded scalars (randomness), one per line.
-std::vector<shf::Scalar> read_randomness_from_file(const std::string& filename) {
-    std::vector<shf::Scalar> loaded_scalars;
+shf::ScalarVec read_randomness_from_file(const std::string& filename) {
+    shf::ScalarVec loaded_scalars;
     std::ifstream infile(filename);
     if (!infile.is_open()) {
         throw std::runtime_error("Error: Could not open randomness file " + filename);
@@ -287,8 +254,13 @@ shf::Scalar read_scalar(std::ifstream& in) {
     return kyber_to_relic_scalar(bytes);
 }
 
-// Helper for writing a vector of scalars
-void write_scalar_vector(std::ofstream& out, const std::vector<shf::Scalar>& vec) {
+// Scalars in a proof are public, so the verifier may use variable-time arithmetic on them.
+shf::PublicScalar read_public_scalar(std::ifstream& in) {
+    return shf::PublicScalar(read_scalar(in));
+}
+
+// Helper for writing a vector of (proof) scalars
+void write_scalar_vector(std::ofstream& out, const shf::PublicScalarVec& vec) {
     size_t vec_size = vec.size();
     out.write(reinterpret_cast<const char*>(&vec_size), sizeof(vec_size));
     for (const auto& s : vec) {
@@ -296,14 +268,14 @@ void write_scalar_vector(std::ofstream& out, const std::vector<shf::Scalar>& vec
     }
 }
 
-// Helper for reading a vector of scalars
-std::vector<shf::Scalar> read_scalar_vector(std::ifstream& in) {
+// Helper for reading a vector of (proof) scalars
+shf::PublicScalarVec read_scalar_vector(std::ifstream& in) {
     size_t vec_size;
     in.read(reinterpret_cast<char*>(&vec_size), sizeof(vec_size));
-    std::vector<shf::Scalar> vec;
+    shf::PublicScalarVec vec;
     vec.reserve(vec_size);
     for (size_t i = 0; i < vec_size; ++i) {
-        vec.push_back(read_scalar(in));
+        vec.push_back(read_public_scalar(in));
     }
     return vec;
 }
@@ -314,6 +286,10 @@ void write_proof_to_file(const std::string& filename, const shf::ShuffleP& proof
     std::ofstream outfile(filename, std::ios::binary);
     if (!outfile.is_open()) throw std::runtime_error("Cannot open proof file for writing.");
 
+    // --- Part 0: Transcript version ---
+    const uint8_t version = static_cast<uint8_t>(proof.version);
+    outfile.write(reinterpret_cast<const char*>(&version), sizeof(version));
+
     // --- Part 1: Main proof components ---
     write_point(outfile, proof.Ca);
     write_point(outfile, proof.Cb);
@@ -343,12 +319,19 @@ void write_proof_to_file(const std::string& filename, const shf::ShuffleP& proof
 
 // Read proof from file
 // Under construction.
-shf::ShuffleP read_proof_from_file(const std::string& filename, const std::vector<shf::Ctxt>& pEs) {
+shf::ShuffleP read_proof_from_file(const std::string& filename, shf::CtxtVector pEs) {
     std::ifstream infile(filename, std::ios::binary);
     if (!infile.is_open()) throw std::runtime_error("Cannot open proof file for reading.");
 
     shf::ShuffleP proof;
-    proof.permuted = pEs; // The permuted ciphertexts are part of the statement
+    proof.permuted = std::move(pEs); // The permuted ciphertexts are part of the statement
+
+    // --- Part 0: Transcript version ---
+    uint8_t version;
+    infile.read(reinterpret_cast<char*>(&version), sizeof(version));
+    if (version < 1 || version > 3)
+        throw std::runtime_error("Unknown transcript version in proof file.");
+    proof.version = static_cast<shf::TranscriptVersion>(version);
 
     // --- Part 1: Main proof components ---
     proof.Ca = read_point(infile);
@@ -360,8 +343,8 @@ shf::ShuffleP read_proof_from_file(const std::string& filename, const std::vecto
     proof.product_proof.C2 = read_point(infile);
     proof.product_proof.as = read_scalar_vector(infile);
     proof.product_proof.bs = read_scalar_vector(infile);
-    proof.product_proof.r = read_scalar(infile);
-    proof.product_proof.s = read_scalar(infile);
+    proof.product_proof.r = read_public_scalar(infile);
+    proof.product_proof.s = read_public_scalar(infile);
 
     // --- Part 3: Deserialize MultiExpP (matching zkp.h) ---
     proof.multiexp_proof.C0 = read_point(infile);
@@ -369,10 +352,10 @@ shf::ShuffleP read_proof_from_file(const std::string& filename, const std::vecto
     proof.multiexp_proof.E.U = read_point(infile);
     proof.multiexp_proof.E.V = read_point(infile);
     proof.multiexp_proof.a = read_scalar_vector(infile);
-    proof.multiexp_proof.r = read_scalar(infile);
-    proof.multiexp_proof.b = read_scalar(infile);
-    proof.multiexp_proof.s = read_scalar(infile);
-    proof.multiexp_proof.t = read_scalar(infile);
+    proof.multiexp_proof.r = read_public_scalar(infile);
+    proof.multiexp_proof.b = read_public_scalar(infile);
+    proof.multiexp_proof.s = read_public_scalar(infile);
+    proof.multiexp_proof.t = read_public_scalar(infile);
 
     infile.close();
     return proof;
@@ -390,12 +373,35 @@ std::map<std::string, std::string> parse_args(int argc, char* argv[]) {
     return args;
 }
 
+// --transcript selects the Fiat-Shamir transcript version, 2 by default. 3
+// binds the ciphertext vectors with a tree hash.
+shf::TranscriptVersion transcript_version(const std::map<std::string, std::string>& args) {
+    const auto it = args.find("--transcript");
+    if (it == args.end() || it->second == "2") return shf::TranscriptVersion::kV2;
+    if (it->second == "1") return shf::TranscriptVersion::kV1;
+    if (it->second == "3") return shf::TranscriptVersion::kV3;
+    throw std::invalid_argument("Unknown transcript version: " + it->second);
+}
+
+// --threads sets how many threads the library's parallel loops use, one per
+// hardware thread by default or when 0.
+std::size_t thread_count(const std::map<std::string, std::string>& args) {
+    const auto it = args.find("--threads");
+    if (it == args.end()) return 0;
+    std::size_t pos = 0;
+    const unsigned long threads = std::stoul(it->second, &pos);
+    if (pos != it->second.size())
+        throw std::invalid_argument("Invalid thread count: " + it->second);
+    return threads;
+}
+
 void print_usage() {
     std::cerr << "Usage: ./bayer_groth_tool <command> [options]\n"
               << "Commands:\n"
-              << "  shuffle   --pk <file> --in <file> --out <file> --proof <file>\n"
-              << "  prove     --pk <file> --in <file> --out <file> --perm <file> --rand <file> --proof <file>\n"
-              << "  verify    --pk <file> --in <file> --out <file> --proof <file>\n";
+              << "  shuffle   --pk <file> --in <file> --out <file> --proof <file> [--transcript <1|2|3>]\n"
+              << "  prove     --pk <file> --in <file> --out <file> --perm <file> --rand <file> --proof <file> [--transcript <1|2|3>]\n"
+              << "  verify    --pk <file> --in <file> --out <file> --proof <file>\n"
+              << "Every command also takes [--threads <n>], 0 or omitted for one per hardware thread.\n";
 }
 
 int main(int argc, char* argv[]) {
@@ -409,6 +415,7 @@ int main(int argc, char* argv[]) {
 
     try {
         shf::CurveInit();
+        shf::SetThreadCount(thread_count(args));
 
         if (command == "shuffle") {
             // ./shuffle_app shuffle --pk pk.txt --in input.csv --out shuffled.csv --proof proof.bin
@@ -416,7 +423,8 @@ int main(int argc, char* argv[]) {
             auto ctxts = read_ciphertexts_from_file(args.at("--in"));
 
             shf::Prg prg;
-            shf::Shuffler shuffler(pk, shf::CreateCommitKey(ctxts.size()), prg);
+            shf::Shuffler shuffler(pk, shf::CreateCommitKey(ctxts.Size()), prg,
+                                   transcript_version(args));
             shf::Hash hp;
 
             std::cout << "Shuffling and proving..." << std::endl;
@@ -448,7 +456,8 @@ int main(int argc, char* argv[]) {
             auto rho = read_randomness_from_file(args.at("--rand"));
 
             shf::Prg prg;
-            shf::Shuffler shuffler(pk, shf::CreateCommitKey(in_ctxts.size()), prg);
+            shf::Shuffler shuffler(pk, shf::CreateCommitKey(in_ctxts.Size()), prg,
+                                   transcript_version(args));
             shf::Hash hp;
 
             std::cout << "Proving existing shuffle..." << std::endl;
@@ -477,10 +486,12 @@ int main(int argc, char* argv[]) {
             auto pk = read_public_key_from_file(args.at("--pk"));
             auto in_ctxts = read_ciphertexts_from_file(args.at("--in"));
             auto out_ctxts = read_ciphertexts_from_file(args.at("--out"));
-            auto proof = read_proof_from_file(args.at("--proof"), out_ctxts);
+            auto proof = read_proof_from_file(args.at("--proof"), std::move(out_ctxts));
 
+            // the proof records its transcript version.
             shf::Prg prg;
-            shf::Shuffler shuffler(pk, shf::CreateCommitKey(in_ctxts.size()), prg);
+            shf::Shuffler shuffler(pk, shf::CreateCommitKey(in_ctxts.Size()), prg,
+                                   proof.version);
             shf::Hash hv;
 
             std::cout << "Verifying shuffle proof..." << std::endl;
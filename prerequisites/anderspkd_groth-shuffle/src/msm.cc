@@ -0,0 +1,925 @@
+#include "msm.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+
+#include "thread_pool.h"
+
+// below this many terms, doing the scalar multiplications one at a time is
+// faster than setting up buckets.
+static constexpr std::size_t kMinPippengerSize = 4;
+
+// signed digits are stored as int16_t, so |digit| <= 2^(c-1) must fit.
+static constexpr std::size_t kMaxWindowSize = 15;
+
+static constexpr std::size_t kScalarBits = shf::Scalar::ByteSize() * 8;
+static constexpr std::size_t kScalarLimbs = kScalarBits / 64;
+
+std::size_t shf::MultiExpWindowSize(const std::size_t n) {
+  if (n < 32) return 3;
+  const auto c = static_cast<std::size_t>(std::log(n)) + 2;
+  return c > kMaxWindowSize ? kMaxWindowSize : c;
+}
+
+static inline void CheckWidth(const std::size_t width) {
+  if (width < 1 || width > kMaxWindowSize)
+    throw std::invalid_argument("unsupported window width");
+}
+
+// with signed digits the top window has to absorb a final carry, so one window
+// more than floor(bits/c) is always enough.
+static inline std::size_t NumWindows(const std::size_t c) {
+  return kScalarBits / c + 1;
+}
+
+static inline uint32_t GetBits(const uint64_t limbs[kScalarLimbs],
+                               const std::size_t offset, const std::size_t c) {
+  const std::size_t li = offset / 64;
+  const std::size_t bi = offset % 64;
+  if (li >= kScalarLimbs) return 0;
+  uint64_t v = limbs[li] >> bi;
+  if (bi + c > 64 && li + 1 < kScalarLimbs) v |= limbs[li + 1] << (64 - bi);
+  return static_cast<uint32_t>(v & ((UINT64_C(1) << c) - 1));
+}
+
+// Recode a scalar into signed c-bit digits in [-2^(c-1), 2^(c-1)]. Digit w of
+// the scalar is written to digits[w * stride]. The carry is computed without
+// branches, so secret scalars can be recoded too.
+static inline void RecodeScalar(const shf::Scalar& s, const std::size_t c,
+                                const std::size_t nwindows, int16_t* digits,
+                                const std::size_t stride) {
+  uint64_t limbs[kScalarLimbs];
+  s.GetLimbs(limbs);
+  const int32_t half = 1 << (c - 1);
+  const int32_t full = 1 << c;
+  int32_t carry = 0;
+  for (std::size_t w = 0; w < nwindows; ++w) {
+    int32_t d = static_cast<int32_t>(GetBits(limbs, w * c, c)) + carry;
+    carry = static_cast<int32_t>(static_cast<uint32_t>(half - d) >> 31);
+    d -= full & -carry;
+    digits[w * stride] = static_cast<int16_t>(d);
+  }
+}
+
+// Table reads for secret digits. Every entry of a row is read and combined
+// with masks, so the memory access pattern does not depend on the digit.
+// Affine points are plain field elements, so they are selected word by word.
+static constexpr std::size_t kAffineWords =
+    sizeof(shf::PointBackend::Affine) / sizeof(uint64_t);
+static_assert(sizeof(shf::PointBackend::Affine) % sizeof(uint64_t) == 0,
+              "affine points must be whole words");
+
+// r = a if mask is all ones, unchanged if it is zero.
+static inline void SelectAffine(uint64_t mask, shf::PointBackend::Affine& r,
+                                const shf::PointBackend::Affine& a) {
+  uint64_t rw[kAffineWords], aw[kAffineWords];
+  std::memcpy(rw, &r, sizeof(rw));
+  std::memcpy(aw, &a, sizeof(aw));
+  for (std::size_t i = 0; i < kAffineWords; ++i) rw[i] ^= (rw[i] ^ aw[i]) & mask;
+  std::memcpy(&r, rw, sizeof(rw));
+}
+
+// all ones if x is zero, else zero.
+static inline uint64_t ZeroMask(uint64_t x) {
+  return ((x | (0 - x)) >> 63) - 1;
+}
+
+// Q = d*P for a signed digit |d| <= size, where row[i] = (i + 1)*P. For d = 0,
+// Q is row[0] and *zero is set, so the caller can skip the addition.
+static inline void LookupAffine(shf::PointBackend::Affine& Q,
+                                const shf::PointBackend::Affine* row,
+                                std::size_t size, int32_t d, uint32_t* zero) {
+  const uint64_t neg = 0 - (static_cast<uint64_t>(static_cast<uint32_t>(d)) >> 31);
+  const uint64_t abs =
+      (static_cast<uint64_t>(static_cast<int64_t>(d)) ^ neg) - neg;
+  Q = row[0];
+  for (std::size_t i = 1; i < size; ++i)
+    SelectAffine(ZeroMask(abs ^ (i + 1)), Q, row[i]);
+  shf::PointBackend::Affine negated;
+  shf::PointBackend::NegateAffine(negated, Q);
+  SelectAffine(neg, Q, negated);
+  *zero = static_cast<uint32_t>(ZeroMask(abs) & 1);
+}
+
+namespace {
+// Applies bucket additions in batches. Call Flush before reading the buckets.
+//
+// If the backend has vectorized lanes, the additions are applied
+// PointBatch::kLanes at a time. The additions in one batch must go to distinct
+// buckets, so adding to a bucket that is already pending flushes the batch
+// early.
+//
+// Otherwise, if there are enough buckets, they are accumulated in affine
+// coordinates and kAffineBatch additions share one inversion (see
+// PointBackend::AddAffineBatch). An addition to a bucket that is already
+// pending becomes a mixed addition instead, which keeps skewed windows (like
+// the short top window of a scalar) from stalling the batches.
+class BucketAdder {
+ public:
+  using Affine = shf::PointBackend::Affine;
+
+  explicit BucketAdder(std::vector<shf::Point>& buckets)
+      : m_buckets(buckets), m_lanes(UseLanes(buckets.size())) {
+    if (m_lanes) return;
+    m_sums.resize(buckets.size(), kInfinity);
+    m_pending.resize(buckets.size(), false);
+    m_index.reserve(kAffineBatch);
+    m_a.reserve(kAffineBatch);
+    m_b.reserve(kAffineBatch);
+  };
+
+  void Add(std::size_t bucket, const Affine& Q) {
+    if (m_lanes)
+      AddLane(bucket, Q);
+    else
+      AddAffine(bucket, Q);
+  };
+
+  void Sub(std::size_t bucket, const Affine& Q) {
+    Affine negated;
+    shf::PointBackend::NegateAffine(negated, Q);
+    Add(bucket, negated);
+  };
+
+  void Flush() {
+    if (m_lanes) return FlushLanes();
+    if (!m_index.empty()) ApplyAffine();
+    for (std::size_t j = 0; j < m_sums.size(); ++j) {
+      if (shf::PointBackend::IsInfinity(m_sums[j])) continue;
+      m_buckets[j] += shf::Point::FromAffine(m_sums[j]);
+      m_sums[j] = kInfinity;
+    }
+  };
+
+ private:
+  static constexpr std::size_t kLanes = shf::PointBatch::kLanes;
+  static constexpr std::size_t kAffineBatch = 64;
+  static constexpr Affine kInfinity = {};
+
+  // an affine batch needs enough buckets to find kAffineBatch distinct ones.
+  static bool UseLanes(std::size_t nbuckets) {
+    return shf::PointBatch::Vectorized() || nbuckets < 4 * kAffineBatch;
+  };
+
+  void AddLane(std::size_t bucket, const Affine& Q) {
+    for (std::size_t i = 0; i < m_size; ++i) {
+      if (m_lane_index[i] == bucket) {
+        FlushLanes();
+        break;
+      }
+    }
+    m_lane_index[m_size] = bucket;
+    m_Q[m_size] = Q;
+    if (++m_size == kLanes) FlushLanes();
+  };
+
+  void FlushLanes() {
+    if (!m_size) return;
+    shf::Point* lanes[kLanes];
+    for (std::size_t i = 0; i < kLanes; ++i)
+      lanes[i] = i < m_size ? &m_buckets[m_lane_index[i]] : &m_unused[i];
+    const uint32_t skip = ((UINT32_C(1) << kLanes) - 1) &
+                          ~((UINT32_C(1) << m_size) - 1);
+    m_batch.Load(lanes);
+    m_batch.Add(m_Q, skip);
+    m_batch.Store(lanes);
+    m_size = 0;
+  };
+
+  void AddAffine(std::size_t bucket, const Affine& Q) {
+    // a bucket that is already pending takes a mixed addition instead.
+    if (m_pending[bucket]) {
+      m_buckets[bucket] += shf::Point::FromAffine(Q);
+      return;
+    }
+    // the first point of a bucket needs no addition.
+    if (shf::PointBackend::IsInfinity(m_sums[bucket])) {
+      m_sums[bucket] = Q;
+      return;
+    }
+    m_pending[bucket] = true;
+    m_index.push_back(bucket);
+    m_a.push_back(m_sums[bucket]);
+    m_b.push_back(Q);
+    if (m_index.size() == kAffineBatch) ApplyAffine();
+  };
+
+  void ApplyAffine() {
+    shf::PointBackend::AddAffineBatch(m_a.data(), m_a.data(), m_b.data(),
+                                      m_a.size());
+    for (std::size_t i = 0; i < m_index.size(); ++i) {
+      m_sums[m_index[i]] = m_a[i];
+      m_pending[m_index[i]] = false;
+    }
+    m_index.clear();
+    m_a.clear();
+    m_b.clear();
+  };
+
+  std::vector<shf::Point>& m_buckets;
+  const bool m_lanes;
+
+  shf::PointBatch m_batch;
+  std::size_t m_size = 0;
+  std::size_t m_lane_index[kLanes];
+  Affine m_Q[kLanes] = {};
+  shf::Point m_unused[kLanes];
+
+  std::vector<Affine> m_sums;
+  std::vector<bool> m_pending;
+  std::vector<std::size_t> m_index;
+  std::vector<Affine> m_a;
+  std::vector<Affine> m_b;
+};
+}  // namespace
+
+// The bucket method for public scalars. Which buckets a term goes to depends
+// on its digits, so secret scalars use SecretMultiExp below instead.
+static std::vector<shf::Point> MultiExpRange(
+    const std::vector<shf::PointColumn>& columns,
+    const shf::PublicScalar* scalars, const std::size_t n) {
+  using shf::Point;
+  const std::size_t k = columns.size();
+  std::vector<Point> results(k);
+
+  if (n < kMinPippengerSize) {
+    for (std::size_t i = 0; i < n; ++i)
+      for (std::size_t col = 0; col < k; ++col)
+        results[col] += columns[col][i] * scalars[i];
+    return results;
+  }
+
+  const std::size_t c = shf::MultiExpWindowSize(n);
+  const std::size_t nwindows = NumWindows(c);
+
+  // digits are stored window-major so each pass below reads them in order.
+  std::vector<int16_t> digits(nwindows * n);
+  for (std::size_t i = 0; i < n; ++i)
+    RecodeScalar(scalars[i], c, nwindows, digits.data() + i, n);
+
+  // affine columns are added through a PointBatch.
+  bool affine = true;
+  for (const auto& column : columns) affine = affine && column.IsAffine();
+
+  // buckets for column col are buckets[col * nbuckets, (col + 1) * nbuckets).
+  const std::size_t nbuckets = std::size_t(1) << (c - 1);
+  std::vector<Point> buckets(k * nbuckets);
+  for (std::size_t w = nwindows; w-- > 0;) {
+    for (auto& result : results)
+      if (!result.IsInfinity())
+        for (std::size_t j = 0; j < c; ++j) result = result.Double();
+
+    for (auto& bucket : buckets) bucket = Point();
+
+    const int16_t* d = digits.data() + w * n;
+    if (affine) {
+      BucketAdder adder(buckets);
+      for (std::size_t i = 0; i < n; ++i) {
+        if (d[i] > 0) {
+          for (std::size_t col = 0; col < k; ++col)
+            adder.Add(col * nbuckets + d[i] - 1, columns[col].AffineAt(i));
+        } else if (d[i] < 0) {
+          for (std::size_t col = 0; col < k; ++col)
+            adder.Sub(col * nbuckets - d[i] - 1, columns[col].AffineAt(i));
+        }
+      }
+      adder.Flush();
+    } else {
+      for (std::size_t i = 0; i < n; ++i) {
+        if (d[i] > 0) {
+          for (std::size_t col = 0; col < k; ++col)
+            buckets[col * nbuckets + d[i] - 1] += columns[col][i];
+        } else if (d[i] < 0) {
+          for (std::size_t col = 0; col < k; ++col)
+            buckets[col * nbuckets - d[i] - 1] -= columns[col][i];
+        }
+      }
+    }
+
+    // sum_j (j+1)*buckets[j] computed with a running sum.
+    for (std::size_t col = 0; col < k; ++col) {
+      Point running, window_sum;
+      for (std::size_t j = nbuckets; j-- > 0;) {
+        running += buckets[col * nbuckets + j];
+        window_sum += running;
+      }
+      results[col] += window_sum;
+    }
+  }
+
+  return results;
+}
+
+// Multiexps and sums are split into one piece per thread of the default pool
+// once every piece gets at least this many terms, and the pieces are added up.
+static constexpr std::size_t kParallelTerms = 4096;
+
+static inline void CheckBases(const std::vector<shf::PointColumn>& columns,
+                              const std::size_t n) {
+  for (const auto& column : columns)
+    if (column.Size() < n)
+      throw std::invalid_argument("not enough bases for multiexp");
+}
+
+// adds up the results of two pieces of a multi-column multiexp.
+static std::vector<shf::Point> AddColumns(std::vector<shf::Point> sum,
+                                          const std::vector<shf::Point>& part) {
+  for (std::size_t col = 0; col < sum.size(); ++col) sum[col] += part[col];
+  return sum;
+}
+
+static std::vector<shf::Point> MultiExpColumns(
+    const std::vector<shf::PointColumn>& columns,
+    const shf::PublicScalarVec& scalars) {
+  using shf::Point;
+  const std::size_t n = scalars.size();
+  CheckBases(columns, n);
+
+  shf::ThreadPool& pool = shf::DefaultThreadPool();
+  const std::size_t parts = pool.Parts(n, kParallelTerms);
+  if (parts == 1) return MultiExpRange(columns, scalars.data(), n);
+  return pool.ParallelReduce(
+      parts, std::vector<Point>(columns.size()),
+      [&](std::size_t part) {
+        const std::size_t first = part * n / parts;
+        const std::size_t last = (part + 1) * n / parts;
+        std::vector<shf::PointColumn> slices;
+        for (const auto& column : columns)
+          slices.push_back(column.Slice(first, last - first));
+        return MultiExpRange(slices, scalars.data() + first, last - first);
+      },
+      AddColumns);
+}
+
+// Secret scalars use Straus's method. Every term gets a table of its multiples
+// 1..2^(c-1) in affine form, and the terms go through the lanes of a
+// PointBatch kLanes at a time: each c-bit window costs c doublings of the
+// batch plus one full table scan and one mixed addition per term, whatever the
+// digits are. With c = 5 that is about twice the additions of the bucket
+// method.
+static constexpr std::size_t kSecretWidth = 5;
+
+// terms are processed this many at a time, which keeps the tables of a piece
+// at 256 KiB per column. Pieces are also what the default pool works on.
+static constexpr std::size_t kSecretChunk = 256;
+
+// recode(i, digits) writes the nwindows signed c-bit digits of term i, least
+// significant first.
+template <typename Recode>
+static std::vector<shf::Point> SecretMultiExp(
+    const std::vector<shf::PointColumn>& columns, const std::size_t n,
+    const std::size_t c, const std::size_t nwindows, const Recode& recode) {
+  using shf::Point;
+  using shf::PointBackend;
+  using shf::PointBatch;
+  constexpr std::size_t kLanes = PointBatch::kLanes;
+  const std::size_t k = columns.size();
+  const std::size_t half = std::size_t(1) << (c - 1);
+
+  const auto chunk_sum = [&](std::size_t chunk) {
+    const std::size_t first = chunk * kSecretChunk;
+    const std::size_t m = std::min(kSecretChunk, n - first);
+
+    std::vector<int16_t> digits(m * nwindows);
+    for (std::size_t i = 0; i < m; ++i)
+      recode(first + i, digits.data() + i * nwindows);
+
+    // tables[col][i * half + j] = (j + 1) * columns[col][first + i].
+    std::vector<shf::AffinePointVec> tables(k);
+    std::vector<Point> multiples(m * half);
+    for (std::size_t col = 0; col < k; ++col) {
+      for (std::size_t i = 0; i < m; ++i) {
+        Point* T = multiples.data() + i * half;
+        T[0] = columns[col][first + i];
+        if (half > 1) T[1] = T[0].Double();
+        for (std::size_t j = 2; j < half; ++j) T[j] = T[j - 1] + T[0];
+      }
+      tables[col].Append(multiples.data(), multiples.size());
+    }
+
+    // lane i of column col sums the terms first + i, first + i + kLanes, ...
+    std::vector<Point> lanes(k * kLanes);
+    std::vector<Point*> ptrs(k * kLanes);
+    for (std::size_t j = 0; j < ptrs.size(); ++j) ptrs[j] = &lanes[j];
+    std::vector<PointBatch> batches(k);
+    for (std::size_t col = 0; col < k; ++col)
+      batches[col].Load(ptrs.data() + col * kLanes);
+
+    for (std::size_t w = nwindows; w-- > 0;) {
+      if (w + 1 < nwindows)
+        for (auto& batch : batches)
+          for (std::size_t j = 0; j < c; ++j) batch.Double();
+
+      for (std::size_t g = 0; g < m; g += kLanes) {
+        for (std::size_t col = 0; col < k; ++col) {
+          PointBackend::Affine Q[kLanes] = {};
+          uint32_t skip = 0;
+          for (std::size_t i = 0; i < kLanes; ++i) {
+            // only the last group of a chunk has unused lanes.
+            if (g + i >= m) {
+              skip |= UINT32_C(1) << i;
+              continue;
+            }
+            uint32_t zero;
+            LookupAffine(Q[i], tables[col].Data() + (g + i) * half, half,
+                         digits[(g + i) * nwindows + w], &zero);
+            skip |= zero << i;
+          }
+          batches[col].Add(Q, skip);
+        }
+      }
+    }
+
+    std::vector<Point> sums(k);
+    for (std::size_t col = 0; col < k; ++col) {
+      batches[col].Store(ptrs.data() + col * kLanes);
+      for (std::size_t i = 0; i < kLanes; ++i)
+        sums[col] += lanes[col * kLanes + i];
+    }
+    return sums;
+  };
+
+  return shf::DefaultThreadPool().ParallelReduce(
+      (n + kSecretChunk - 1) / kSecretChunk, std::vector<Point>(k), chunk_sum,
+      AddColumns);
+}
+
+static std::vector<shf::Point> MultiExpColumns(
+    const std::vector<shf::PointColumn>& columns,
+    const shf::ScalarVec& scalars) {
+  const std::size_t n = scalars.size();
+  CheckBases(columns, n);
+  const std::size_t nwindows = NumWindows(kSecretWidth);
+  return SecretMultiExp(columns, n, kSecretWidth, nwindows,
+                        [&](std::size_t i, int16_t* digits) {
+                          RecodeScalar(scalars[i], kSecretWidth, nwindows,
+                                       digits, 1);
+                        });
+}
+
+std::vector<shf::Point> shf::MultiExp(
+    const std::vector<shf::PointColumn>& columns,
+    const shf::ScalarVec& scalars) {
+  return MultiExpColumns(columns, scalars);
+}
+
+std::vector<shf::Point> shf::MultiExp(
+    const std::vector<shf::PointColumn>& columns,
+    const shf::PublicScalarVec& scalars) {
+  return MultiExpColumns(columns, scalars);
+}
+
+shf::Point shf::MultiExp(const shf::PointColumn& bases,
+                         const shf::ScalarVec& scalars) {
+  return MultiExpColumns({bases}, scalars)[0];
+}
+
+shf::Point shf::MultiExp(const shf::PointColumn& bases,
+                         const shf::PublicScalarVec& scalars) {
+  return MultiExpColumns({bases}, scalars)[0];
+}
+
+// MulMany converts the column to Points this many at a time. The chunks go to
+// the threads of the default pool and each writes its own slice of the
+// result, so the output does not depend on the number of threads.
+static constexpr std::size_t kMulManyChunk = 1024;
+
+std::vector<shf::Point> shf::MulMany(const shf::Scalar& scalar,
+                                     const shf::PointColumn& points) {
+  const std::size_t n = points.Size();
+  std::vector<Point> results(n);
+  const std::size_t chunks = (n + kMulManyChunk - 1) / kMulManyChunk;
+  DefaultThreadPool().ParallelFor(chunks, [&](std::size_t c) {
+    const std::size_t first = c * kMulManyChunk;
+    const std::size_t last = std::min(n, first + kMulManyChunk);
+    for (std::size_t i = first; i < last; ++i) results[i] = points[i];
+    Point::MulMany(scalar, results.data() + first, results.data() + first,
+                   last - first);
+  });
+  return results;
+}
+
+// SumPoints converts the column to affine this many points at a time. Levels
+// with fewer than kMinAffineSum points are not worth an inversion and are
+// added projectively.
+static constexpr std::size_t kSumChunk = 1024;
+static constexpr std::size_t kMinAffineSum = 16;
+
+static shf::Point SumRange(const shf::PointColumn& points) {
+  using shf::Point;
+  using shf::PointBackend;
+  const std::size_t n = points.Size();
+  Point sum;
+  if (n < kMinAffineSum) {
+    for (std::size_t i = 0; i < n; ++i) sum += points[i];
+    return sum;
+  }
+
+  std::vector<PointBackend::Affine> level;
+  std::vector<Point> chunk;
+  for (std::size_t first = 0; first < n; first += kSumChunk) {
+    const std::size_t m = std::min(kSumChunk, n - first);
+    level.resize(m);
+    if (points.IsAffine()) {
+      for (std::size_t i = 0; i < m; ++i) level[i] = points.AffineAt(first + i);
+    } else {
+      chunk.clear();
+      for (std::size_t i = 0; i < m; ++i) chunk.emplace_back(points[first + i]);
+      shf::NormalizeBatch(chunk);
+      for (std::size_t i = 0; i < m; ++i) chunk[i].ToAffine(level[i]);
+    }
+
+    // fold the back half of the level onto the front half.
+    std::size_t size = m;
+    while (size >= kMinAffineSum) {
+      const std::size_t half = size / 2;
+      const std::size_t rest = size - half;
+      PointBackend::AddAffineBatch(level.data(), level.data(),
+                                   level.data() + rest, half);
+      size = rest;
+    }
+    for (std::size_t i = 0; i < size; ++i) sum += Point::FromAffine(level[i]);
+  }
+  return sum;
+}
+
+shf::Point shf::SumPoints(const shf::PointColumn& points) {
+  const std::size_t n = points.Size();
+  ThreadPool& pool = DefaultThreadPool();
+  const std::size_t parts = pool.Parts(n, kParallelTerms);
+  return pool.ParallelReduce(
+      parts, Point(),
+      [&](std::size_t part) {
+        const std::size_t first = part * n / parts;
+        return SumRange(points.Slice(first, (part + 1) * n / parts - first));
+      },
+      [](const Point& sum, const Point& part) { return sum + part; });
+}
+
+// MultiExpSmall scalars fit in an unsigned int, which is what
+// Scalar::CreateFromInt takes. Both overloads share this code.
+static constexpr std::size_t kMaxSmallBits = 32;
+
+// the additions SecretMultiExp spends per term on scalars of the given bit
+// length with c-bit windows: building the table, then one per window.
+static inline std::size_t SecretCost(const std::size_t bits,
+                                     const std::size_t c) {
+  return (std::size_t(1) << (c - 1)) - 1 + bits / c + 1;
+}
+
+template <typename Int>
+static shf::Point MultiExpSmallImpl(const shf::PointColumn& bases,
+                                    const std::vector<Int>& scalars) {
+  using shf::Scalar;
+  const std::size_t n = scalars.size();
+  if (bases.Size() < n)
+    throw std::invalid_argument("not enough bases for multiexp");
+
+  std::size_t max = 0;
+  for (const auto s : scalars) max |= s;
+  if (max >> kMaxSmallBits)
+    throw std::invalid_argument("scalar too large for MultiExpSmall");
+
+  // only the windows covering the bits of the largest scalar are walked, and
+  // short scalars do better with narrower windows and smaller tables.
+  std::size_t bits = 0;
+  while (max >> bits) ++bits;
+  std::size_t c = 1;
+  for (std::size_t w = 2; w <= kSecretWidth; ++w)
+    if (SecretCost(bits, w) < SecretCost(bits, c)) c = w;
+  // as in NumWindows, one extra window absorbs the final carry.
+  const std::size_t nwindows = bits / c + 1;
+  return SecretMultiExp({bases}, n, c, nwindows,
+                        [&](std::size_t i, int16_t* digits) {
+                          RecodeScalar(Scalar::CreateFromInt(
+                                           static_cast<unsigned int>(scalars[i])),
+                                       c, nwindows, digits, 1);
+                        })[0];
+}
+
+shf::Point shf::MultiExpSmall(const shf::PointColumn& bases,
+                              const std::vector<std::size_t>& scalars) {
+  return MultiExpSmallImpl(bases, scalars);
+}
+
+shf::Point shf::MultiExpSmall(const shf::PointColumn& bases,
+                              const std::vector<uint32_t>& scalars) {
+  return MultiExpSmallImpl(bases, scalars);
+}
+
+shf::FixedBasePoint::FixedBasePoint(const shf::Point& P, std::size_t width)
+    : m_width(width), m_windows(NumWindows(width)) {
+  CheckWidth(width);
+  const std::size_t half = std::size_t(1) << (m_width - 1);
+  std::vector<Point> table;
+  table.reserve(m_windows * half);
+  // base = 2^(width*j) * P for window j.
+  Point base = P;
+  for (std::size_t j = 0; j < m_windows; ++j) {
+    table.emplace_back(base);
+    for (std::size_t d = 1; d < half; ++d)
+      table.emplace_back(table.back() + base);
+    base = table.back().Double();
+  }
+  // affine entries make every lookup a cheaper mixed addition.
+  m_table = AffinePointVec(table);
+}
+
+shf::Point shf::FixedBasePoint::Mul(const shf::Scalar& s) const {
+  Point r;
+  MulMany(&s, &r, 1);
+  return r;
+}
+
+void shf::FixedBasePoint::MulMany(const shf::Scalar* scalars, shf::Point* out,
+                                  std::size_t n) const {
+  if (m_table.Empty()) throw std::logic_error("empty fixed-base table");
+  constexpr std::size_t kLanes = PointBatch::kLanes;
+  const std::size_t half = std::size_t(1) << (m_width - 1);
+  std::vector<int16_t> digits(kLanes * m_windows);
+  Point unused[kLanes];
+  for (std::size_t first = 0; first < n; first += kLanes) {
+    const std::size_t lanes = std::min(kLanes, n - first);
+    Point* results[kLanes];
+    for (std::size_t i = 0; i < kLanes; ++i) {
+      results[i] = i < lanes ? out + first + i : unused + i;
+      *results[i] = Point();
+      if (i < lanes)
+        RecodeScalar(scalars[first + i], m_width, m_windows,
+                     digits.data() + i * m_windows, 1);
+      else
+        std::fill(digits.begin() + i * m_windows,
+                  digits.begin() + (i + 1) * m_windows, 0);
+    }
+
+    // every window scans its whole row for every lane and always adds; lanes
+    // with a zero digit are masked out inside the batch.
+    PointBatch batch;
+    batch.Load(results);
+    for (std::size_t j = 0; j < m_windows; ++j) {
+      PointBackend::Affine Q[kLanes];
+      uint32_t skip = 0;
+      for (std::size_t i = 0; i < kLanes; ++i) {
+        uint32_t zero;
+        LookupAffine(Q[i], m_table.Data() + j * half, half,
+                     digits[i * m_windows + j], &zero);
+        skip |= zero << i;
+      }
+      batch.Add(Q, skip);
+    }
+    batch.Store(results);
+  }
+}
+
+shf::Point shf::FixedBasePoint::Mul(const shf::PublicScalar& s) const {
+  if (m_table.Empty()) throw std::logic_error("empty fixed-base table");
+  int16_t digits[kScalarBits + 1];
+  RecodeScalar(s, m_width, m_windows, digits, 1);
+  const std::size_t half = std::size_t(1) << (m_width - 1);
+  Point r;
+  for (std::size_t j = 0; j < m_windows; ++j) {
+    const int16_t d = digits[j];
+    if (d > 0)
+      r += m_table[j * half + d - 1];
+    else if (d < 0)
+      r -= m_table[j * half - d - 1];
+  }
+  return r;
+}
+
+std::size_t shf::FixedBasePoint::ByteSize() const { return m_table.ByteSize(); }
+
+shf::FixedBaseTable::FixedBaseTable(const shf::PointColumn& bases,
+                                    std::size_t width)
+    : m_size(bases.Size()), m_width(width), m_windows(NumWindows(width)) {
+  CheckWidth(width);
+  m_shifts.Reserve(m_size * m_windows);
+  // the shifts are stored window by window, so every window of a multiexp
+  // reads them in order. Each window is the previous one doubled width times,
+  // split over the default pool and joined in order.
+  ThreadPool& pool = DefaultThreadPool();
+  const std::size_t parts = pool.Parts(m_size, kParallelTerms);
+  for (std::size_t j = 0; j < m_windows; ++j) {
+    const auto window = pool.ParallelReduce(
+        parts, AffinePointVec(),
+        [&](std::size_t part) {
+          const std::size_t first = part * m_size / parts;
+          const std::size_t last = (part + 1) * m_size / parts;
+          std::vector<Point> shifted;
+          shifted.reserve(last - first);
+          for (std::size_t i = first; i < last; ++i) {
+            if (j == 0) {
+              shifted.emplace_back(bases[i]);
+              continue;
+            }
+            Point P = m_shifts[(j - 1) * m_size + i];
+            for (std::size_t k = 0; k < m_width; ++k) P = P.Double();
+            shifted.emplace_back(P);
+          }
+          return AffinePointVec(shifted);
+        },
+        [](AffinePointVec all, const AffinePointVec& part) {
+          all.Append(part);
+          return all;
+        });
+    m_shifts.Append(window);
+  }
+}
+
+std::size_t shf::FixedBaseTable::ByteSize() const {
+  return m_shifts.ByteSize();
+}
+
+std::size_t shf::FixedBaseTable::ByteSize(std::size_t size,
+                                          std::size_t width) {
+  CheckWidth(width);
+  return size * NumWindows(width) * sizeof(PointBackend::Affine);
+}
+
+// table[j * size + i] = 2^(width*j) * bases[i], for i < size.
+static shf::Point FixedBaseMultiExp(const shf::PointBackend::Affine* table,
+                                    const std::size_t size,
+                                    const std::size_t width,
+                                    const std::size_t windows,
+                                    const shf::PublicScalarVec& scalars) {
+  using shf::Point;
+  using shf::PointBackend;
+  const std::size_t n = scalars.size();
+  if (size < n) throw std::invalid_argument("not enough bases for multiexp");
+
+  // the single bucket pass costs 2^width additions, which only pays off when
+  // there are enough terms. Otherwise use the unshifted bases directly.
+  if (n * windows < (std::size_t(1) << width))
+    return shf::MultiExp(shf::PointColumn(table, size,
+                                          sizeof(PointBackend::Affine)),
+                         scalars);
+
+  // every shifted base is its own term with a width-bit digit, so all windows
+  // share one set of buckets and no doublings are needed. Terms first to last
+  // go into one set of buckets; pieces for the pool each need enough shifted
+  // terms to pay for their own bucket pass.
+  const std::size_t nbuckets = std::size_t(1) << (width - 1);
+  const auto bucket_sum = [&](std::size_t first, std::size_t last) {
+    const std::size_t m = last - first;
+    std::vector<int16_t> digits(windows * m);
+    for (std::size_t i = 0; i < m; ++i)
+      RecodeScalar(scalars[first + i], width, windows, digits.data() + i, m);
+    std::vector<Point> buckets(nbuckets);
+    BucketAdder adder(buckets);
+    for (std::size_t j = 0; j < windows; ++j) {
+      const int16_t* d = digits.data() + j * m;
+      const PointBackend::Affine* shifts = table + j * size + first;
+      for (std::size_t i = 0; i < m; ++i) {
+        if (d[i] > 0)
+          adder.Add(d[i] - 1, shifts[i]);
+        else if (d[i] < 0)
+          adder.Sub(-d[i] - 1, shifts[i]);
+      }
+    }
+    adder.Flush();
+
+    Point running, result;
+    for (std::size_t j = nbuckets; j-- > 0;) {
+      running += buckets[j];
+      result += running;
+    }
+    return result;
+  };
+
+  shf::ThreadPool& pool = shf::DefaultThreadPool();
+  const std::size_t parts = std::min(
+      pool.Parts(n, kParallelTerms), pool.Parts(n * windows, 8 * nbuckets));
+  return pool.ParallelReduce(
+      parts, Point(),
+      [&](std::size_t part) {
+        return bucket_sum(part * n / parts, (part + 1) * n / parts);
+      },
+      [](const Point& sum, const Point& part) { return sum + part; });
+}
+
+shf::Point shf::FixedBaseTable::MultiExp(
+    const shf::PublicScalarVec& scalars) const {
+  return FixedBaseMultiExp(m_shifts.Data(), m_size, m_width, m_windows,
+                           scalars);
+}
+
+// FixedBaseMultiExp for the first n bases of the table, whose windows are
+// stride points apart, together with the columns. The shifted bases share one
+// set of buckets over all windows, while the columns get fresh buckets and
+// doublings per window as in MultiExpRange.
+static std::vector<shf::Point> FixedBaseMultiExpRange(
+    const shf::PointBackend::Affine* table, const std::size_t stride,
+    const std::size_t width, const std::size_t windows,
+    const std::vector<shf::PointColumn>& columns,
+    const shf::PublicScalar* scalars, const std::size_t n) {
+  using shf::Point;
+  const std::size_t k = columns.size();
+  const std::size_t nbuckets = std::size_t(1) << (width - 1);
+
+  // digits are stored window-major so each pass below reads them in order.
+  std::vector<int16_t> digits(windows * n);
+  for (std::size_t i = 0; i < n; ++i)
+    RecodeScalar(scalars[i], width, windows, digits.data() + i, n);
+
+  bool affine = true;
+  for (const auto& column : columns) affine = affine && column.IsAffine();
+
+  std::vector<Point> results(k + 1);
+  std::vector<Point> table_buckets(nbuckets);
+  BucketAdder table_adder(table_buckets);
+  // buckets for column col are buckets[col * nbuckets, (col + 1) * nbuckets).
+  std::vector<Point> buckets(k * nbuckets);
+  for (std::size_t w = windows; w-- > 0;) {
+    for (std::size_t col = 1; col <= k; ++col)
+      if (!results[col].IsInfinity())
+        for (std::size_t j = 0; j < width; ++j)
+          results[col] = results[col].Double();
+
+    for (auto& bucket : buckets) bucket = Point();
+
+    const int16_t* d = digits.data() + w * n;
+    const shf::PointBackend::Affine* shifts = table + w * stride;
+    for (std::size_t i = 0; i < n; ++i) {
+      if (d[i] > 0)
+        table_adder.Add(d[i] - 1, shifts[i]);
+      else if (d[i] < 0)
+        table_adder.Sub(-d[i] - 1, shifts[i]);
+    }
+    if (affine) {
+      BucketAdder adder(buckets);
+      for (std::size_t i = 0; i < n; ++i) {
+        if (d[i] > 0) {
+          for (std::size_t col = 0; col < k; ++col)
+            adder.Add(col * nbuckets + d[i] - 1, columns[col].AffineAt(i));
+        } else if (d[i] < 0) {
+          for (std::size_t col = 0; col < k; ++col)
+            adder.Sub(col * nbuckets - d[i] - 1, columns[col].AffineAt(i));
+        }
+      }
+      adder.Flush();
+    } else {
+      for (std::size_t i = 0; i < n; ++i) {
+        if (d[i] > 0) {
+          for (std::size_t col = 0; col < k; ++col)
+            buckets[col * nbuckets + d[i] - 1] += columns[col][i];
+        } else if (d[i] < 0) {
+          for (std::size_t col = 0; col < k; ++col)
+            buckets[col * nbuckets - d[i] - 1] -= columns[col][i];
+        }
+      }
+    }
+
+    for (std::size_t col = 0; col < k; ++col) {
+      Point running, window_sum;
+      for (std::size_t j = nbuckets; j-- > 0;) {
+        running += buckets[col * nbuckets + j];
+        window_sum += running;
+      }
+      results[col + 1] += window_sum;
+    }
+  }
+
+  table_adder.Flush();
+  Point running;
+  for (std::size_t j = nbuckets; j-- > 0;) {
+    running += table_buckets[j];
+    results[0] += running;
+  }
+  return results;
+}
+
+std::vector<shf::Point> shf::FixedBaseTable::MultiExp(
+    const shf::PublicScalarVec& scalars,
+    const std::vector<shf::PointColumn>& columns) const {
+  const std::size_t n = scalars.size();
+  if (m_size < n) throw std::invalid_argument("not enough bases for multiexp");
+  CheckBases(columns, n);
+
+  // as in FixedBaseMultiExp, short inputs use the unshifted bases as one more
+  // column instead.
+  if (n * m_windows < (std::size_t(1) << m_width)) {
+    std::vector<PointColumn> all;
+    all.emplace_back(m_shifts.Data(), m_size, sizeof(PointBackend::Affine));
+    all.insert(all.end(), columns.begin(), columns.end());
+    return shf::MultiExp(all, scalars);
+  }
+
+  ThreadPool& pool = DefaultThreadPool();
+  const std::size_t parts = pool.Parts(n, kParallelTerms);
+  return pool.ParallelReduce(
+      parts, std::vector<Point>(columns.size() + 1),
+      [&](std::size_t part) {
+        const std::size_t first = part * n / parts;
+        const std::size_t last = (part + 1) * n / parts;
+        std::vector<PointColumn> slices;
+        for (const auto& column : columns)
+          slices.push_back(column.Slice(first, last - first));
+        return FixedBaseMultiExpRange(m_shifts.Data() + first, m_size, m_width,
+                                      m_windows, slices, scalars.data() + first,
+                                      last - first);
+      },
+      AddColumns);
+}
@@ -0,0 +1,311 @@
+#ifndef SHF_MSM_H
+#define SHF_MSM_H
+
+#include <cstdint>
+#include <vector>
+
+#include "curve.h"
+
+namespace shf {
+
+/**
+ * @brief A read-only view of a column of points.
+ *
+ * A column is <code>size</code> points spaced <code>stride</code> bytes
+ * apart, which lets a multiexp read e.g. the U components of a vector of
+ * ciphertexts without copying them out first. The points are either Points or
+ * affine points as stored in an AffinePointVec.
+ */
+class PointColumn {
+ public:
+  PointColumn(const std::vector<Point>& points)
+      : PointColumn(points.data(), points.size(), sizeof(Point)){};
+
+  PointColumn(const Point* first, std::size_t size, std::size_t stride)
+      : m_first(reinterpret_cast<const uint8_t*>(first)),
+        m_size(size),
+        m_stride(stride),
+        m_affine(false){};
+
+  PointColumn(const AffinePointVec& points)
+      : PointColumn(points.Data(), points.Size(),
+                    sizeof(PointBackend::Affine)){};
+
+  PointColumn(const PointBackend::Affine* first, std::size_t size,
+              std::size_t stride)
+      : m_first(reinterpret_cast<const uint8_t*>(first)),
+        m_size(size),
+        m_stride(stride),
+        m_affine(true){};
+
+  std::size_t Size() const { return m_size; };
+
+  bool IsAffine() const { return m_affine; };
+
+  /**
+   * @brief The size points starting at point first, as a column of the same
+   * kind.
+   */
+  PointColumn Slice(std::size_t first, std::size_t size) const {
+    PointColumn slice = *this;
+    slice.m_first += first * m_stride;
+    slice.m_size = size;
+    return slice;
+  };
+
+  /**
+   * @brief Read point i of an affine column without converting it.
+   */
+  const PointBackend::Affine& AffineAt(std::size_t i) const {
+    return *reinterpret_cast<const PointBackend::Affine*>(m_first +
+                                                          i * m_stride);
+  };
+
+  Point operator[](std::size_t i) const {
+    const uint8_t* p = m_first + i * m_stride;
+    if (m_affine)
+      return Point::FromAffine(
+          *reinterpret_cast<const PointBackend::Affine*>(p));
+    return *reinterpret_cast<const Point*>(p);
+  };
+
+ private:
+  const uint8_t* m_first;
+  std::size_t m_size;
+  std::size_t m_stride;
+  bool m_affine;
+};
+
+/**
+ * @brief Compute a multi-scalar multiplication in constant time.
+ *
+ * Uses Straus's method with 5-bit windows: every base gets a table of 16
+ * multiples, and each window scans the whole table of every term and adds the
+ * selected multiple through a PointBatch. The memory accesses and additions do
+ * not depend on the scalars, so they can be secret. Whether a base is infinity
+ * is not kept secret.
+ *
+ * @param bases the points. Must hold at least as many points as there are
+ * scalars; only the first <code>scalars.size()</code> points are used.
+ * @param scalars the scalars
+ * @return sum_i scalars[i]*bases[i].
+ */
+Point MultiExp(const PointColumn& bases, const ScalarVec& scalars);
+
+/**
+ * @brief Compute a multi-scalar multiplication with public scalars.
+ *
+ * Uses Pippenger's bucket method with a window size picked from the number of
+ * terms, which needs roughly n/log(n) point additions per window instead of an
+ * addition per term, about half the work of the constant-time version. The
+ * buckets a term is added to depend on the digits of its scalar, so this leaks
+ * the scalars through timing. Used by verifiers.
+ */
+Point MultiExp(const PointColumn& bases, const PublicScalarVec& scalars);
+
+/**
+ * @brief Compute several multi-scalar multiplications that share scalars.
+ *
+ * The scalars are recoded once and each window is walked once for all
+ * columns. This is cheaper than calling MultiExp once per column when the same
+ * scalars are used against several sets of bases. Constant time for a
+ * ScalarVec, like MultiExp.
+ *
+ * @param columns the columns of bases. Each column must hold at least as many
+ * points as there are scalars.
+ * @param scalars the scalars
+ * @return a vector R with R[k] = sum_i scalars[i]*columns[k][i].
+ */
+std::vector<Point> MultiExp(const std::vector<PointColumn>& columns,
+                            const ScalarVec& scalars);
+
+std::vector<Point> MultiExp(const std::vector<PointColumn>& columns,
+                            const PublicScalarVec& scalars);
+
+/**
+ * @brief Compute a multi-scalar multiplication with small integer scalars.
+ *
+ * The windows only cover the bits of the largest scalar, and their width is
+ * picked from that bit length, so scalars below 2^20 take about a dozen
+ * additions per term instead of the 67 of a full 256-bit scalar. Meant for
+ * committing to permutations. Like MultiExp this is constant time, except that
+ * the bit length of the largest scalar is not kept secret; for a permutation
+ * it is public anyway.
+ *
+ * @param bases the points. Must hold at least as many points as there are
+ * scalars.
+ * @param scalars the scalars, each below 2^32
+ * @return sum_i scalars[i]*bases[i].
+ * @throws std::invalid_argument if a scalar is 2^32 or larger.
+ */
+Point MultiExpSmall(const PointColumn& bases,
+                    const std::vector<std::size_t>& scalars);
+Point MultiExpSmall(const PointColumn& bases,
+                    const std::vector<uint32_t>& scalars);
+
+/**
+ * @brief Multiply every point of a column by the same scalar.
+ *
+ * Works through the column in chunks with Point::MulMany, so the scalar is
+ * recoded once and each chunk shares one inversion. Constant time in the
+ * scalar, so it can be used with secret keys.
+ *
+ * @param scalar the scalar
+ * @param points the points
+ * @return a vector R with R[i] = scalar*points[i].
+ */
+std::vector<Point> MulMany(const Scalar& scalar, const PointColumn& points);
+
+/**
+ * @brief Sum the points of a column.
+ *
+ * Works through the column in chunks that are summed as a tree in affine
+ * coordinates: each level adds disjoint pairs with PointBackend::AddAffineBatch,
+ * so a level costs one inversion and about 6 multiplications per pair, against
+ * 11 or more for a projective addition. Columns of Points are normalized first,
+ * which costs about as much as the tree saves, so affine columns such as
+ * AffinePointVec and CtxtVector gain the most. Not constant time.
+ *
+ * @param points the points
+ * @return sum_i points[i].
+ */
+Point SumPoints(const PointColumn& points);
+
+/**
+ * @brief The window size MultiExp uses for a given number of terms.
+ * @param n the number of terms
+ * @return a window size in bits.
+ */
+std::size_t MultiExpWindowSize(std::size_t n);
+
+/**
+ * @brief Precomputed multiples of a single fixed point.
+ *
+ * Holds d*2^(w*j)*P for every window j and every digit 1 <= d <= 2^(w-1), so
+ * multiplying the point by a scalar costs one addition per window and no
+ * doublings. The table holds about (256/w)*2^(w-1) points.
+ *
+ * Multiplying by a Scalar runs in constant time: every window scans its whole
+ * row of 2^(w-1) entries and always adds, so wide tables cost more per
+ * multiplication than they save. Multiplying by a PublicScalar reads the
+ * entries by digit in variable time.
+ */
+class FixedBasePoint {
+ public:
+  FixedBasePoint() = default;
+
+  /**
+   * @brief Build the table for a point.
+   * @param P the point
+   * @param width the window width in bits, between 1 and 15
+   */
+  FixedBasePoint(const Point& P, std::size_t width);
+
+  /**
+   * @brief Multiply the fixed point by a secret scalar in constant time.
+   * @param s the scalar
+   * @return s*P.
+   */
+  Point Mul(const Scalar& s) const;
+
+  /**
+   * @brief Multiply the fixed point by a public scalar in variable time.
+   */
+  Point Mul(const PublicScalar& s) const;
+
+  /**
+   * @brief Multiply the fixed point by many secret scalars in constant time.
+   *
+   * The scalars walk the table in lockstep through a PointBatch, which is
+   * faster than calling Mul for each of them when the backend has vectorized
+   * field arithmetic.
+   *
+   * @param scalars the scalars
+   * @param out receives scalars[i]*P for each i
+   * @param n the number of scalars
+   */
+  void MulMany(const Scalar* scalars, Point* out, std::size_t n) const;
+
+  bool Empty() const { return m_table.Empty(); };
+
+  std::size_t ByteSize() const;
+
+ private:
+  std::size_t m_width = 0;
+  std::size_t m_windows = 0;
+  AffinePointVec m_table;
+};
+
+/**
+ * @brief Precomputed window shifts for a list of fixed bases.
+ *
+ * Holds 2^(w*j)*bases[i] for every base i and window j, stored window by
+ * window so that a multiexp reads each window in order. A multiexp against the
+ * bases then treats every shifted base as its own term with a w-bit digit, so
+ * all windows share a single set of buckets and no doublings are needed. The
+ * table holds about n*(256/w) points.
+ *
+ * The buckets are picked by digit, so only public scalars are accepted; use
+ * MultiExp against the bases for secret ones.
+ */
+class FixedBaseTable {
+ public:
+  FixedBaseTable() = default;
+
+  /**
+   * @brief Build the table for a list of bases.
+   * @param bases the bases
+   * @param width the window width in bits, between 1 and 15
+   */
+  FixedBaseTable(const PointColumn& bases, std::size_t width);
+
+  /**
+   * @brief Compute a multiexp against a prefix of the bases, in variable time.
+   * @param scalars the scalars. There can be at most Size() of them.
+   * @return sum_i scalars[i]*bases[i].
+   */
+  Point MultiExp(const PublicScalarVec& scalars) const;
+
+  /**
+   * @brief Compute a multiexp against a prefix of the bases together with
+   * multiexps against other columns that share the scalars, in variable time.
+   *
+   * The scalars are recoded once with the table's width and the windows are
+   * walked once. In each window the shifted bases go into one set of buckets
+   * that is kept across all windows, and the points of the columns go into
+   * fresh buckets per window as in MultiExp. This saves a second recoding and
+   * pass over the scalars compared with calling MultiExp twice.
+   *
+   * @param scalars the scalars. There can be at most Size() of them.
+   * @param columns the other columns. Each must hold at least as many points
+   * as there are scalars.
+   * @return a vector R with R[0] = sum_i scalars[i]*bases[i] and
+   * R[k + 1] = sum_i scalars[i]*columns[k][i].
+   */
+  std::vector<Point> MultiExp(const PublicScalarVec& scalars,
+                              const std::vector<PointColumn>& columns) const;
+
+  std::size_t Size() const { return m_size; };
+
+  std::size_t Width() const { return m_width; };
+
+  std::size_t ByteSize() const;
+
+  /**
+   * @brief The memory a table would need.
+   * @param size the number of bases
+   * @param width the window width in bits
+   * @return the size of the table in bytes.
+   */
+  static std::size_t ByteSize(std::size_t size, std::size_t width);
+
+ private:
+  std::size_t m_size = 0;
+  std::size_t m_width = 0;
+  std::size_t m_windows = 0;
+  AffinePointVec m_shifts;
+};
+
+}  // namespace shf
+
+#endif  // SHF_MSM_H
@@ -0,0 +1,658 @@
+#include "p256.h"
+
+#include <algorithm>
+#include <vector>
+
+#include "p256_batch.h"
+
+using shf::p256::Affine;
+using shf::p256::Batch;
+using shf::p256::Fe;
+using shf::p256::Jacobian;
+
+static const uint8_t kCurveB[32] = {
+    0x5A, 0xC6, 0x35, 0xD8, 0xAA, 0x3A, 0x93, 0xE7, 0xB3, 0xEB, 0xBD,
+    0x55, 0x76, 0x98, 0x86, 0xBC, 0x65, 0x1D, 0x06, 0xB0, 0xCC, 0x53,
+    0xB0, 0xF6, 0x3B, 0xCE, 0x3C, 0x3E, 0x27, 0xD2, 0x60, 0x4B};
+
+static const uint8_t kGeneratorX[32] = {
+    0x6B, 0x17, 0xD1, 0xF2, 0xE1, 0x2C, 0x42, 0x47, 0xF8, 0xBC, 0xE6,
+    0xE5, 0x63, 0xA4, 0x40, 0xF2, 0x77, 0x03, 0x7D, 0x81, 0x2D, 0xEB,
+    0x33, 0xA0, 0xF4, 0xA1, 0x39, 0x45, 0xD8, 0x98, 0xC2, 0x96};
+
+static const uint8_t kGeneratorY[32] = {
+    0x4F, 0xE3, 0x42, 0xE2, 0xFE, 0x1A, 0x7F, 0x9B, 0x8E, 0xE7, 0xEB,
+    0x4A, 0x7C, 0x0F, 0x9E, 0x16, 0x2B, 0xCE, 0x33, 0x57, 0x6B, 0x31,
+    0x5E, 0xCE, 0xCB, 0xB6, 0x40, 0x68, 0x37, 0xBF, 0x51, 0xF5};
+
+// (p + 1) / 4, for square roots since p = 3 mod 4.
+static const uint64_t kSqrtExponent[4] = {0x0000000000000000, 0x0000000040000000,
+                                          0x4000000000000000, 0x3FFFFFFFC0000000};
+
+// scalar multiplication uses signed 5-bit windows with digits in [-15, 16].
+static constexpr std::size_t kWindow = 5;
+static constexpr std::size_t kWindows = 256 / kWindow + 1;
+static constexpr std::size_t kTableSize = 1 << (kWindow - 1);
+
+static const Fe& CurveB() {
+  static const Fe b = Fe::Read(kCurveB);
+  return b;
+}
+
+Jacobian shf::p256::Infinity() { return {Fe::One(), Fe::One(), Fe::Zero()}; }
+
+Jacobian shf::p256::Generator() {
+  static const Jacobian g = {Fe::Read(kGeneratorX), Fe::Read(kGeneratorY),
+                             Fe::One()};
+  return g;
+}
+
+Jacobian shf::p256::FromAffine(const Affine& P) { return {P.x, P.y, Fe::One()}; }
+
+bool shf::p256::IsOnCurve(const Affine& P) {
+  const Fe rhs = (P.x.Square() - Fe::FromInt(3)) * P.x + CurveB();
+  return P.y.Square() == rhs;
+}
+
+Affine shf::p256::ToAffine(const Jacobian& P) {
+  if (IsNormalized(P)) return {P.X, P.Y};
+  const Fe zinv = P.Z.Invert();
+  const Fe zinv2 = zinv.Square();
+  return {P.X * zinv2, P.Y * zinv2 * zinv};
+}
+
+void shf::p256::NormalizeBatch(Jacobian* const* points, std::size_t n) {
+  std::vector<Jacobian*> todo;
+  todo.reserve(n);
+  for (std::size_t i = 0; i < n; ++i)
+    if (!IsInfinity(*points[i]) && !IsNormalized(*points[i]))
+      todo.push_back(points[i]);
+  if (todo.empty()) return;
+
+  // prefix[i] = Z_0 * ... * Z_i
+  const std::size_t m = todo.size();
+  std::vector<Fe> prefix(m);
+  prefix[0] = todo[0]->Z;
+  for (std::size_t i = 1; i < m; ++i) prefix[i] = prefix[i - 1] * todo[i]->Z;
+
+  Fe inv = prefix[m - 1].Invert();
+  for (std::size_t i = m; i-- > 0;) {
+    Jacobian* P = todo[i];
+    // inv = 1/(Z_0 * ... * Z_i) here
+    const Fe zinv = i ? inv * prefix[i - 1] : inv;
+    if (i) inv *= P->Z;
+    const Fe zinv2 = zinv.Square();
+    P->X *= zinv2;
+    P->Y *= zinv2 * zinv;
+    P->Z = Fe::One();
+  }
+}
+
+namespace {
+// how AddAffineBatch computes each sum.
+enum class AffineSum : uint8_t { kAdd, kDouble, kFirst, kSecond, kInfinity };
+}  // namespace
+
+static inline bool IsAffineInfinity(const Affine& P) {
+  return P.x.IsZero() && P.y.IsZero();
+}
+
+void shf::p256::AddAffineBatch(Affine* r, const Affine* a, const Affine* b,
+                               std::size_t n) {
+  if (!n) return;
+
+  // prefix[i] is the product of the slope denominators of pairs 0..i. Pairs
+  // without a slope contribute a factor of one.
+  std::vector<AffineSum> kinds(n);
+  std::vector<Fe> prefix(n);
+  Fe acc = Fe::One();
+  for (std::size_t i = 0; i < n; ++i) {
+    AffineSum kind;
+    if (IsAffineInfinity(a[i]))
+      kind = AffineSum::kSecond;
+    else if (IsAffineInfinity(b[i]))
+      kind = AffineSum::kFirst;
+    else if (!(a[i].x == b[i].x))
+      kind = AffineSum::kAdd;
+    else if (a[i].y == b[i].y)
+      kind = AffineSum::kDouble;
+    else
+      kind = AffineSum::kInfinity;
+    kinds[i] = kind;
+    if (kind == AffineSum::kAdd)
+      acc *= b[i].x - a[i].x;
+    else if (kind == AffineSum::kDouble)
+      acc *= a[i].y.Double();
+    prefix[i] = acc;
+  }
+
+  Fe inv = acc.Invert();
+  for (std::size_t i = n; i-- > 0;) {
+    switch (kinds[i]) {
+      case AffineSum::kFirst:
+        r[i] = a[i];
+        continue;
+      case AffineSum::kSecond:
+        r[i] = b[i];
+        continue;
+      case AffineSum::kInfinity:
+        r[i] = {Fe::Zero(), Fe::Zero()};
+        continue;
+      default:
+        break;
+    }
+    // inv = 1/prefix[i] here
+    const Fe dinv = i ? inv * prefix[i - 1] : inv;
+    Fe lambda;
+    if (kinds[i] == AffineSum::kAdd) {
+      inv *= b[i].x - a[i].x;
+      lambda = (b[i].y - a[i].y) * dinv;
+    } else {
+      inv *= a[i].y.Double();
+      // (3x^2 + a) / 2y with a = -3.
+      const Fe t = a[i].x.Square() - Fe::One();
+      lambda = (t + t.Double()) * dinv;
+    }
+    const Fe x = lambda.Square() - a[i].x - b[i].x;
+    const Fe y = lambda * (a[i].x - x) - a[i].y;
+    r[i] = {x, y};
+  }
+}
+
+Jacobian shf::p256::Negate(const Jacobian& P) { return {P.X, -P.Y, P.Z}; }
+
+Jacobian shf::p256::Double(const Jacobian& P) {
+  const Fe delta = P.Z.Square();
+  const Fe gamma = P.Y.Square();
+  const Fe beta = P.X * gamma;
+  const Fe t = (P.X - delta) * (P.X + delta);
+  const Fe alpha = t + t.Double();
+  const Fe beta4 = beta.Double().Double();
+  Jacobian R;
+  R.X = alpha.Square() - beta4.Double();
+  R.Z = (P.Y + P.Z).Square() - gamma - delta;
+  const Fe gamma2 = gamma.Square();
+  R.Y = alpha * (beta4 - R.X) - gamma2.Double().Double().Double();
+  return R;
+}
+
+// add-2007-bl without the special cases. Sets *dbl if P == Q, in which case the
+// result is meaningless.
+static inline Jacobian AddUnchecked(const Jacobian& P, const Jacobian& Q,
+                                    bool* dbl) {
+  const Fe Z1Z1 = P.Z.Square();
+  const Fe Z2Z2 = Q.Z.Square();
+  const Fe U1 = P.X * Z2Z2;
+  const Fe U2 = Q.X * Z1Z1;
+  const Fe S1 = P.Y * Q.Z * Z2Z2;
+  const Fe S2 = Q.Y * P.Z * Z1Z1;
+  const Fe H = U2 - U1;
+  const Fe r = (S2 - S1).Double();
+  *dbl = H.IsZero() & r.IsZero();
+  const Fe I = H.Double().Square();
+  const Fe J = H * I;
+  const Fe V = U1 * I;
+  Jacobian R;
+  R.X = r.Square() - J - V.Double();
+  R.Y = r * (V - R.X) - (S1 * J).Double();
+  R.Z = ((P.Z + Q.Z).Square() - Z1Z1 - Z2Z2) * H;
+  return R;
+}
+
+// madd-2007-bl without the special cases. See AddUnchecked.
+static inline Jacobian AddMixedUnchecked(const Jacobian& P, const Affine& Q,
+                                         bool* dbl) {
+  const Fe Z1Z1 = P.Z.Square();
+  const Fe U2 = Q.x * Z1Z1;
+  const Fe S2 = Q.y * P.Z * Z1Z1;
+  const Fe H = U2 - P.X;
+  const Fe r = (S2 - P.Y).Double();
+  *dbl = H.IsZero() & r.IsZero();
+  const Fe HH = H.Square();
+  const Fe I = HH.Double().Double();
+  const Fe J = H * I;
+  const Fe V = P.X * I;
+  Jacobian R;
+  R.X = r.Square() - J - V.Double();
+  R.Y = r * (V - R.X) - (P.Y * J).Double();
+  R.Z = (P.Z + H).Square() - Z1Z1 - HH;
+  return R;
+}
+
+Jacobian shf::p256::AddMixed(const Jacobian& P, const Affine& Q) {
+  if (IsInfinity(P)) return FromAffine(Q);
+  bool dbl;
+  const Jacobian R = AddMixedUnchecked(P, Q, &dbl);
+  if (dbl) return Double(P);
+  return R;
+}
+
+Jacobian shf::p256::Add(const Jacobian& P, const Jacobian& Q) {
+  if (IsInfinity(P)) return Q;
+  if (IsInfinity(Q)) return P;
+  if (IsNormalized(Q)) return AddMixed(P, {Q.X, Q.Y});
+  bool dbl;
+  const Jacobian R = AddUnchecked(P, Q, &dbl);
+  if (dbl) return Double(P);
+  return R;
+}
+
+bool shf::p256::Equal(const Jacobian& P, const Jacobian& Q) {
+  const bool pinf = IsInfinity(P);
+  const bool qinf = IsInfinity(Q);
+  if (pinf || qinf) return pinf && qinf;
+  const Fe Z1Z1 = P.Z.Square();
+  const Fe Z2Z2 = Q.Z.Square();
+  return P.X * Z2Z2 == Q.X * Z1Z1 && P.Y * Z2Z2 * Q.Z == Q.Y * Z1Z1 * P.Z;
+}
+
+static inline Jacobian Select(uint64_t bit, const Jacobian& a,
+                              const Jacobian& b) {
+  return {Fe::Select(bit, a.X, b.X), Fe::Select(bit, a.Y, b.Y),
+          Fe::Select(bit, a.Z, b.Z)};
+}
+
+// Recode k into kWindows signed digits in [-15, 16] without branches.
+static inline void RecodeSigned(const uint64_t k[4], int32_t digits[kWindows]) {
+  uint32_t carry = 0;
+  for (std::size_t w = 0; w < kWindows; ++w) {
+    const std::size_t off = w * kWindow;
+    const std::size_t li = off / 64;
+    const std::size_t bi = off % 64;
+    uint64_t bits = li < 4 ? k[li] >> bi : 0;
+    if (bi + kWindow > 64 && li + 1 < 4) bits |= k[li + 1] << (64 - bi);
+    const int32_t d = static_cast<int32_t>(bits & 0x1F) + carry;
+    carry = static_cast<uint32_t>(kTableSize - d) >> 31;
+    digits[w] = d - static_cast<int32_t>(carry << kWindow);
+  }
+}
+
+// Constant-time: returns |d|*P from table (table[i] = (i+1)*P), negated if
+// d < 0, or infinity if d == 0.
+static inline Jacobian Lookup(const Jacobian* table, int32_t d) {
+  const uint32_t neg = static_cast<uint32_t>(d) >> 31;
+  const uint32_t abs = (static_cast<uint32_t>(d) ^ (0 - neg)) + neg;
+  Jacobian R = shf::p256::Infinity();
+  for (uint32_t i = 0; i < kTableSize; ++i) {
+    const uint64_t eq = ((static_cast<uint64_t>(abs ^ (i + 1)) - 1) >> 63);
+    R = Select(eq, R, table[i]);
+  }
+  R.Y = Fe::Select(neg, R.Y, -R.Y);
+  return R;
+}
+
+// Constant-time P + Q, except that P == Q (which only happens with negligible
+// probability inside a scalar multiplication) takes a branch.
+static inline Jacobian AddConstTime(const Jacobian& P, const Jacobian& Q) {
+  bool dbl;
+  Jacobian R = AddUnchecked(P, Q, &dbl);
+  const uint64_t pinf = P.Z.IsZero();
+  const uint64_t qinf = Q.Z.IsZero();
+  if (dbl & !pinf & !qinf) return shf::p256::Double(P);
+  R = Select(pinf, R, Q);
+  return Select(qinf, R, P);
+}
+
+// table[i] = (i + 1) * P
+static inline void BuildTable(const Jacobian& P, Jacobian table[kTableSize]) {
+  table[0] = P;
+  table[1] = shf::p256::Double(P);
+  for (std::size_t i = 2; i < kTableSize; ++i)
+    table[i] = shf::p256::Add(table[i - 1], P);
+}
+
+Jacobian shf::p256::Mul(const Jacobian& P, const uint64_t k[4]) {
+  Jacobian table[kTableSize];
+  BuildTable(P, table);
+
+  int32_t digits[kWindows];
+  RecodeSigned(k, digits);
+
+  Jacobian R = Lookup(table, digits[kWindows - 1]);
+  for (std::size_t w = kWindows - 1; w-- > 0;) {
+    for (std::size_t j = 0; j < kWindow; ++j) R = Double(R);
+    R = AddConstTime(R, Lookup(table, digits[w]));
+  }
+  return R;
+}
+
+Jacobian shf::p256::MulAdd2(const uint64_t k[4], const Jacobian& P,
+                            const uint64_t l[4], const Jacobian& Q) {
+  Jacobian ptable[kTableSize], qtable[kTableSize];
+  BuildTable(P, ptable);
+  BuildTable(Q, qtable);
+
+  int32_t kdigits[kWindows], ldigits[kWindows];
+  RecodeSigned(k, kdigits);
+  RecodeSigned(l, ldigits);
+
+  Jacobian R = AddConstTime(Lookup(ptable, kdigits[kWindows - 1]),
+                            Lookup(qtable, ldigits[kWindows - 1]));
+  for (std::size_t w = kWindows - 1; w-- > 0;) {
+    for (std::size_t j = 0; j < kWindow; ++j) R = Double(R);
+    R = AddConstTime(R, Lookup(ptable, kdigits[w]));
+    R = AddConstTime(R, Lookup(qtable, ldigits[w]));
+  }
+  return R;
+}
+
+// Constant-time: returns |d|*P from an affine table (table[i] = (i+1)*P),
+// negated if d < 0. Sets *zero if d == 0, in which case the result is
+// meaningless.
+static inline Affine LookupAffine(const Affine* table, int32_t d,
+                                  uint64_t* zero) {
+  const uint32_t neg = static_cast<uint32_t>(d) >> 31;
+  const uint32_t abs = (static_cast<uint32_t>(d) ^ (0 - neg)) + neg;
+  Affine R = table[0];
+  for (uint32_t i = 1; i < kTableSize; ++i) {
+    const uint64_t eq = ((static_cast<uint64_t>(abs ^ (i + 1)) - 1) >> 63);
+    R.x = Fe::Select(eq, R.x, table[i].x);
+    R.y = Fe::Select(eq, R.y, table[i].y);
+  }
+  R.y = Fe::Select(neg, R.y, -R.y);
+  *zero = (static_cast<uint64_t>(abs) - 1) >> 63;
+  return R;
+}
+
+Jacobian shf::p256::AddMixedConstTime(const Jacobian& P, const Affine& Q,
+                                      uint64_t skip) {
+  bool dbl;
+  Jacobian R = AddMixedUnchecked(P, Q, &dbl);
+  const uint64_t pinf = P.Z.IsZero();
+  if (dbl & !pinf & !skip) return Double(P);
+  R = Select(pinf, R, FromAffine(Q));
+  return Select(skip, R, P);
+}
+
+// points are multiplied this many at a time by MulMany, so the tables of a
+// chunk (32 KiB) stay in L1 and share one inversion.
+static constexpr std::size_t kMulManyChunk = 64;
+
+// runs the ladders of MulMany Batch::kLanes points at a time, so that each
+// field multiplication of a step is shared by the lanes. Lanes past n are
+// skipped throughout and never stored.
+static void MulLockstep(Jacobian* r, const int32_t digits[kWindows],
+                        const Affine* affine, const std::size_t* finite,
+                        std::size_t n) {
+  constexpr std::size_t kLanes = Batch::kLanes;
+  for (std::size_t f = 0; f < n; f += kLanes) {
+    const std::size_t lanes = std::min(kLanes, n - f);
+    Jacobian R[kLanes];
+    Affine Q[kLanes] = {};
+    const Jacobian* in[kLanes];
+    Jacobian* out[kLanes];
+    uint64_t zero;
+    for (std::size_t i = 0; i < kLanes; ++i) {
+      R[i] = shf::p256::Infinity();
+      if (i < lanes) {
+        const Affine* table = affine + (f + i) * kTableSize;
+        const Affine T = LookupAffine(table, digits[kWindows - 1], &zero);
+        R[i] = Select(zero, shf::p256::FromAffine(T), shf::p256::Infinity());
+      }
+      in[i] = out[i] = R + i;
+    }
+    Batch batch;
+    batch.Load(in);
+    const uint32_t unused = ~((uint32_t(1) << lanes) - 1) & 0xff;
+    for (std::size_t w = kWindows - 1; w-- > 0;) {
+      for (std::size_t j = 0; j < kWindow; ++j) batch.Double();
+      uint32_t skip = unused;
+      for (std::size_t i = 0; i < lanes; ++i) {
+        const Affine* table = affine + (f + i) * kTableSize;
+        Q[i] = LookupAffine(table, digits[w], &zero);
+        skip |= static_cast<uint32_t>(zero) << i;
+      }
+      batch.AddMixed(Q, skip);
+    }
+    batch.Store(out);
+    for (std::size_t i = 0; i < lanes; ++i) r[finite[f + i]] = R[i];
+  }
+}
+
+void shf::p256::MulMany(Jacobian* r, const uint64_t k[4],
+                        const Jacobian* points, std::size_t n) {
+  int32_t digits[kWindows];
+  RecodeSigned(k, digits);
+
+  std::vector<Jacobian> tables(kMulManyChunk * kTableSize);
+  std::vector<Jacobian*> ptrs;
+  std::vector<Affine> affine(kMulManyChunk * kTableSize);
+  std::vector<std::size_t> finite;
+  ptrs.reserve(tables.size());
+  finite.reserve(kMulManyChunk);
+
+  for (std::size_t first = 0; first < n; first += kMulManyChunk) {
+    const std::size_t last = std::min(n, first + kMulManyChunk);
+    // whether an input is infinity is not secret, so those are skipped. The
+    // multiples of a finite point are finite since the group order is prime.
+    finite.clear();
+    ptrs.clear();
+    for (std::size_t i = first; i < last; ++i) {
+      if (IsInfinity(points[i])) continue;
+      Jacobian* table = tables.data() + finite.size() * kTableSize;
+      BuildTable(points[i], table);
+      for (std::size_t j = 0; j < kTableSize; ++j) ptrs.push_back(table + j);
+      finite.push_back(i);
+    }
+    NormalizeBatch(ptrs.data(), ptrs.size());
+    for (std::size_t j = 0; j < ptrs.size(); ++j)
+      affine[j] = {ptrs[j]->X, ptrs[j]->Y};
+
+    for (std::size_t i = first; i < last; ++i)
+      if (IsInfinity(points[i])) r[i] = Infinity();
+    if (Batch::Vectorized()) {
+      MulLockstep(r, digits, affine.data(), finite.data(), finite.size());
+      continue;
+    }
+    for (std::size_t f = 0; f < finite.size(); ++f) {
+      const Affine* table = affine.data() + f * kTableSize;
+      uint64_t zero;
+      Affine Q = LookupAffine(table, digits[kWindows - 1], &zero);
+      Jacobian R = Select(zero, FromAffine(Q), Infinity());
+      for (std::size_t w = kWindows - 1; w-- > 0;) {
+        for (std::size_t j = 0; j < kWindow; ++j) R = Double(R);
+        Q = LookupAffine(table, digits[w], &zero);
+        R = AddMixedConstTime(R, Q, zero);
+      }
+      r[finite[f]] = R;
+    }
+  }
+}
+
+// width-kWindow NAF: nonzero digits are odd, lie in [-15, 15] and are
+// followed by at least kWindow - 1 zeros. Returns the number of digits.
+static inline std::size_t RecodeNaf(const uint64_t k[4], int8_t naf[257]) {
+  // one limb more than k, since subtracting a negative digit can carry out.
+  uint64_t t[5] = {k[0], k[1], k[2], k[3], 0};
+  std::size_t len = 0;
+  while (t[0] | t[1] | t[2] | t[3] | t[4]) {
+    int32_t d = 0;
+    if (t[0] & 1) {
+      d = static_cast<int32_t>(t[0] & 0x1F);
+      if (d > 16) d -= 32;
+      // t -= d, which clears the low kWindow bits. A positive d equals the
+      // low bits of t, so subtracting it cannot borrow.
+      if (d > 0) {
+        t[0] -= static_cast<uint64_t>(d);
+      } else {
+        uint64_t carry = static_cast<uint64_t>(-d);
+        for (std::size_t i = 0; i < 5 && carry; ++i) {
+          t[i] += carry;
+          carry = t[i] < carry;
+        }
+      }
+    }
+    naf[len++] = static_cast<int8_t>(d);
+    for (std::size_t i = 0; i < 4; ++i) t[i] = (t[i] >> 1) | (t[i + 1] << 63);
+    t[4] >>= 1;
+  }
+  return len;
+}
+
+// odd[i] = (2i + 1) * P
+static inline void BuildOddTable(const Jacobian& P,
+                                 Jacobian odd[kTableSize / 2]) {
+  odd[0] = P;
+  const Jacobian P2 = shf::p256::Double(P);
+  for (std::size_t i = 1; i < kTableSize / 2; ++i)
+    odd[i] = shf::p256::Add(odd[i - 1], P2);
+}
+
+// R + d*P for a NAF digit d, given the odd multiples of P.
+static inline Jacobian AddNafDigit(const Jacobian& R, int8_t d,
+                                   const Jacobian odd[kTableSize / 2]) {
+  if (d > 0) return shf::p256::Add(R, odd[(d - 1) / 2]);
+  if (d < 0) return shf::p256::Add(R, shf::p256::Negate(odd[(-d - 1) / 2]));
+  return R;
+}
+
+Jacobian shf::p256::MulVartime(const Jacobian& P, const uint64_t k[4]) {
+  Jacobian odd[kTableSize / 2];
+  BuildOddTable(P, odd);
+
+  int8_t naf[257];
+  const std::size_t len = RecodeNaf(k, naf);
+
+  Jacobian R = Infinity();
+  for (std::size_t i = len; i-- > 0;) {
+    if (!IsInfinity(R)) R = Double(R);
+    R = AddNafDigit(R, naf[i], odd);
+  }
+  return R;
+}
+
+Jacobian shf::p256::MulAdd2Vartime(const uint64_t k[4], const Jacobian& P,
+                                   const uint64_t l[4], const Jacobian& Q) {
+  Jacobian podd[kTableSize / 2], qodd[kTableSize / 2];
+  BuildOddTable(P, podd);
+  BuildOddTable(Q, qodd);
+
+  int8_t knaf[257] = {0}, lnaf[257] = {0};
+  const std::size_t klen = RecodeNaf(k, knaf);
+  const std::size_t llen = RecodeNaf(l, lnaf);
+
+  Jacobian R = Infinity();
+  for (std::size_t i = klen > llen ? klen : llen; i-- > 0;) {
+    if (!IsInfinity(R)) R = Double(R);
+    R = AddNafDigit(R, knaf[i], podd);
+    R = AddNafDigit(R, lnaf[i], qodd);
+  }
+  return R;
+}
+
+namespace {
+// gen[w][i] = (i + 1) * 32^w * G. Entries are affine, so lookups scan two
+// coordinates and additions use the mixed formula.
+struct GeneratorTable {
+  Affine gen[kWindows][kTableSize];
+
+  GeneratorTable() {
+    std::vector<Jacobian> points(kWindows * kTableSize);
+    std::vector<Jacobian*> ptrs;
+    Jacobian base = shf::p256::Generator();
+    for (std::size_t w = 0; w < kWindows; ++w) {
+      Jacobian* row = points.data() + w * kTableSize;
+      row[0] = base;
+      for (std::size_t i = 1; i < kTableSize; ++i)
+        row[i] = shf::p256::Add(row[i - 1], base);
+      base = shf::p256::Double(row[kTableSize - 1]);
+    }
+    for (auto& p : points) ptrs.push_back(&p);
+    shf::p256::NormalizeBatch(ptrs.data(), ptrs.size());
+    for (std::size_t w = 0; w < kWindows; ++w)
+      for (std::size_t i = 0; i < kTableSize; ++i)
+        gen[w][i] = {points[w * kTableSize + i].X, points[w * kTableSize + i].Y};
+  }
+};
+}  // namespace
+
+static const GeneratorTable& GetGeneratorTable() {
+  static const GeneratorTable table;
+  return table;
+}
+
+Jacobian shf::p256::MulGenerator(const uint64_t k[4]) {
+  const GeneratorTable& table = GetGeneratorTable();
+
+  int32_t digits[kWindows];
+  RecodeSigned(k, digits);
+
+  Jacobian R = Infinity();
+  for (std::size_t w = 0; w < kWindows; ++w) {
+    uint64_t zero;
+    const Affine Q = LookupAffine(table.gen[w], digits[w], &zero);
+    R = AddMixedConstTime(R, Q, zero);
+  }
+  return R;
+}
+
+void shf::p256::MulGeneratorMany(Jacobian* r, const uint64_t* k,
+                                 std::size_t n) {
+  const GeneratorTable& table = GetGeneratorTable();
+  constexpr std::size_t kLanes = Batch::kLanes;
+
+  int32_t digits[kLanes][kWindows];
+  Jacobian unused[kLanes];
+  for (std::size_t first = 0; first < n; first += kLanes) {
+    const std::size_t lanes = std::min(kLanes, n - first);
+    Jacobian* out[kLanes];
+    for (std::size_t i = 0; i < kLanes; ++i) {
+      out[i] = i < lanes ? r + first + i : unused + i;
+      if (i < lanes)
+        RecodeSigned(k + 4 * (first + i), digits[i]);
+      else
+        std::fill(digits[i], digits[i] + kWindows, 0);
+    }
+
+    Batch batch;
+    for (std::size_t w = 0; w < kWindows; ++w) {
+      Affine Q[kLanes];
+      uint32_t skip = 0;
+      for (std::size_t i = 0; i < kLanes; ++i) {
+        uint64_t zero;
+        Q[i] = LookupAffine(table.gen[w], digits[i][w], &zero);
+        skip |= static_cast<uint32_t>(zero) << i;
+      }
+      batch.AddMixed(Q, skip);
+    }
+    batch.Store(out);
+  }
+}
+
+Jacobian shf::p256::MulGeneratorVartime(const uint64_t k[4]) {
+  const GeneratorTable& table = GetGeneratorTable();
+
+  int32_t digits[kWindows];
+  RecodeSigned(k, digits);
+
+  Jacobian R = Infinity();
+  for (std::size_t w = 0; w < kWindows; ++w) {
+    const int32_t d = digits[w];
+    if (d > 0) {
+      R = AddMixed(R, table.gen[w][d - 1]);
+    } else if (d < 0) {
+      const Affine& Q = table.gen[w][-d - 1];
+      R = AddMixed(R, {Q.x, -Q.y});
+    }
+  }
+  return R;
+}
+
+void shf::p256::WriteCompressed(uint8_t* dest, const Jacobian& P) {
+  const Affine A = ToAffine(P);
+  dest[0] = 2 | static_cast<uint8_t>(A.y.v[0] & 1);
+  A.x.Write(dest + 1);
+}
+
+bool shf::p256::ReadCompressed(Jacobian& P, const uint8_t* bytes) {
+  if ((bytes[0] & ~1) != 2) return false;
+  bool reduced = false;
+  const Fe x = Fe::Read(bytes + 1, &reduced);
+  if (!reduced) return false;
+  const Fe rhs = (x.Square() - Fe::FromInt(3)) * x + CurveB();
+  Fe y = rhs.Pow(kSqrtExponent);
+  if (y.Square() != rhs) return false;
+  if ((y.v[0] & 1) != (bytes[0] & 1)) y = -y;
+  P = {x, y, Fe::One()};
+  return true;
+}
@@ -0,0 +1,224 @@
+#ifndef SHF_P256_H
+#define SHF_P256_H
+
+#include <cstdint>
+
+#include "fp256.h"
+
+namespace shf {
+namespace p256 {
+
+/**
+ * @brief Montgomery constants for the base field of NIST P-256,
+ * p = 2^256 - 2^224 + 2^192 + 2^96 - 1.
+ */
+struct FieldParams {
+  static constexpr uint64_t kModulus[4] = {
+      0xFFFFFFFFFFFFFFFF, 0x00000000FFFFFFFF, 0x0000000000000000,
+      0xFFFFFFFF00000001};
+  static constexpr uint64_t kN0 = 1;
+  static constexpr uint64_t kR2[4] = {0x0000000000000003, 0xFFFFFFFBFFFFFFFF,
+                                      0xFFFFFFFFFFFFFFFE, 0x00000004FFFFFFFD};
+  static constexpr uint64_t kOne[4] = {0x0000000000000001, 0xFFFFFFFF00000000,
+                                       0xFFFFFFFFFFFFFFFF, 0x00000000FFFFFFFE};
+};
+
+using Fe = Fp256<FieldParams>;
+
+/**
+ * @brief Montgomery constants for the order of the P-256 group,
+ * n = FFFFFFFF00000000FFFFFFFFFFFFFFFFBCE6FAADA7179E84F3B9CAC2FC632551.
+ */
+struct ScalarParams {
+  static constexpr uint64_t kModulus[4] = {
+      0xF3B9CAC2FC632551, 0xBCE6FAADA7179E84, 0xFFFFFFFFFFFFFFFF,
+      0xFFFFFFFF00000000};
+  static constexpr uint64_t kN0 = 0xCCD1C8AAEE00BC4F;
+  static constexpr uint64_t kR2[4] = {0x83244C95BE79EEA2, 0x4699799C49BD6FA6,
+                                      0x2845B2392B6BEC59, 0x66E12D94F3D95620};
+  static constexpr uint64_t kOne[4] = {0x0C46353D039CDAAF, 0x4319055258E8617B,
+                                       0x0000000000000000, 0x00000000FFFFFFFF};
+};
+
+using Fn = Fp256<ScalarParams>;
+
+/**
+ * @brief A point in affine coordinates. Only used for finite points.
+ */
+struct Affine {
+  Fe x;
+  Fe y;
+};
+
+/**
+ * @brief A point in Jacobian coordinates (X/Z^2, Y/Z^3).
+ *
+ * The point at infinity has Z == 0. A point with Z == 1 (in Montgomery form)
+ * is normalized, and adding it to another point uses the cheaper mixed
+ * addition formula.
+ */
+struct Jacobian {
+  Fe X;
+  Fe Y;
+  Fe Z;
+};
+
+/**
+ * @brief Size of the encodings of the curve's field elements in bytes.
+ */
+constexpr std::size_t kFieldBytes = 32;
+
+Jacobian Infinity();
+
+Jacobian Generator();
+
+inline bool IsInfinity(const Jacobian& P) { return P.Z.IsZero(); };
+
+inline bool IsNormalized(const Jacobian& P) { return P.Z == Fe::One(); };
+
+Jacobian FromAffine(const Affine& P);
+
+/**
+ * @brief Check if affine coordinates satisfy y^2 = x^3 - 3x + b.
+ */
+bool IsOnCurve(const Affine& P);
+
+/**
+ * @brief Normalize a (finite) point to affine coordinates. Free if the point
+ * is already normalized.
+ */
+Affine ToAffine(const Jacobian& P);
+
+/**
+ * @brief Normalize a list of points in place with one shared inversion.
+ *
+ * Points at infinity and points that are already normalized are left alone.
+ */
+void NormalizeBatch(Jacobian* const* points, std::size_t n);
+
+/**
+ * @brief r[i] = a[i] + b[i] for n pairs of affine points, with one shared
+ * inversion for all slopes.
+ *
+ * Costs about 5M + 1S per pair plus the inversion, against 7M + 4S for a mixed
+ * addition, but the result is affine. Infinity is encoded as x = y = 0 here,
+ * as in P256Backend. r may alias a or b. Variable time.
+ */
+void AddAffineBatch(Affine* r, const Affine* a, const Affine* b, std::size_t n);
+
+Jacobian Negate(const Jacobian& P);
+
+/**
+ * @brief 2P using dbl-2001-b (a = -3). Correct for all inputs.
+ */
+Jacobian Double(const Jacobian& P);
+
+/**
+ * @brief P + Q using add-2007-bl, or madd-2007-bl if Q is normalized.
+ *
+ * Correct for all inputs: infinity, P == Q and P == -Q are handled
+ * explicitly, so this is variable time in those cases.
+ */
+Jacobian Add(const Jacobian& P, const Jacobian& Q);
+
+/**
+ * @brief P + Q for an affine Q using madd-2007-bl. Correct for all inputs.
+ */
+Jacobian AddMixed(const Jacobian& P, const Affine& Q);
+
+/**
+ * @brief P + Q for an affine Q, or P if skip is 1, in constant time.
+ *
+ * Like the additions inside Mul, P == Q takes a branch, which only happens
+ * with negligible probability for secret inputs.
+ */
+Jacobian AddMixedConstTime(const Jacobian& P, const Affine& Q, uint64_t skip);
+
+bool Equal(const Jacobian& P, const Jacobian& Q);
+
+/**
+ * @brief k*P for a 256-bit scalar k given as four limbs (least significant
+ * first).
+ *
+ * Uses a fixed 5-bit signed window with constant-time table lookups, so the
+ * sequence of operations does not depend on k.
+ */
+Jacobian Mul(const Jacobian& P, const uint64_t k[4]);
+
+/**
+ * @brief k*G for the curve generator G, using a precomputed table.
+ *
+ * Table lookups are constant time, like Mul.
+ */
+Jacobian MulGenerator(const uint64_t k[4]);
+
+/**
+ * @brief k*P in variable time, for public k only.
+ *
+ * Uses a width-5 NAF of k, so about 43 additions instead of 52, and skips the
+ * constant-time table scans.
+ */
+Jacobian MulVartime(const Jacobian& P, const uint64_t k[4]);
+
+/**
+ * @brief k*G in variable time, for public k only. Reads the table entries for
+ * the digits of k directly and skips zero digits.
+ */
+Jacobian MulGeneratorVartime(const uint64_t k[4]);
+
+/**
+ * @brief k*P + l*Q in constant time.
+ *
+ * Like Mul, but both scalars share one chain of doublings, which saves about
+ * a third compared to two separate multiplications.
+ */
+Jacobian MulAdd2(const uint64_t k[4], const Jacobian& P, const uint64_t l[4],
+                 const Jacobian& Q);
+
+/**
+ * @brief k*P + l*Q in variable time, for public k and l only.
+ *
+ * Interleaves the width-5 NAFs of k and l over one chain of doublings
+ * (Straus-Shamir).
+ */
+Jacobian MulAdd2Vartime(const uint64_t k[4], const Jacobian& P,
+                        const uint64_t l[4], const Jacobian& Q);
+
+/**
+ * @brief r[i] = k*points[i] for many points and one secret scalar.
+ *
+ * Recodes k once and normalizes the window tables of many points with a
+ * single inversion, so every addition in the main loop is a mixed addition
+ * and every table scan reads two coordinates instead of three. Constant time
+ * in k, like Mul. r may alias points.
+ */
+void MulMany(Jacobian* r, const uint64_t k[4], const Jacobian* points,
+             std::size_t n);
+
+/**
+ * @brief r[i] = k[i]*G for n secret scalars, given as 4n limbs.
+ *
+ * Like MulGenerator, but eight scalars at a time walk the generator table in
+ * lockstep, so the additions can use vectorized field arithmetic (see
+ * Batch). Constant time in the scalars.
+ */
+void MulGeneratorMany(Jacobian* r, const uint64_t* k, std::size_t n);
+
+/**
+ * @brief Write the 33-byte SEC1 compressed encoding of a finite point.
+ *
+ * The low bit of the prefix byte is the parity of the Montgomery form of y,
+ * which is what relic writes, so both backends produce identical bytes.
+ */
+void WriteCompressed(uint8_t* dest, const Jacobian& P);
+
+/**
+ * @brief Read a point written by WriteCompressed.
+ * @return false if the bytes do not encode a point on the curve.
+ */
+bool ReadCompressed(Jacobian& P, const uint8_t* bytes);
+
+}  // namespace p256
+}  // namespace shf
+
+#endif  // SHF_P256_H
@@ -0,0 +1,374 @@
+#include "p256_batch.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define SHF_HAVE_IFMA_KERNEL 1
+#endif
+
+using shf::p256::Affine;
+using shf::p256::Batch;
+using shf::p256::Fe;
+using shf::p256::Jacobian;
+
+#if defined(SHF_HAVE_IFMA_KERNEL)
+
+// The IFMA kernel is compiled for AVX-512 IFMA regardless of -march and only
+// called after checking the CPU at runtime.
+#define SHF_IFMA __attribute__((target("avx512f,avx512ifma")))
+
+// GCC 12's AVX-512 shift intrinsics pass an unspecified vector through, which
+// -Wuninitialized reports at every inlined call.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+
+static constexpr uint64_t kMask52 = (UINT64_C(1) << 52) - 1;
+
+// Multiples of p in radix 2^52. Field elements are kept in [0, 4p) with every
+// limb below 2^52, which is what the 52-bit multipliers read.
+static const uint64_t kP[5] = {0xFFFFFFFFFFFFF, 0xFFFFFFFFFFF, 0x0,
+                               0x1000000000, 0xFFFFFFFF0000};
+static const uint64_t k2P[5] = {0xFFFFFFFFFFFFE, 0x1FFFFFFFFFFF, 0x0,
+                                0x2000000000, 0x1FFFFFFFE0000};
+static const uint64_t k3P[5] = {0xFFFFFFFFFFFFD, 0x2FFFFFFFFFFF, 0x0,
+                                0x3000000000, 0x2FFFFFFFD0000};
+static const uint64_t k4P[5] = {0xFFFFFFFFFFFFC, 0x3FFFFFFFFFFF, 0x0,
+                                0x4000000000, 0x3FFFFFFFC0000};
+static const uint64_t k8P[5] = {0xFFFFFFFFFFFF8, 0x7FFFFFFFFFFF, 0x0,
+                                0x8000000000, 0x7FFFFFFF80000};
+// 2^256 mod p. Multiplying by it converts from R = 2^260 back to R = 2^256.
+static const uint64_t kR256[5] = {0x1, 0xFF00000000000, 0xFFFFFFFFFFFFF,
+                                  0xFFFEFFFFFFFFF, 0xFFFF};
+
+namespace {
+struct F8 {
+  __m512i l[5];
+};
+}  // namespace
+
+SHF_IFMA static inline F8 Broadcast(const uint64_t c[5]) {
+  F8 r;
+  for (std::size_t j = 0; j < 5; ++j) r.l[j] = _mm512_set1_epi64(c[j]);
+  return r;
+}
+
+// Propagate carries so every limb is below 2^52. Limbs must be non-negative.
+SHF_IFMA static inline void Carry(F8& a) {
+  const __m512i mask = _mm512_set1_epi64(kMask52);
+  for (std::size_t j = 0; j < 4; ++j) {
+    a.l[j + 1] = _mm512_add_epi64(a.l[j + 1], _mm512_srli_epi64(a.l[j], 52));
+    a.l[j] = _mm512_and_si512(a.l[j], mask);
+  }
+}
+
+// Like Carry, for limbs that may be negative. The top limb keeps the sign.
+SHF_IFMA static inline void CarrySigned(F8& a) {
+  const __m512i mask = _mm512_set1_epi64(kMask52);
+  for (std::size_t j = 0; j < 4; ++j) {
+    a.l[j + 1] = _mm512_add_epi64(a.l[j + 1], _mm512_srai_epi64(a.l[j], 52));
+    a.l[j] = _mm512_and_si512(a.l[j], mask);
+  }
+}
+
+// a - c if that is non-negative, otherwise a.
+SHF_IFMA static inline F8 CondSub(const F8& a, const uint64_t c[5]) {
+  F8 t;
+  for (std::size_t j = 0; j < 5; ++j)
+    t.l[j] = _mm512_sub_epi64(a.l[j], _mm512_set1_epi64(c[j]));
+  CarrySigned(t);
+  const __mmask8 neg = _mm512_cmplt_epi64_mask(t.l[4], _mm512_setzero_si512());
+  for (std::size_t j = 0; j < 5; ++j)
+    t.l[j] = _mm512_mask_blend_epi64(neg, t.l[j], a.l[j]);
+  return t;
+}
+
+SHF_IFMA static inline F8 Add(const F8& a, const F8& b) {
+  F8 r;
+  for (std::size_t j = 0; j < 5; ++j) r.l[j] = _mm512_add_epi64(a.l[j], b.l[j]);
+  Carry(r);
+  return CondSub(r, k4P);
+}
+
+SHF_IFMA static inline F8 Sub(const F8& a, const F8& b) {
+  F8 r;
+  for (std::size_t j = 0; j < 5; ++j)
+    r.l[j] = _mm512_add_epi64(_mm512_sub_epi64(a.l[j], b.l[j]),
+                              _mm512_set1_epi64(k4P[j]));
+  CarrySigned(r);
+  return CondSub(r, k4P);
+}
+
+// a * b / 2^260 mod p, in [0, 3p) for inputs in [0, 4p). Operand scanning
+// with one reduction step per limb; since p = -1 mod 2^52, the reduction
+// multiplier is just the low limb.
+SHF_IFMA static inline F8 Mul(const F8& a, const F8& b) {
+  const __m512i mask = _mm512_set1_epi64(kMask52);
+  const __m512i zero = _mm512_setzero_si512();
+  __m512i t[10];
+  for (std::size_t j = 0; j < 10; ++j) t[j] = zero;
+  for (std::size_t i = 0; i < 5; ++i) {
+    for (std::size_t j = 0; j < 5; ++j) {
+      t[i + j] = _mm512_madd52lo_epu64(t[i + j], a.l[j], b.l[i]);
+      t[i + j + 1] = _mm512_madd52hi_epu64(t[i + j + 1], a.l[j], b.l[i]);
+    }
+    const __m512i m = _mm512_and_si512(t[i], mask);
+    for (std::size_t j = 0; j < 5; ++j) {
+      // limb 2 of p is zero.
+      if (j == 2) continue;
+      const __m512i pj = _mm512_set1_epi64(kP[j]);
+      t[i + j] = _mm512_madd52lo_epu64(t[i + j], m, pj);
+      t[i + j + 1] = _mm512_madd52hi_epu64(t[i + j + 1], m, pj);
+    }
+    t[i + 1] = _mm512_add_epi64(t[i + 1], _mm512_srli_epi64(t[i], 52));
+  }
+  F8 r;
+  for (std::size_t j = 0; j < 5; ++j) r.l[j] = t[j + 5];
+  Carry(r);
+  return r;
+}
+
+SHF_IFMA static inline F8 Square(const F8& a) { return Mul(a, a); }
+
+SHF_IFMA static inline __mmask8 Equal(const F8& a, const uint64_t c[5]) {
+  __mmask8 eq = 0xFF;
+  for (std::size_t j = 0; j < 5; ++j)
+    eq &= _mm512_cmpeq_epi64_mask(a.l[j], _mm512_set1_epi64(c[j]));
+  return eq;
+}
+
+// The lanes that are 0 mod p, given values in [0, 4p).
+SHF_IFMA static inline __mmask8 IsZero(const F8& a) {
+  static const uint64_t zero[5] = {0, 0, 0, 0, 0};
+  return Equal(a, zero) | Equal(a, kP) | Equal(a, k2P) | Equal(a, k3P);
+}
+
+SHF_IFMA static inline F8 Blend(__mmask8 m, const F8& a, const F8& b) {
+  F8 r;
+  for (std::size_t j = 0; j < 5; ++j)
+    r.l[j] = _mm512_mask_blend_epi64(m, a.l[j], b.l[j]);
+  return r;
+}
+
+// Convert eight field elements, given as four 64-bit limb vectors in
+// Montgomery form with R = 2^256, to radix 2^52 with R = 2^260. Shifting by
+// four bits while splitting multiplies by 16; the result is then reduced from
+// [0, 16p) to [0, 4p).
+SHF_IFMA static inline F8 FromLimbs(const __m512i v[4]) {
+  const __m512i mask = _mm512_set1_epi64(kMask52);
+  F8 r;
+  r.l[0] = _mm512_and_si512(_mm512_slli_epi64(v[0], 4), mask);
+  r.l[1] = _mm512_and_si512(
+      _mm512_or_si512(_mm512_srli_epi64(v[0], 48), _mm512_slli_epi64(v[1], 16)),
+      mask);
+  r.l[2] = _mm512_and_si512(
+      _mm512_or_si512(_mm512_srli_epi64(v[1], 36), _mm512_slli_epi64(v[2], 28)),
+      mask);
+  r.l[3] = _mm512_and_si512(
+      _mm512_or_si512(_mm512_srli_epi64(v[2], 24), _mm512_slli_epi64(v[3], 40)),
+      mask);
+  r.l[4] = _mm512_srli_epi64(v[3], 12);
+  return CondSub(CondSub(r, k8P), k4P);
+}
+
+// The inverse of FromLimbs: divide by 16 with a multiplication by 2^256,
+// reduce to [0, p) and join the limbs.
+SHF_IFMA static inline void ToLimbs(__m512i v[4], const F8& a) {
+  F8 r = Mul(a, Broadcast(kR256));
+  r = CondSub(CondSub(r, k2P), kP);
+  v[0] = _mm512_or_si512(r.l[0], _mm512_slli_epi64(r.l[1], 52));
+  v[1] = _mm512_or_si512(_mm512_srli_epi64(r.l[1], 12),
+                         _mm512_slli_epi64(r.l[2], 40));
+  v[2] = _mm512_or_si512(_mm512_srli_epi64(r.l[2], 24),
+                         _mm512_slli_epi64(r.l[3], 28));
+  v[3] = _mm512_or_si512(_mm512_srli_epi64(r.l[3], 36),
+                         _mm512_slli_epi64(r.l[4], 16));
+}
+
+SHF_IFMA static inline F8 LoadF8(const uint64_t limbs[5][Batch::kLanes]) {
+  F8 r;
+  for (std::size_t j = 0; j < 5; ++j) r.l[j] = _mm512_load_si512(limbs[j]);
+  return r;
+}
+
+SHF_IFMA static inline void StoreF8(uint64_t limbs[5][Batch::kLanes],
+                                    const F8& a) {
+  for (std::size_t j = 0; j < 5; ++j) _mm512_store_si512(limbs[j], a.l[j]);
+}
+
+// dbl-2001-b, like p256::Double.
+SHF_IFMA static inline void DoubleF8(F8& X, F8& Y, F8& Z) {
+  const F8 delta = Square(Z);
+  const F8 gamma = Square(Y);
+  const F8 beta = Mul(X, gamma);
+  const F8 t = Mul(Sub(X, delta), Add(X, delta));
+  const F8 alpha = Add(t, Add(t, t));
+  const F8 beta2 = Add(beta, beta);
+  const F8 beta4 = Add(beta2, beta2);
+  const F8 X3 = Sub(Square(alpha), Add(beta4, beta4));
+  Z = Sub(Sub(Square(Add(Y, Z)), gamma), delta);
+  F8 gamma8 = Square(gamma);
+  gamma8 = Add(gamma8, gamma8);
+  gamma8 = Add(gamma8, gamma8);
+  gamma8 = Add(gamma8, gamma8);
+  Y = Sub(Mul(alpha, Sub(beta4, X3)), gamma8);
+  X = X3;
+}
+
+SHF_IFMA static void LoadIfma(uint64_t lanes[3][5][Batch::kLanes],
+                              const Jacobian* const points[Batch::kLanes]) {
+  alignas(64) uint64_t raw[3][4][Batch::kLanes];
+  for (std::size_t i = 0; i < Batch::kLanes; ++i) {
+    const Fe* c[3] = {&points[i]->X, &points[i]->Y, &points[i]->Z};
+    for (std::size_t k = 0; k < 3; ++k)
+      for (std::size_t j = 0; j < 4; ++j) raw[k][j][i] = c[k]->v[j];
+  }
+  for (std::size_t k = 0; k < 3; ++k) {
+    __m512i v[4];
+    for (std::size_t j = 0; j < 4; ++j) v[j] = _mm512_load_si512(raw[k][j]);
+    StoreF8(lanes[k], FromLimbs(v));
+  }
+}
+
+SHF_IFMA static void StoreIfma(const uint64_t lanes[3][5][Batch::kLanes],
+                               Jacobian* const points[Batch::kLanes]) {
+  alignas(64) uint64_t raw[3][4][Batch::kLanes];
+  for (std::size_t k = 0; k < 3; ++k) {
+    __m512i v[4];
+    ToLimbs(v, LoadF8(lanes[k]));
+    for (std::size_t j = 0; j < 4; ++j) _mm512_store_si512(raw[k][j], v[j]);
+  }
+  for (std::size_t i = 0; i < Batch::kLanes; ++i) {
+    Fe* c[3] = {&points[i]->X, &points[i]->Y, &points[i]->Z};
+    for (std::size_t k = 0; k < 3; ++k)
+      for (std::size_t j = 0; j < 4; ++j) c[k]->v[j] = raw[k][j][i];
+  }
+}
+
+SHF_IFMA static void DoubleIfma(uint64_t lanes[3][5][Batch::kLanes]) {
+  F8 X = LoadF8(lanes[0]);
+  F8 Y = LoadF8(lanes[1]);
+  F8 Z = LoadF8(lanes[2]);
+  DoubleF8(X, Y, Z);
+  StoreF8(lanes[0], X);
+  StoreF8(lanes[1], Y);
+  StoreF8(lanes[2], Z);
+}
+
+// madd-2007-bl, like AddMixedUnchecked in p256.cc, with the special cases
+// resolved by blending: skipped lanes keep P, lanes where P is infinity take
+// Q, and lanes where P == Q are doubled.
+SHF_IFMA static void AddMixedIfma(uint64_t lanes[3][5][Batch::kLanes],
+                                  const Affine Q[Batch::kLanes],
+                                  uint32_t skip) {
+  alignas(64) uint64_t raw[2][4][Batch::kLanes];
+  for (std::size_t i = 0; i < Batch::kLanes; ++i)
+    for (std::size_t j = 0; j < 4; ++j) {
+      raw[0][j][i] = Q[i].x.v[j];
+      raw[1][j][i] = Q[i].y.v[j];
+    }
+  __m512i v[4];
+  for (std::size_t j = 0; j < 4; ++j) v[j] = _mm512_load_si512(raw[0][j]);
+  const F8 x = FromLimbs(v);
+  for (std::size_t j = 0; j < 4; ++j) v[j] = _mm512_load_si512(raw[1][j]);
+  const F8 y = FromLimbs(v);
+
+  const F8 X1 = LoadF8(lanes[0]);
+  const F8 Y1 = LoadF8(lanes[1]);
+  const F8 Z1 = LoadF8(lanes[2]);
+
+  const F8 Z1Z1 = Square(Z1);
+  const F8 U2 = Mul(x, Z1Z1);
+  const F8 S2 = Mul(Mul(y, Z1), Z1Z1);
+  const F8 H = Sub(U2, X1);
+  F8 r = Sub(S2, Y1);
+  r = Add(r, r);
+  const F8 HH = Square(H);
+  F8 I = Add(HH, HH);
+  I = Add(I, I);
+  const F8 J = Mul(H, I);
+  const F8 V = Mul(X1, I);
+  F8 X3 = Sub(Sub(Square(r), J), Add(V, V));
+  F8 YJ = Mul(Y1, J);
+  F8 Y3 = Sub(Mul(r, Sub(V, X3)), Add(YJ, YJ));
+  F8 Z3 = Sub(Sub(Square(Add(Z1, H)), Z1Z1), HH);
+
+  const __mmask8 skipped = static_cast<__mmask8>(skip);
+  const __mmask8 pinf = IsZero(Z1);
+  const __mmask8 dbl = IsZero(H) & IsZero(r) & ~pinf & ~skipped;
+  if (dbl) {
+    // P == Q only happens with negligible probability for random inputs.
+    F8 DX = X1, DY = Y1, DZ = Z1;
+    DoubleF8(DX, DY, DZ);
+    X3 = Blend(dbl, X3, DX);
+    Y3 = Blend(dbl, Y3, DY);
+    Z3 = Blend(dbl, Z3, DZ);
+  }
+  // Z = 1 is 2^260 mod p in this representation, which is 16 * 2^256 mod p.
+  static const uint64_t one[5] = {0x10, 0xF000000000000, 0xFFFFFFFFFFFFF,
+                                  0xFFEFFFFFFFFFF, 0xFFFFF};
+  X3 = Blend(pinf, X3, x);
+  Y3 = Blend(pinf, Y3, y);
+  Z3 = Blend(pinf, Z3, Broadcast(one));
+  StoreF8(lanes[0], Blend(skipped, X3, X1));
+  StoreF8(lanes[1], Blend(skipped, Y3, Y1));
+  StoreF8(lanes[2], Blend(skipped, Z3, Z1));
+}
+
+#pragma GCC diagnostic pop
+
+static bool UseIfma() {
+  static const bool ifma = __builtin_cpu_supports("avx512f") &&
+                           __builtin_cpu_supports("avx512ifma");
+  return ifma;
+}
+
+#else
+
+static bool UseIfma() { return false; }
+
+#endif  // SHF_HAVE_IFMA_KERNEL
+
+const char* shf::p256::BatchKernel() {
+  return UseIfma() ? "avx512ifma" : "scalar";
+}
+
+bool shf::p256::Batch::Vectorized() { return UseIfma(); }
+
+shf::p256::Batch::Batch() : m_vector(UseIfma()) {
+  const Jacobian inf = Infinity();
+  const Jacobian* ptrs[kLanes];
+  for (std::size_t i = 0; i < kLanes; ++i) {
+    m_points[i] = inf;
+    ptrs[i] = &inf;
+  }
+  if (m_vector) Load(ptrs);
+}
+
+void shf::p256::Batch::Load(const Jacobian* const points[kLanes]) {
+#if defined(SHF_HAVE_IFMA_KERNEL)
+  if (m_vector) return LoadIfma(m_limbs, points);
+#endif
+  for (std::size_t i = 0; i < kLanes; ++i) m_points[i] = *points[i];
+}
+
+void shf::p256::Batch::Store(Jacobian* const points[kLanes]) const {
+#if defined(SHF_HAVE_IFMA_KERNEL)
+  if (m_vector) return StoreIfma(m_limbs, points);
+#endif
+  for (std::size_t i = 0; i < kLanes; ++i) *points[i] = m_points[i];
+}
+
+void shf::p256::Batch::AddMixed(const Affine Q[kLanes], uint32_t skip) {
+#if defined(SHF_HAVE_IFMA_KERNEL)
+  if (m_vector) return AddMixedIfma(m_limbs, Q, skip);
+#endif
+  for (std::size_t i = 0; i < kLanes; ++i)
+    m_points[i] = AddMixedConstTime(m_points[i], Q[i], (skip >> i) & 1);
+}
+
+void shf::p256::Batch::Double() {
+#if defined(SHF_HAVE_IFMA_KERNEL)
+  if (m_vector) return DoubleIfma(m_limbs);
+#endif
+  for (std::size_t i = 0; i < kLanes; ++i)
+    m_points[i] = shf::p256::Double(m_points[i]);
+}
@@ -0,0 +1,82 @@
+#ifndef SHF_P256_BATCH_H
+#define SHF_P256_BATCH_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include "p256.h"
+
+namespace shf {
+namespace p256 {
+
+/**
+ * @brief Eight Jacobian points that are updated in lockstep.
+ *
+ * On CPUs with AVX-512 IFMA the coordinates of all eight lanes are kept in
+ * radix 2^52, and each field multiplication of an addition or doubling is
+ * computed for all lanes at once with 52-bit multiply-accumulate
+ * instructions. Elsewhere the lanes are plain Jacobian points that are updated
+ * one after another. The kernel is picked at runtime (see BatchKernel), so a
+ * binary built on an IFMA host still runs on older CPUs.
+ *
+ * Loading and storing converts between representations, so a batch pays off
+ * when several operations are applied between a Load and a Store, e.g. a whole
+ * fixed-base multiplication.
+ *
+ * Lane operations run in constant time, except that adding a point to itself
+ * takes a branch, as inside Mul.
+ */
+class Batch {
+ public:
+  static constexpr std::size_t kLanes = 8;
+
+  /**
+   * @brief Create a batch with all lanes at infinity.
+   */
+  Batch();
+
+  /**
+   * @brief Set lane i to *points[i].
+   */
+  void Load(const Jacobian* const points[kLanes]);
+
+  /**
+   * @brief Write lane i to *points[i].
+   */
+  void Store(Jacobian* const points[kLanes]) const;
+
+  /**
+   * @brief Add Q[i] to lane i, except for the lanes whose bit is set in skip.
+   *
+   * Q[i] must be a finite point unless lane i is skipped.
+   */
+  void AddMixed(const Affine Q[kLanes], uint32_t skip);
+
+  /**
+   * @brief Double every lane.
+   */
+  void Double();
+
+  /**
+   * @brief Whether the lanes run through the vector kernel on this CPU.
+   */
+  static bool Vectorized();
+
+ private:
+  // m_limbs[c][j][i] is limb j of coordinate c (X, Y, Z) of lane i, in radix
+  // 2^52 and Montgomery form with R = 2^260. Only used by the IFMA kernel.
+  alignas(64) uint64_t m_limbs[3][5][kLanes];
+  Jacobian m_points[kLanes];
+  bool m_vector;
+};
+
+/**
+ * @brief The name of the kernel Batch uses on this CPU: "avx512ifma" or
+ * "scalar".
+ */
+const char* BatchKernel();
+
+}  // namespace p256
+}  // namespace shf
+
+#endif  // SHF_P256_BATCH_H
@@ -4,6 +4,7 @@
 #include <wmmintrin.h>
 
 #include <cstdint>
+#include <type_traits>
 #include <vector>
 
 namespace shf {
@@ -18,21 +19,42 @@ class Prg {
 
   Prg(const uint8_t* seed);
 
+  /**
+   * @brief Write the next n bytes of the AES-CTR stream to dest.
+   *
+   * Every call starts on a fresh block, so the unused end of a partial last
+   * block is skipped.
+   */
   void Fill(uint8_t* dest, std::size_t n);
 
+  /**
+   * @brief Fill a vector of plain values with random bytes, in place.
+   */
   template <typename T>
   void Fill(std::vector<T>& to_fill) {
-    const auto n = to_fill.size();
-    const auto data_size = sizeof(T) * n;
-    uint8_t* data = new uint8_t[data_size];
-    Fill(data, data_size);
-    T* ptr = reinterpret_cast<T*>(data);
-    for (std::size_t i = 0; i < n; ++i) to_fill[i] = *ptr++;
-    delete[] data;
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "only plain values can be filled with random bytes");
+    Fill(reinterpret_cast<uint8_t*>(to_fill.data()),
+         sizeof(T) * to_fill.size());
   }
 
+  /**
+   * @brief Derive an independent generator for a substream.
+   *
+   * The child is keyed with a block encrypted under this generator's key, so
+   * it depends only on the seed and stream_id: forking the same id twice gives
+   * the same stream, and how much of this stream was read does not matter.
+   * Different ids give unrelated streams, and none of them overlaps this one.
+   *
+   * Workers that need fresh randomness on every call can draw a seed from the
+   * shared generator once and fork one stream per fixed-size piece of work,
+   * which keeps the output the same for any number of threads.
+   *
+   * @param stream_id the substream
+   */
+  Prg Fork(uint64_t stream_id) const;
+
  private:
-  void Update();
   void Init();
 
   uint8_t m_seed[sizeof(__m128i)] = {0};
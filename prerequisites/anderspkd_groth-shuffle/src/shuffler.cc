@@ -1,29 +1,191 @@
 #include "shuffler.h"
 
+#include <algorithm>
+#include <cstdint>
 #include <iostream>
 #include <numeric>
+#include <utility>
 
-shf::Permutation shf::CreatePermutation(std::size_t size, shf::Prg& prg) {
-  if (!size) return Permutation();
-
-  Permutation p(size);
-  std::iota(p.begin(), p.end(), 0);
-  std::vector<std::size_t> r(size);
-  prg.Fill(r);
-
-  // Fisher-Yates
-  std::size_t c = 0;
-  for (int i = size - 1; i >= 0; i--) {
-    std::size_t j = r[c++] % (i + 1);
-    std::swap(p[i], p[j]);
+#include "thread_pool.h"
+
+namespace {
+
+__extension__ typedef unsigned __int128 uint128_t;
+
+// Uniform integers below a bound, by Lemire's multiply-shift method: the high
+// half of x*range is uniform except for a few values of x, which are detected
+// from the low half and redrawn. The division that finds them is only needed
+// when the low half is below range, i.e. rarely. Random words are read from
+// the Prg kWords at a time.
+class BoundedRandom {
+ public:
+  explicit BoundedRandom(shf::Prg& prg) : m_prg(prg) {}
+
+  std::size_t Below(std::size_t range) {
+    if (range <= UINT32_MAX) return Below32(static_cast<uint32_t>(range));
+    return Below64(range);
+  }
+
+  uint64_t Bits() { return Next64(); }
+
+  bool Bit() {
+    if (!m_nbits) {
+      m_bits = Next64();
+      m_nbits = 64;
+    }
+    const bool b = m_bits & 1;
+    m_bits >>= 1;
+    --m_nbits;
+    return b;
+  }
+
+ private:
+  static constexpr std::size_t kWords = 512;
+
+  uint32_t Next32() {
+    if (m_next == kWords) {
+      m_prg.Fill(reinterpret_cast<uint8_t*>(m_words), sizeof(m_words));
+      m_next = 0;
+    }
+    return m_words[m_next++];
+  }
+
+  uint64_t Next64() { return uint64_t(Next32()) << 32 | Next32(); }
+
+  uint32_t Below32(uint32_t range) {
+    uint64_t m = uint64_t(Next32()) * range;
+    if (static_cast<uint32_t>(m) < range) {
+      const uint32_t t = -range % range;
+      while (static_cast<uint32_t>(m) < t) m = uint64_t(Next32()) * range;
+    }
+    return m >> 32;
+  }
+
+  uint64_t Below64(uint64_t range) {
+    uint128_t m = uint128_t(Next64()) * range;
+    if (static_cast<uint64_t>(m) < range) {
+      const uint64_t t = -range % range;
+      while (static_cast<uint64_t>(m) < t) m = uint128_t(Next64()) * range;
+    }
+    return m >> 64;
+  }
+
+  shf::Prg& m_prg;
+  uint32_t m_words[kWords];
+  std::size_t m_next = kWords;
+  uint64_t m_bits = 0;
+  unsigned m_nbits = 0;
+};
+
+template <typename Index>
+void FisherYates(Index* p, std::size_t n, BoundedRandom& rng) {
+  for (std::size_t i = n; i-- > 1;) std::swap(p[i], p[rng.Below(i + 1)]);
+}
+
+// Merge two uniformly shuffled runs p[0, m) and p[m, n) into a uniformly
+// shuffled p[0, n) (Bacher et al., "MergeShuffle"). Coin flips pick the next
+// element from either run until one of them runs out, and the rest are then
+// inserted at random positions as in Fisher-Yates.
+template <typename Index>
+void Merge(Index* p, std::size_t m, std::size_t n, BoundedRandom& rng) {
+  std::size_t i = 0, j = m;
+  // neither run can run out within the next 64 flips, so take a whole word of
+  // them with masks instead of branches, since the coins are unpredictable by
+  // design. top caches p[j], which saves reloading a value just stored.
+  while (j - i > 64 && n - j > 64) {
+    const uint64_t coins = rng.Bits();
+    Index top = p[j];
+    for (unsigned k = 0; k < 64; ++k, ++i) {
+      const std::size_t heads = (coins >> k) & 1;
+      const Index mask = -Index(heads);
+      const Index a = p[i], next = p[j + 1];
+      const Index t = (a ^ top) & mask;
+      p[i] = a ^ t;
+      p[j] = top ^ t;
+      top ^= (top ^ next) & mask;
+      j += heads;
+    }
+  }
+  for (;; ++i) {
+    if (rng.Bit()) {
+      if (j == n) break;
+      std::swap(p[i], p[j++]);
+    } else if (i == j) {
+      break;
+    }
+  }
+  for (; i < n; ++i) std::swap(p[i], p[rng.Below(i + 1)]);
+}
+
+// Permutations of at least kMergeShuffleMin elements are built by
+// MergeShuffle: the elements are split into a power of two of runs of at most
+// kShuffleRun elements, which are shuffled in cache, each with its own fork of
+// the Prg, and then merged pairwise. The runs are of equal size give or take
+// one, since merging a short run into a long one leaves most of the long one
+// to the slow insertion step. Every run and every merge of a level is
+// independent of the others, so they run on the default pool, and the forks
+// keep the result the same whatever order they are done in.
+constexpr std::size_t kMergeShuffleMin = std::size_t(1) << 22;
+constexpr std::size_t kShuffleRun = std::size_t(1) << 18;
+
+template <typename Index>
+std::vector<Index> RandomPermutation(std::size_t size, shf::Prg& prg) {
+  std::vector<Index> p(size);
+  std::iota(p.begin(), p.end(), Index(0));
+
+  if (size < kMergeShuffleMin) {
+    BoundedRandom rng(prg);
+    FisherYates(p.data(), size, rng);
+    return p;
   }
 
+  uint8_t seed[shf::Prg::SeedSize()];
+  prg.Fill(seed, sizeof(seed));
+  const shf::Prg base(seed);
+
+  std::size_t levels = 0;
+  while ((size >> levels) >= kShuffleRun) ++levels;
+  const std::size_t runs = std::size_t(1) << levels;
+  // run r starts at element bound(r).
+  const auto bound = [&](std::size_t r) { return r * size >> levels; };
+
+  // stream ids: run r uses r, merge k of level l (l >= 1) uses l << 48 | k.
+  shf::ThreadPool& pool = shf::DefaultThreadPool();
+  pool.ParallelFor(runs, [&](std::size_t r) {
+    shf::Prg stream = base.Fork(r);
+    BoundedRandom rng(stream);
+    FisherYates(p.data() + bound(r), bound(r + 1) - bound(r), rng);
+  });
+  for (uint64_t level = 1; level <= levels; ++level) {
+    pool.ParallelFor(runs >> level, [&](std::size_t k) {
+      shf::Prg stream = base.Fork(level << 48 | k);
+      BoundedRandom rng(stream);
+      const std::size_t first = bound(k << level);
+      const std::size_t mid = bound((2 * k + 1) << (level - 1));
+      const std::size_t last = bound((k + 1) << level);
+      Merge(p.data() + first, mid - first, last - first, rng);
+    });
+  }
   return p;
 }
 
-static inline std::vector<shf::Scalar> PermutationAsScalars(
-    const shf::Permutation p) {
-  std::vector<shf::Scalar> s;
+}  // namespace
+
+shf::Permutation shf::CreatePermutation(std::size_t size, shf::Prg& prg) {
+  return RandomPermutation<std::size_t>(size, prg);
+}
+
+shf::CompactPermutation shf::CreateCompactPermutation(std::size_t size,
+                                                      shf::Prg& prg) {
+  if (size > std::size_t(1) << 32)
+    throw std::invalid_argument("too many elements for a compact permutation");
+  return RandomPermutation<uint32_t>(size, prg);
+}
+
+template <typename Index>
+static inline shf::ScalarVec PermutationAsScalars(
+    const std::vector<Index>& p) {
+  shf::ScalarVec s;
   const std::size_t n = p.size();
   s.reserve(n);
   for (std::size_t i = 0; i < n; ++i)
@@ -31,10 +193,19 @@ static inline std::vector<shf::Scalar> PermutationAsScalars(
   return s;
 }
 
+// Bind the input and output ciphertexts into the transcript. The digest of
+// pEs, if any, stands in for it in the multiexp statement.
+static inline const shf::Digest* BindStatement(shf::Transcript& transcript,
+                                               const shf::CtxtVector& Es,
+                                               const shf::CtxtVector& pEs) {
+  transcript.Bind(Es);
+  return transcript.Bind(pEs);
+}
+
 // Compute {x, x^2, x^3, ..., x^n}
-static inline std::vector<shf::Scalar> ExpSuccessive(const shf::Scalar& x,
-                                                    const std::size_t n) {
-  std::vector<shf::Scalar> values;
+static inline shf::ScalarVec ExpSuccessive(const shf::Scalar& x,
+                                           const std::size_t n) {
+  shf::ScalarVec values;
   values.reserve(n);
   values.emplace_back(x);
   for (std::size_t i = 1; i < n; ++i) values.emplace_back(values[i - 1] * x);
@@ -47,79 +218,56 @@ static inline std::vector<shf::Scalar> ExpSuccessive(const shf::Scalar& x,
 
 #define SCALAR_VECTOR(_name, _size) TYPED_VECTOR(shf::Scalar, _name, _size)
 
-static inline shf::Ctxt Randomize(const shf::PublicKey& pk, const shf::Ctxt& E,
-                                 const shf::Scalar& r) {
-  return shf::Add(shf::Encrypt(pk, shf::Point(), r), E);
-}
-
-static inline std::vector<shf::Ctxt> Randomize(
-    const shf::PublicKey& pk, const std::vector<shf::Ctxt>& Es,
-    const std::vector<shf::Scalar>& rs) {
-  const std::size_t n = Es.size();
-  TYPED_VECTOR(shf::Ctxt, randomized, n);
-  const shf::Point one = shf::Point();
-  for (std::size_t i = 0; i < n; ++i) {
-    randomized.emplace_back(Randomize(pk, Es[i], rs[i]));
-  }
-  return randomized;
-}
-
-static inline shf::Scalar NegateInnerProd(const std::vector<shf::Scalar>& a,
-                                         const std::vector<shf::Scalar>& b) {
+static inline shf::Scalar NegateInnerProd(const shf::ScalarVec& a,
+                                         const shf::ScalarVec& b) {
   shf::Scalar d;
   for (std::size_t i = 0; i < a.size(); i++) d += a[i] * b[i];
   return -d;
 }
 
-static inline shf::Scalar ShuffleChallenge1(shf::Hash& hash,
-                                           const std::vector<shf::Ctxt>& Es,
-                                           const std::vector<shf::Ctxt>& pEs,
-                                           const shf::Point& C) {
-  for (const shf::Ctxt& E : Es) hash.Update(E.U).Update(E.V);
-  for (const shf::Ctxt& E : pEs) hash.Update(E.U).Update(E.V);
+// Es and pEs are bound into the transcript first, see BindStatement.
+static inline shf::PublicScalar ShuffleChallenge1(shf::Hash& hash,
+                                                  const shf::Point& C) {
   hash.Update(C);
   return shf::ScalarFromHash(hash);
 }
 
-#define RANDOM_SCALAR_VECTOR(_name, _size)            \
-  do {                                                \
-    _name.reserve(_size);                             \
-    for (std::size_t __i = 0; __i < _size; ++__i)     \
-      _name.emplace_back(shf::Scalar::CreateRandom()); \
-  } while (0)
-
-static inline shf::Scalar ShuffleChallenge2(shf::Hash& hash, const shf::Scalar& c,
-                                           const shf::Point& C) {
+static inline shf::PublicScalar ShuffleChallenge2(shf::Hash& hash,
+                                                  const shf::Scalar& c,
+                                                  const shf::Point& C) {
   hash.Update(c).Update(C);
   return shf::ScalarFromHash(hash);
 }
 
-static inline shf::Scalar ShuffleChallenge3(shf::Hash& hash,
-                                           const shf::Scalar& c) {
+static inline shf::PublicScalar ShuffleChallenge3(shf::Hash& hash,
+                                                  const shf::Scalar& c) {
   hash.Update(c);
   return shf::ScalarFromHash(hash);
 }
 
-shf::ShuffleP shf::Shuffler::Shuffle(const std::vector<shf::Ctxt>& Es,
+shf::ShuffleP shf::Shuffler::Shuffle(const shf::CtxtVector& Es,
                                    shf::Hash& hash) {
-  const std::size_t n = Es.size();
+  const std::size_t n = Es.Size();
 
   // permute and randomize ciphertexts
-  const Permutation p = CreatePermutation(n, m_prg);
-  std::vector<Scalar> rho;
-  RANDOM_SCALAR_VECTOR(rho, n);
-  const std::vector<Ctxt> pEs = Randomize(m_pk, Permute(Es, p), rho);
+  const CompactPermutation p = CreateCompactPermutation(n, m_prg);
+  const ScalarVec rho = Scalar::CreateRandomBatch(n);
+  CtxtVector pEs = ReEncrypt(m_pk, Permute(Es, p), rho);
 
   // Ca = commit(ck ; pi(1) ... pi(n) ; r)
-  const std::vector<Scalar> a = PermutationAsScalars(p);
-  const CommitmentAndRandomness Ca = Commit(m_ck, a);
+  // the entries of p are small, so commit to them directly.
+  const CommitmentAndRandomness Ca = Commit(m_ck, p);
+  const ScalarVec a = PermutationAsScalars(p);
 
-  const Scalar x = ShuffleChallenge1(hash, Es, pEs, Ca.C);
+  Transcript transcript(hash, m_version);
+  const Digest* pEs_digest = BindStatement(transcript, Es, pEs);
+  const Scalar x = ShuffleChallenge1(hash, Ca.C);
 
-  // Cb = commit(ck ; pi(1)*c0 ... pi(n)*c0 ; s);
-  const std::vector<Scalar> xexp = ExpSuccessive(x, n);
-  const std::vector<Scalar> b = Permute(xexp, p);
-  const CommitmentAndRandomness Cb = Commit(m_ck, b);
+  // Cb = commit(ck ; pi(1)*c0 ... pi(n)*c0 ; s), together with Dot(b, pEs)
+  // which the multiexp argument needs later.
+  const ScalarVec xexp = ExpSuccessive(x, n);
+  const ScalarVec b = Permute(xexp, p);
+  const CommitmentAndDot Cb = CommitAndDot(m_ck, b, pEs);
 
   const Scalar y = ShuffleChallenge2(hash, x, Cb.C);
   const Scalar z = ShuffleChallenge3(hash, y);
@@ -134,35 +282,41 @@ shf::ShuffleP shf::Shuffler::Shuffle(const std::vector<shf::Ctxt>& Es,
   const Scalar t = y * Ca.r + Cb.r;
   const Point CdCz = Commit(m_ck, t, dz);
   // product proof that commit(ck ; d - z ; t) is a commitment of dz.
-  const ProductP proof0 = CreateProof(m_ck, hash, {CdCz, prod}, dz, t);
+  ProductP proof0 = CreateProof(m_ck, hash, {CdCz, prod}, dz, t);
 
   const Scalar rr = NegateInnerProd(rho, b);
-  const Ctxt Ex = Add(Encrypt(m_pk, Point(), rr), Dot(b, pEs));
-  const MultiExpP proof1 =
-      CreateProof(m_ck, m_pk, hash, {pEs, Ex, Cb.C}, b, Cb.r, rr);
+  const Ctxt Ex = Add(Encrypt(m_pk, Point(), rr), Cb.E);
+  MultiExpP proof1 = CreateProof(m_ck, m_pk.Key(), hash,
+                                 {pEs, Ex, Cb.C, pEs_digest}, b, Cb.r, rr);
 
-  return {pEs, Ca.C, Cb.C, proof0, proof1};
+  return {std::move(pEs), Ca.C, Cb.C, std::move(proof0), std::move(proof1),
+          m_version};
 }
 
-static inline shf::Point CommitConstantNoRandomness(const shf::CommitKey& ck,
-                                                   const shf::Scalar& s) {
-  shf::Point Cz;
-  for (const shf::Point& Gi : ck.G) Cz += Gi * s;
-  return Cz;
+static inline shf::Point CommitConstantNoRandomness(
+    const shf::CommitKey& ck, const shf::PublicScalar& s) {
+  // sum_i s*G[i] == s*(sum_i G[i]), so a single multiplication suffices.
+  return shf::SumPoints(ck.G) * s;
 }
 
-bool shf::Shuffler::VerifyShuffle(const std::vector<shf::Ctxt>& ctxts,
+bool shf::Shuffler::VerifyShuffle(const shf::CtxtVector& ctxts,
                                  const shf::ShuffleP& proof, shf::Hash& hash) {
-  const Scalar x = ShuffleChallenge1(hash, ctxts, proof.permuted, proof.Ca);
-  const Scalar y = ShuffleChallenge2(hash, x, proof.Cb);
-  const Scalar z = ShuffleChallenge3(hash, y);
-
-  const Point Cz = CommitConstantNoRandomness(m_ck, -z);
+  // everything the verifier handles is public, so it uses variable-time
+  // arithmetic throughout.
+  if (proof.version != m_version) return false;
+  Transcript transcript(hash, m_version);
+  const Digest* pEs_digest =
+      BindStatement(transcript, ctxts, proof.permuted);
+  const PublicScalar x = ShuffleChallenge1(hash, proof.Ca);
+  const PublicScalar y = ShuffleChallenge2(hash, x, proof.Cb);
+  const PublicScalar z = ShuffleChallenge3(hash, y);
+
+  const Point Cz = CommitConstantNoRandomness(m_ck, PublicScalar(-z));
   const Point Cd = y * proof.Ca + proof.Cb;
   const Point CdCz = Cd + Cz;
 
-  const std::size_t n = ctxts.size();
-  SCALAR_VECTOR(xexp, n);
+  const std::size_t n = ctxts.Size();
+  TYPED_VECTOR(PublicScalar, xexp, n);
   xexp.emplace_back(x);
   Scalar prod = x - z;
   for (std::size_t i = 1; i < n; ++i) {
@@ -170,46 +324,50 @@ bool shf::Shuffler::VerifyShuffle(const std::vector<shf::Ctxt>& ctxts,
     prod *= Scalar::CreateFromInt(i) * y + xexp[i] - z;
   }
 
-  const ProductP proof0 = proof.product_proof;
+  const ProductP& proof0 = proof.product_proof;
   const bool check0 = VerifyProof(m_ck, hash, {CdCz, prod}, proof0);
 
-  const std::vector<Ctxt> pEs = proof.permuted;
+  const CtxtVector& pEs = proof.permuted;
   const Ctxt Ex = Dot(xexp, ctxts);
-  const MultiExpP proof1 = proof.multiexp_proof;
+  const MultiExpP& proof1 = proof.multiexp_proof;
   const bool check1 =
-      VerifyProof(m_ck, m_pk, hash, {pEs, Ex, proof.Cb}, proof1);
+      VerifyProof(m_ck, m_pk.Key(), hash, {pEs, Ex, proof.Cb, pEs_digest},
+                  proof1);
 
   return check0 && check1;
 }
 
 // START: Groth Shuffle Application for Votegral
 shf::ShuffleP shf::Shuffler::Prove(
-    const std::vector<shf::Ctxt>& Es,
-    const std::vector<shf::Ctxt>& pEs,
+    const shf::CtxtVector& Es,
+    const shf::CtxtVector& pEs,
     const shf::Permutation& p,
-    const std::vector<shf::Scalar>& rho,
+    const shf::ScalarVec& rho,
     shf::Hash& hash) {
 
-    const std::size_t n = Es.size();
+    const std::size_t n = Es.Size();
 
-    if (pEs.size() != n || p.size() != n || rho.size() != n) {
+    if (pEs.Size() != n || p.size() != n || rho.size() != n) {
         throw std::runtime_error("Input dimensions mismatch in Prove. Es, pEs, p, and rho must have the same size.");
     }
 
     // --- Proof Generation Logic ---
 
     // Ca = commit(ck ; pi(1) ... pi(n) ; r)
-    const std::vector<Scalar> a = PermutationAsScalars(p);
     // Commit generates internal randomness (Ca.r) for the commitment itself.
-    const CommitmentAndRandomness Ca = Commit(m_ck, a);
+    // The entries of p are small, so commit to them directly.
+    const CommitmentAndRandomness Ca = Commit(m_ck, p);
+    const ScalarVec a = PermutationAsScalars(p);
 
     // Calculate Challenge 1 (x)
-    const Scalar x = ShuffleChallenge1(hash, Es, pEs, Ca.C);
+    Transcript transcript(hash, m_version);
+    const Digest* pEs_digest = BindStatement(transcript, Es, pEs);
+    const Scalar x = ShuffleChallenge1(hash, Ca.C);
 
-    // Cb = commit(ck ; pi(1)*x^i ... pi(n)*x^i ; s);
-    const std::vector<Scalar> xexp = ExpSuccessive(x, n);
-    const std::vector<Scalar> b = Permute(xexp, p);
-    const CommitmentAndRandomness Cb = Commit(m_ck, b);
+    // Cb = commit(ck ; pi(1)*x^i ... pi(n)*x^i ; s), together with Dot(b, pEs)
+    const ScalarVec xexp = ExpSuccessive(x, n);
+    const ScalarVec b = Permute(xexp, p);
+    const CommitmentAndDot Cb = CommitAndDot(m_ck, b, pEs);
 
     // Calculate Challenges 2 and 3 (y, z)
     const Scalar y = ShuffleChallenge2(hash, x, Cb.C);
@@ -227,19 +385,21 @@ shf::ShuffleP shf::Shuffler::Prove(
     const Point CdCz = Commit(m_ck, t, dz);
 
     // Generate Product Proof (proof0)
-    const ProductP proof0 = CreateProof(m_ck, hash, {CdCz, prod}, dz, t);
+    ProductP proof0 = CreateProof(m_ck, hash, {CdCz, prod}, dz, t);
 
     // Prepare Multi-Exponentiation Argument
     // We use the provided randomness 'rho'
     const Scalar rr = NegateInnerProd(rho, b);
     // Ex is calculated based on the provided output pEs
-    const Ctxt Ex = Add(Encrypt(m_pk, Point(), rr), Dot(b, pEs));
+    const Ctxt Ex = Add(Encrypt(m_pk, Point(), rr), Cb.E);
 
     // Generate Multi-Exponentiation Proof (proof1)
-    const MultiExpP proof1 =
-        CreateProof(m_ck, m_pk, hash, {pEs, Ex, Cb.C}, b, Cb.r, rr);
+    MultiExpP proof1 =
+        CreateProof(m_ck, m_pk.Key(), hash, {pEs, Ex, Cb.C, pEs_digest}, b,
+                    Cb.r, rr);
 
-    // Return the generated proof components.
-    return {pEs, Ca.C, Cb.C, proof0, proof1};
+    // Return the generated proof components. pEs is copied, since the proof
+    // owns its ciphertexts.
+    return {pEs, Ca.C, Cb.C, std::move(proof0), std::move(proof1), m_version};
 }
 // END: Groth Shuffle Application for Votegral
\ No newline at end of file
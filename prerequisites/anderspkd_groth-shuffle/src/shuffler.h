@@ -1,7 +1,9 @@
 #ifndef SHF_SHUFFLER_H
 #define SHF_SHUFFLER_H
 
+#include <cstdint>
 #include <stdexcept>
+#include <utility>
 #include <vector>
 
 #include "cipher.h"
@@ -17,22 +19,42 @@ namespace shf {
  */
 using Permutation = std::vector<std::size_t>;
 
+/**
+ * @brief A permutation of at most 2^32 elements, at half the memory.
+ */
+using CompactPermutation = std::vector<uint32_t>;
+
 /**
  * @brief Create a random permutation of a given size.
+ *
+ * Every permutation is equally likely. Indices are drawn with Lemire's
+ * multiply-shift rejection, which needs no division in the common case.
+ * Permutations of four million elements or more are built with MergeShuffle:
+ * fixed-size runs are shuffled from their own forks of prg and then merged
+ * pairwise, which stays in cache for most of the work, and lets the runs and
+ * the merges of each level be done in any order.
+ *
  * @param size the size of the permutation
  * @param prg the random generator to use
  * @return a random permutation.
  */
 Permutation CreatePermutation(std::size_t size, shf::Prg& prg);
 
+/**
+ * @brief Like CreatePermutation, but with 32-bit indices.
+ * @throws std::invalid_argument if size is larger than 2^32.
+ */
+CompactPermutation CreateCompactPermutation(std::size_t size, shf::Prg& prg);
+
 /**
  * @brief Permute a list of things.
  * @param things the list of things to permute
- * @param perm the permutation to use
+ * @param perm the permutation to use, as a Permutation or CompactPermutation
  * @return a permutation of the input.
  */
-template <typename T>
-std::vector<T> Permute(const std::vector<T>& things, const Permutation& perm) {
+template <typename T, typename Index>
+std::vector<T> Permute(const std::vector<T>& things,
+                       const std::vector<Index>& perm) {
   const std::size_t n = things.size();
   if (n != perm.size()) throw std::invalid_argument("invalid permutation size");
 
@@ -42,51 +64,91 @@ std::vector<T> Permute(const std::vector<T>& things, const Permutation& perm) {
   return permuted;
 }
 
+/**
+ * @brief Permute a list of ciphertexts.
+ * @param Es the ciphertexts to permute
+ * @param perm the permutation to use
+ * @return a permutation of the input.
+ */
+inline CtxtVector Permute(const CtxtVector& Es, const Permutation& perm) {
+  return Es.Permute(perm);
+}
+
+inline CtxtVector Permute(const CtxtVector& Es,
+                          const CompactPermutation& perm) {
+  return Es.Permute(perm);
+}
+
 struct ShuffleP {
-  std::vector<Ctxt> permuted;
+  CtxtVector permuted;
   Point Ca;
   Point Cb;
   ProductP product_proof;
   MultiExpP multiexp_proof;
+  TranscriptVersion version = TranscriptVersion::kV2;
 };
 
 class Shuffler {
  public:
-  Shuffler(const PublicKey& pk, const CommitKey& ck, Prg& prg)
-      : m_pk(pk), m_ck(ck), m_prg(prg){};
+  /**
+   * @brief Create a shuffler.
+   *
+   * Fixed-base tables are built for the public key, which every shuffled
+   * ciphertext is re-randomized under, and for the commit key unless it
+   * already has them, since proofs commit against H several times. The table
+   * for G is only built if options allows it a memory budget (see
+   * PrecomputeOptions::max_bytes).
+   *
+   * @param pk the public key the ciphertexts are encrypted under
+   * @param ck the commit key
+   * @param prg the random generator to use
+   * @param version the transcript version to prove and verify with. Proofs
+   * made with another version are rejected.
+   * @param options the tables to build for the commit key if it has none,
+   * e.g. a max_bytes that allows a table for G
+   */
+  Shuffler(const PublicKey& pk, CommitKey ck, Prg& prg,
+           TranscriptVersion version = TranscriptVersion::kV2,
+           const PrecomputeOptions& options = {})
+      : m_pk(pk), m_ck(std::move(ck)), m_prg(prg), m_version(version) {
+    if (!m_ck.precomputed) Precompute(m_ck, options);
+  };
   
   // START: Groth Shuffle Application for Votegral
   // Custom Prove function: Accepts the statement (Es, pEs) and the witness (p, rho)
   ShuffleP Prove(
-    const std::vector<Ctxt>& Es,          // Input Ciphertexts
-    const std::vector<Ctxt>& pEs,         // Output (Shuffled) Ciphertexts
+    const CtxtVector& Es,                 // Input Ciphertexts
+    const CtxtVector& pEs,                // Output (Shuffled) Ciphertexts
     const Permutation& p,                 // Permutation (Witness)
-    const std::vector<Scalar>& rho,       // Randomness (Witness)
+    const ScalarVec& rho,       // Randomness (Witness)
       Hash& hash);
   // END: Groth Shuffle Application for Votegral
 
   /**
    * @brief Shuffle a set of ciphertexts and return a proof of correctness.
    * @param ctxts ciphertexts to shuffle
-   * @param hash a hash function object
+   * @param hash a fresh hash function object
    * @return a proof of that the shuffle was done correctly.
+   * @throws std::invalid_argument if hash has already absorbed some input.
    */
-  ShuffleP Shuffle(const std::vector<Ctxt>& ctxts, Hash& hash);
+  ShuffleP Shuffle(const CtxtVector& ctxts, Hash& hash);
 
   /**
    * @brief Verify a shuffle.
    * @param ctxts the ciphertexts that were shuffled
    * @param proof the proof to verify
-   * @param hash a hash function object
+   * @param hash a fresh hash function object
    * @return true if the shuffle was correct and false otherwise.
+   * @throws std::invalid_argument if hash has already absorbed some input.
    */
-  bool VerifyShuffle(const std::vector<Ctxt>& ctxts, const ShuffleP& proof,
+  bool VerifyShuffle(const CtxtVector& ctxts, const ShuffleP& proof,
                      Hash& hash);
 
  private:
-  PublicKey m_pk;
+  PrecomputedPublicKey m_pk;
   CommitKey m_ck;
   Prg m_prg;
+  TranscriptVersion m_version;
 };
 
 }  // namespace mh
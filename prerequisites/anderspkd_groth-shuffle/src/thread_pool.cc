@@ -0,0 +1,115 @@
+#include "thread_pool.h"
+
+#include <atomic>
+#include <exception>
+#include <stdexcept>
+
+// One call to ParallelFor. Threads claim indices from next until they run
+// out; the caller waits for done to reach n.
+struct shf::ThreadPool::Loop {
+  const std::function<void(std::size_t)>* body;
+  std::size_t n;
+  std::atomic<std::size_t> next{0};
+  std::atomic<std::size_t> done{0};
+  std::mutex mutex;
+  std::condition_variable finished;
+  std::exception_ptr error;
+};
+
+shf::ThreadPool::ThreadPool(std::size_t threads) {
+  if (threads == 0) throw std::invalid_argument("a pool needs a thread");
+  m_workers.reserve(threads - 1);
+  for (std::size_t i = 1; i < threads; ++i)
+    m_workers.emplace_back([this] { Work(); });
+}
+
+shf::ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stop = true;
+  }
+  m_wake.notify_all();
+  for (auto& worker : m_workers) worker.join();
+}
+
+void shf::ThreadPool::Run(Loop& loop) {
+  for (;;) {
+    const std::size_t i = loop.next++;
+    if (i >= loop.n) return;
+    try {
+      (*loop.body)(i);
+    } catch (...) {
+      std::lock_guard<std::mutex> lock(loop.mutex);
+      if (!loop.error) loop.error = std::current_exception();
+    }
+    if (++loop.done == loop.n) {
+      std::lock_guard<std::mutex> lock(loop.mutex);
+      loop.finished.notify_all();
+    }
+  }
+}
+
+void shf::ThreadPool::Work() {
+  std::unique_lock<std::mutex> lock(m_mutex);
+  for (;;) {
+    m_wake.wait(lock, [this] { return m_stop || !m_loops.empty(); });
+    if (m_stop) return;
+    std::shared_ptr<Loop> loop = m_loops.front();
+    // every index has been claimed, so the loop no longer needs helpers.
+    if (loop->next >= loop->n) {
+      m_loops.pop_front();
+      continue;
+    }
+    lock.unlock();
+    Run(*loop);
+    lock.lock();
+  }
+}
+
+void shf::ThreadPool::ParallelFor(
+    std::size_t n, const std::function<void(std::size_t)>& body) {
+  if (m_workers.empty() || n < 2) {
+    for (std::size_t i = 0; i < n; ++i) body(i);
+    return;
+  }
+
+  auto loop = std::make_shared<Loop>();
+  loop->body = &body;
+  loop->n = n;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_loops.push_back(loop);
+  }
+  m_wake.notify_all();
+
+  Run(*loop);
+  {
+    std::unique_lock<std::mutex> lock(loop->mutex);
+    loop->finished.wait(lock, [&] { return loop->done == loop->n; });
+  }
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (auto it = m_loops.begin(); it != m_loops.end(); ++it)
+      if (*it == loop) {
+        m_loops.erase(it);
+        break;
+      }
+  }
+  if (loop->error) std::rethrow_exception(loop->error);
+}
+
+static std::mutex k_default_pool_mutex;
+static std::unique_ptr<shf::ThreadPool> k_default_pool;
+
+shf::ThreadPool& shf::DefaultThreadPool() {
+  std::lock_guard<std::mutex> lock(k_default_pool_mutex);
+  if (!k_default_pool) k_default_pool.reset(new ThreadPool(1));
+  return *k_default_pool;
+}
+
+void shf::SetThreadCount(std::size_t threads) {
+  if (threads == 0)
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  std::lock_guard<std::mutex> lock(k_default_pool_mutex);
+  k_default_pool.reset(new ThreadPool(threads));
+}
@@ -0,0 +1,109 @@
+#ifndef SHF_THREAD_POOL_H
+#define SHF_THREAD_POOL_H
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace shf {
+
+/**
+ * @brief A fixed set of worker threads for data-parallel loops.
+ *
+ * The thread that calls ParallelFor works on the loop too, so a pool of size
+ * t has t - 1 workers and a pool of size 1 runs every loop inline. Loops may
+ * be started from several threads at once and from inside other loops: a
+ * caller never waits for an index that no thread is working on, so nesting
+ * cannot deadlock.
+ */
+class ThreadPool {
+ public:
+  /**
+   * @brief Create a pool that runs loops on threads threads in total.
+   * @throws std::invalid_argument if threads is 0.
+   */
+  explicit ThreadPool(std::size_t threads);
+
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  /**
+   * @brief The number of threads a loop can run on, the caller included.
+   */
+  std::size_t Size() const { return m_workers.size() + 1; };
+
+  /**
+   * @brief Split n items into pieces of at least grain items, at most one per
+   * thread.
+   * @return the number of pieces, at least 1.
+   */
+  std::size_t Parts(std::size_t n, std::size_t grain) const {
+    return std::max<std::size_t>(1, std::min(Size(), n / grain));
+  };
+
+  /**
+   * @brief Call body(i) once for every i < n and wait until all calls return.
+   *
+   * The calls run in no particular order, so they must not depend on each
+   * other. If some of them throw, the first exception is rethrown once all
+   * calls are done.
+   */
+  void ParallelFor(std::size_t n, const std::function<void(std::size_t)>& body);
+
+  /**
+   * @brief Compute reduce(...reduce(reduce(init, map(0)), map(1))...,
+   * map(n - 1)), with the map calls spread over the pool.
+   *
+   * The results are combined in index order, so the result does not depend
+   * on the number of threads even if reduce is not commutative.
+   */
+  template <typename T, typename Map, typename Reduce>
+  T ParallelReduce(std::size_t n, T init, const Map& map,
+                   const Reduce& reduce) {
+    std::vector<T> parts(n, init);
+    ParallelFor(n, [&](std::size_t i) { parts[i] = map(i); });
+    for (auto& part : parts) init = reduce(std::move(init), std::move(part));
+    return init;
+  }
+
+ private:
+  struct Loop;
+
+  void Work();
+  static void Run(Loop& loop);
+
+  std::vector<std::thread> m_workers;
+  std::mutex m_mutex;
+  std::condition_variable m_wake;
+  std::deque<std::shared_ptr<Loop>> m_loops;
+  bool m_stop = false;
+};
+
+/**
+ * @brief The pool the library runs its own parallel loops on.
+ *
+ * It has one thread, i.e. everything runs on the calling thread, until
+ * SetThreadCount is called.
+ */
+ThreadPool& DefaultThreadPool();
+
+/**
+ * @brief Resize the default pool.
+ *
+ * Must not be called while any thread is inside the library.
+ *
+ * @param threads the number of threads, or 0 for one per hardware thread
+ */
+void SetThreadCount(std::size_t threads);
+
+}  // namespace shf
+
+#endif  // SHF_THREAD_POOL_H
@@ -1,10 +1,13 @@
 #include "zkp.h"
 
 #include <iostream>
+#include <stdexcept>
+#include <utility>
 
-static inline shf::Scalar DLogChallenge(shf::Hash& hash, const shf::Point& p0,
-                                       const shf::Point& p1,
-                                       const shf::Point& p2) {
+static inline shf::PublicScalar DLogChallenge(shf::Hash& hash,
+                                              const shf::Point& p0,
+                                              const shf::Point& p1,
+                                              const shf::Point& p2) {
   hash.Update(p0).Update(p1).Update(p2);
   return ScalarFromHash(hash);
 }
@@ -17,27 +20,26 @@ shf::DLogP shf::CreateProof(const shf::DLogS& statement, shf::Hash& hash,
   const Point T = v * B;
   const Scalar c = DLogChallenge(hash, B, P, T);
   const Scalar r = v - c * w;
-  return {T, r};
+  return {T, PublicScalar(r)};
 }
 
 bool shf::VerifyProof(const shf::DLogS& statement, shf::Hash& hash,
                      const shf::DLogP& proof) {
   const Point T = proof.T;
-  const Scalar r = proof.r;
+  const PublicScalar r = proof.r;
   const Point B = statement.B;
   const Point P = statement.P;
-  const Scalar c = DLogChallenge(hash, B, P, T);
-  const Point cP = c * P;
-  const Point rB = r * B;
-  return cP + rB == T;
+  const PublicScalar c = DLogChallenge(hash, B, P, T);
+  return Point::MulAdd2(c, P, r, B) == T;
 }
 
-static inline shf::Scalar DLogEqChallenge(shf::Hash& hash, const shf::Point& p0,
-                                         const shf::Point& p1,
-                                         const shf::Point& p2,
-                                         const shf::Point& p3,
-                                         const shf::Point& p4,
-                                         const shf::Point& p5) {
+static inline shf::PublicScalar DLogEqChallenge(shf::Hash& hash,
+                                                const shf::Point& p0,
+                                                const shf::Point& p1,
+                                                const shf::Point& p2,
+                                                const shf::Point& p3,
+                                                const shf::Point& p4,
+                                                const shf::Point& p5) {
   hash.Update(p0).Update(p1).Update(p2).Update(p3).Update(p4).Update(p5);
   return ScalarFromHash(hash);
 }
@@ -53,7 +55,7 @@ shf::DLogEqP shf::CreateProof(const shf::DLogEqS& statement, shf::Hash& hash,
   const Point K = v * H;
   const Scalar c = DLogEqChallenge(hash, G, A, H, B, T, K);
   const Scalar r = v - c * w;
-  return {T, K, r};
+  return {T, K, PublicScalar(r)};
 }
 
 bool shf::VerifyProof(const shf::DLogEqS& statement, shf::Hash& hash,
@@ -64,46 +66,178 @@ bool shf::VerifyProof(const shf::DLogEqS& statement, shf::Hash& hash,
   const Point B = statement.B;
   const Point T = proof.T;
   const Point K = proof.K;
-  const Scalar r = proof.r;
-  const Scalar c = DLogEqChallenge(hash, G, A, H, B, T, K);
-  const Point cA = c * A;
-  const Point cB = c * B;
-  const Point rG = r * G;
-  const Point rH = r * H;
-  return rG == T - cA && rH == K - cB;
+  const PublicScalar r = proof.r;
+  const PublicScalar c = DLogEqChallenge(hash, G, A, H, B, T, K);
+  // rG == T - cA and rH == K - cB
+  return Point::MulAdd2(r, G, c, A) == T && Point::MulAdd2(r, H, c, B) == K;
 }
 
 // create a vector and reserve a size
 #define SCALAR_VECTOR(_name, _size) \
-  std::vector<shf::Scalar> _name;    \
+  shf::ScalarVec _name;             \
+  _name.reserve(_size);
+
+#define PUBLIC_SCALAR_VECTOR(_name, _size) \
+  shf::PublicScalarVec _name;              \
   _name.reserve(_size);
 
-static inline shf::Scalar ProductChallenge(shf::Hash& hash, const shf::Point& C0,
-                                          const shf::Point& C1,
-                                          const shf::Point& C2) {
+// Absorb k points into each hash and derive a challenge from each, as the
+// single-proof challenges do one hash at a time. points holds the k points of
+// hash 0, then those of hash 1, and so on, and is normalized in place.
+static shf::PublicScalarVec ChallengesMany(std::vector<shf::Hash>& hashes,
+                                           std::vector<shf::Point>& points,
+                                           const std::size_t k) {
+  const std::size_t n = hashes.size();
+  const std::size_t m = k * shf::Point::ByteSize();
+  shf::NormalizeBatch(points);
+  std::vector<uint8_t> bytes(n * m);
+  for (std::size_t i = 0; i < n * k; ++i)
+    points[i].Write(bytes.data() + i * shf::Point::ByteSize());
+
+  std::vector<shf::Hash*> ptrs(n);
+  std::vector<const uint8_t*> data(n);
+  for (std::size_t i = 0; i < n; ++i) {
+    ptrs[i] = &hashes[i];
+    data[i] = bytes.data() + i * m;
+  }
+  shf::Hash::UpdateMany(ptrs.data(), data.data(), m, n);
+
+  // like ScalarFromHash, finalize copies so the hashes can go on.
+  std::vector<shf::Hash> copies(hashes);
+  for (std::size_t i = 0; i < n; ++i) ptrs[i] = &copies[i];
+  std::vector<shf::Digest> digests(n);
+  shf::Hash::FinalizeMany(digests.data(), ptrs.data(), n);
+
+  PUBLIC_SCALAR_VECTOR(challenges, n);
+  for (const auto& d : digests)
+    challenges.emplace_back(shf::Scalar::Read(d.data()));
+  return challenges;
+}
+
+static shf::PublicScalarVec ChallengesMany(std::vector<shf::Hash>& hashes,
+                                           std::vector<shf::Point>&& points,
+                                           const std::size_t k) {
+  return ChallengesMany(hashes, points, k);
+}
+
+static inline void CheckBatchSizes(std::size_t statements, std::size_t hashes,
+                                   std::size_t others) {
+  if (hashes != statements || others != statements)
+    throw std::invalid_argument("batch sizes differ");
+}
+
+std::vector<shf::DLogP> shf::CreateProofs(
+    const std::vector<shf::DLogS>& statements, std::vector<shf::Hash>& hashes,
+    const shf::ScalarVec& ws) {
+  const std::size_t n = statements.size();
+  CheckBatchSizes(n, hashes.size(), ws.size());
+  const ScalarVec vs = Scalar::CreateRandomBatch(n);
+  std::vector<Point> points;
+  points.reserve(3 * n);
+  for (std::size_t i = 0; i < n; ++i) {
+    points.push_back(statements[i].B);
+    points.push_back(statements[i].P);
+    points.push_back(vs[i] * statements[i].B);
+  }
+  const PublicScalarVec cs = ChallengesMany(hashes, points, 3);
+
+  std::vector<DLogP> proofs;
+  proofs.reserve(n);
+  for (std::size_t i = 0; i < n; ++i)
+    proofs.push_back({points[3 * i + 2], PublicScalar(vs[i] - cs[i] * ws[i])});
+  return proofs;
+}
+
+bool shf::VerifyProofs(const std::vector<shf::DLogS>& statements,
+                       std::vector<shf::Hash>& hashes,
+                       const std::vector<shf::DLogP>& proofs) {
+  const std::size_t n = statements.size();
+  CheckBatchSizes(n, hashes.size(), proofs.size());
+  std::vector<Point> points;
+  points.reserve(3 * n);
+  for (std::size_t i = 0; i < n; ++i) {
+    points.push_back(statements[i].B);
+    points.push_back(statements[i].P);
+    points.push_back(proofs[i].T);
+  }
+  const PublicScalarVec cs = ChallengesMany(hashes, std::move(points), 3);
+
+  bool valid = true;
+  for (std::size_t i = 0; i < n; ++i) {
+    const DLogS& st = statements[i];
+    valid &= Point::MulAdd2(cs[i], st.P, proofs[i].r, st.B) == proofs[i].T;
+  }
+  return valid;
+}
+
+std::vector<shf::DLogEqP> shf::CreateProofs(
+    const std::vector<shf::DLogEqS>& statements,
+    std::vector<shf::Hash>& hashes, const shf::ScalarVec& ws) {
+  const std::size_t n = statements.size();
+  CheckBatchSizes(n, hashes.size(), ws.size());
+  const ScalarVec vs = Scalar::CreateRandomBatch(n);
+  std::vector<Point> points;
+  points.reserve(6 * n);
+  for (std::size_t i = 0; i < n; ++i) {
+    const DLogEqS& st = statements[i];
+    points.insert(points.end(), {st.G, st.A, st.H, st.B});
+    points.push_back(vs[i] * st.G);
+    points.push_back(vs[i] * st.H);
+  }
+  const PublicScalarVec cs = ChallengesMany(hashes, points, 6);
+
+  std::vector<DLogEqP> proofs;
+  proofs.reserve(n);
+  for (std::size_t i = 0; i < n; ++i)
+    proofs.push_back({points[6 * i + 4], points[6 * i + 5],
+                      PublicScalar(vs[i] - cs[i] * ws[i])});
+  return proofs;
+}
+
+bool shf::VerifyProofs(const std::vector<shf::DLogEqS>& statements,
+                       std::vector<shf::Hash>& hashes,
+                       const std::vector<shf::DLogEqP>& proofs) {
+  const std::size_t n = statements.size();
+  CheckBatchSizes(n, hashes.size(), proofs.size());
+  std::vector<Point> points;
+  points.reserve(6 * n);
+  for (std::size_t i = 0; i < n; ++i) {
+    const DLogEqS& st = statements[i];
+    points.insert(points.end(),
+                  {st.G, st.A, st.H, st.B, proofs[i].T, proofs[i].K});
+  }
+  const PublicScalarVec cs = ChallengesMany(hashes, std::move(points), 6);
+
+  bool valid = true;
+  for (std::size_t i = 0; i < n; ++i) {
+    const DLogEqS& st = statements[i];
+    const PublicScalar& r = proofs[i].r;
+    valid &= Point::MulAdd2(r, st.G, cs[i], st.A) == proofs[i].T &&
+             Point::MulAdd2(r, st.H, cs[i], st.B) == proofs[i].K;
+  }
+  return valid;
+}
+
+static inline shf::PublicScalar ProductChallenge(shf::Hash& hash,
+                                                 const shf::Point& C0,
+                                                 const shf::Point& C1,
+                                                 const shf::Point& C2) {
   hash.Update(C0).Update(C1).Update(C2);
   return shf::ScalarFromHash(hash);
 }
 
 shf::ProductP shf::CreateProof(const shf::CommitKey& ck, shf::Hash& hash,
-                             const shf::ProductS& statement,
-                             const std::vector<shf::Scalar>& w0,
+                             const shf::ProductS& /* statement */,
+                             const shf::ScalarVec& w0,
                              const shf::Scalar& w1) {
   const auto n = w0.size();
-  const auto C = statement.C;
-  const auto b = statement.b;
 
-  SCALAR_VECTOR(ds, n);
+  const ScalarVec ds = Scalar::CreateRandomBatch(n);
+  ScalarVec es = Scalar::CreateRandomBatch(n);
   SCALAR_VECTOR(bs, n);
-  SCALAR_VECTOR(es, n);
 
   bs.emplace_back(w0[0]);
-  for (std::size_t i = 0; i < n; ++i) {
-    ds.emplace_back(Scalar::CreateRandom());
-    es.emplace_back(Scalar::CreateRandom());
-    if (i == 0) continue;
-    bs.emplace_back(w0[i] * bs[i - 1]);
-  }
+  for (std::size_t i = 1; i < n; ++i) bs.emplace_back(w0[i] * bs[i - 1]);
   es[0] = ds[0];
   es[n - 1] = Scalar();
 
@@ -121,18 +255,18 @@ shf::ProductP shf::CreateProof(const shf::CommitKey& ck, shf::Hash& hash,
 
   const auto c = ProductChallenge(hash, Cr0.C, Cr1.C, Cr2.C);
 
-  SCALAR_VECTOR(aa, n);
-  SCALAR_VECTOR(bb, n);
+  PUBLIC_SCALAR_VECTOR(aa, n);
+  PUBLIC_SCALAR_VECTOR(bb, n);
 
   for (std::size_t i = 0; i < n; ++i) {
     aa.emplace_back(c * w0[i] + ds[i]);
     bb.emplace_back(c * bs[i] + es[i]);
   }
 
-  const auto r = c * w1 + Cr0.r;
-  const auto s = c * Cr2.r + Cr1.r;
+  const PublicScalar r(c * w1 + Cr0.r);
+  const PublicScalar s(c * Cr2.r + Cr1.r);
 
-  return {Cr0.C, Cr1.C, Cr2.C, aa, bb, r, s};
+  return {Cr0.C, Cr1.C, Cr2.C, std::move(aa), std::move(bb), r, s};
 }
 
 bool shf::VerifyProof(const shf::CommitKey& ck, shf::Hash& hash,
@@ -147,89 +281,76 @@ bool shf::VerifyProof(const shf::CommitKey& ck, shf::Hash& hash,
   const auto lhs0 = c * C + C0;
   const auto lhs1 = c * C2 + C1;
 
-  Point rhs0, rhs1;
-  std::size_t i = 0;
-  const auto as = proof.as;
-  const auto bs = proof.bs;
-  const auto b = statement.b;
-  for (; i < as.size() - 2; ++i) {
-    const auto Gi = ck.G[i];
-    rhs0 += Gi * as[i];
-    rhs1 += Gi * (c * bs[i + 1] - bs[i] * as[i + 1]);
-  }
-  rhs0 += ck.G[i] * as[i];
-  rhs1 += ck.G[i] * (c * c * b - bs[i] * as[i + 1]);
-  i++;
-  rhs0 += ck.G[i] * as[i];
+  const auto& as = proof.as;
+  const auto& bs = proof.bs;
+  const auto& b = statement.b;
+  const std::size_t n = as.size();
 
-  const auto r = proof.r;
-  const auto s = proof.s;
+  // rhs1 = sum_i G[i] * e[i], where the last term uses the claimed product.
+  PUBLIC_SCALAR_VECTOR(es, n - 1);
+  for (std::size_t i = 0; i < n - 2; ++i)
+    es.emplace_back(c * bs[i + 1] - bs[i] * as[i + 1]);
+  es.emplace_back(c * c * b - bs[n - 2] * as[n - 1]);
 
-  return lhs0 == rhs0 + ck.H * r && lhs1 == rhs1 + ck.H * s;
-}
+  const auto rhs0 = Commit(ck, proof.r, as);
+  const auto rhs1 = Commit(ck, proof.s, es);
 
-static inline shf::CommitmentAndRandomness CommitOne(const shf::CommitKey& ck,
-                                                    const shf::Scalar& m) {
-  const auto r = shf::Scalar::CreateRandom();
-  return {m * ck.G[0] + r * ck.H, r};
+  return lhs0 == rhs0 && lhs1 == rhs1;
 }
 
 static inline void HashStatement(shf::Hash& hash,
                                  const shf::MultiExpS& statement) {
-  const auto Es = statement.Es;
-  const auto E = statement.E;
-  const auto C = statement.C;
-  hash.Update(E.U).Update(E.V).Update(C);
-  for (const auto& ctxt : Es) hash.Update(ctxt.U).Update(ctxt.V);
+  const auto& E = statement.E;
+  hash.Update(E.U).Update(E.V).Update(statement.C);
+  if (statement.Es_digest)
+    hash.Update(statement.Es_digest->data(), statement.Es_digest->size());
+  else
+    hash.Update(statement.Es);
 }
 
-static inline shf::Scalar MultiExpChallenge(shf::Hash& hash,
-                                           const shf::MultiExpS& statement,
-                                           const shf::Point& C0,
-                                           const shf::Point& C1,
-                                           const shf::Ctxt& E) {
+static inline shf::PublicScalar MultiExpChallenge(
+    shf::Hash& hash, const shf::MultiExpS& statement, const shf::Point& C0,
+    const shf::Point& C1, const shf::Ctxt& E) {
   HashStatement(hash, statement);
   hash.Update(C0).Update(C1).Update(E.U).Update(E.V);
   return shf::ScalarFromHash(hash);
 }
 
-static inline std::vector<shf::Scalar> MulAndSum(
-    const std::vector<shf::Scalar>& a, const std::vector<shf::Scalar>& b,
-    const shf::Scalar& x) {
+static inline shf::PublicScalarVec MulAndSum(const shf::ScalarVec& a,
+                                             const shf::ScalarVec& b,
+                                             const shf::Scalar& x) {
   const auto n = a.size();
-  SCALAR_VECTOR(c, n);
+  PUBLIC_SCALAR_VECTOR(c, n);
   for (std::size_t i = 0; i < n; ++i) c.emplace_back(a[i] + b[i] * x);
   return c;
 }
 
 shf::MultiExpP shf::CreateProof(const shf::CommitKey& ck, const shf::PublicKey& pk,
                               shf::Hash& hash, const shf::MultiExpS& statement,
-                              const std::vector<shf::Scalar>& w0,
+                              const shf::ScalarVec& w0,
                               const shf::Scalar& w1, const shf::Scalar& w2) {
   const std::size_t n = w0.size();
-  const std::vector<Ctxt> Es = statement.Es;
-  const Ctxt E = statement.E;
-  const Point C = statement.C;
+  const CtxtVector& Es = statement.Es;
 
-  SCALAR_VECTOR(a0, n);
-  for (std::size_t i = 0; i < n; ++i) a0.emplace_back(Scalar::CreateRandom());
+  const ScalarVec a0 = Scalar::CreateRandomBatch(n);
 
   const CommitmentAndRandomness Cr0 = Commit(ck, a0);
 
   const Scalar b = Scalar::CreateRandom();
-  const CommitmentAndRandomness Crb = CommitOne(ck, b);
+  const CommitmentAndRandomness Crb = Commit(ck, b);
 
   const Scalar t = Scalar::CreateRandom();
-  const Point bG = b * Point::Generator();
+  const Point bG = Point::MulGenerator(b);
   const Ctxt E0 = shf::Add(shf::Encrypt(pk, bG, t), shf::Dot(a0, Es));
 
   const Scalar c = MultiExpChallenge(hash, statement, Cr0.C, Crb.C, E0);
 
-  const std::vector<Scalar> aa = MulAndSum(a0, w0, c);
-  const Scalar rr = Cr0.r + w1 * c;
-  const Scalar tt = t + w2 * c;
+  PublicScalarVec aa = MulAndSum(a0, w0, c);
+  const PublicScalar rr(Cr0.r + w1 * c);
+  const PublicScalar tt(t + w2 * c);
 
-  return {Cr0.C, Crb.C, E0, aa, rr, b, Crb.r, tt};
+  return {Cr0.C, Crb.C, E0, std::move(aa), rr, PublicScalar(b),
+          PublicScalar(Crb.r), tt};
 }
 
 static inline bool CtxtEqual(const shf::Ctxt& E0, const shf::Ctxt& E1) {
@@ -246,8 +367,9 @@ bool shf::VerifyProof(const shf::CommitKey& ck, const shf::PublicKey& pk,
   // E0 = E + c*E
   // E1 = Enc(pk, 1, t) + Es^a
   const Ctxt E0 = Add(proof.E, Multiply(c, statement.E));
-  const Ctxt E1 = Add(Encrypt(pk, Point::Generator() * proof.b, proof.t),
-                      Dot(proof.a, statement.Es));
+  const CommitmentAndDot Ca = CommitAndDot(ck, proof.r, proof.a, statement.Es);
+  const Ctxt E1 =
+      Add(Encrypt(pk, Point::MulGenerator(proof.b), proof.t), Ca.E);
 
-  return C == Commit(ck, proof.r, proof.a) && CtxtEqual(E0, E1);
+  return C == Ca.C && CtxtEqual(E0, E1);
 }
@@ -10,6 +10,16 @@
 
 namespace shf {
 
+// Everything in a proof is public, so proofs hold PublicScalars and verifiers
+// recompute them with variable-time arithmetic. Provers declassify their
+// responses explicitly when building a proof.
+//
+// The challenges of the proofs below are drawn from the caller's Hash, and a
+// default Hash is SHA3-256. Before Hash was fixed, Update absorbed whole
+// words incorrectly, so DLog, DLogEq, Product and MultiExp proofs made by
+// those versions do not verify against a default Hash. Prover and verifier
+// should both pass Hash::Legacy() to make or check such proofs.
+
 /**
  * @brief Knowledge of discrete log.
  *
@@ -25,7 +35,7 @@ struct DLogS {
  */
 struct DLogP {
   Point T;
-  Scalar r;
+  PublicScalar r;
 };
 
 /**
@@ -46,6 +56,28 @@ DLogP CreateProof(const DLogS& statement, Hash& hash, const Scalar& w);
  */
 bool VerifyProof(const DLogS& statement, Hash& hash, const DLogP& proof);
 
+/**
+ * @brief Create proofs for many DLog statements, each with its own hash.
+ *
+ * Equivalent to CreateProof(statements[i], hashes[i], ws[i]) for every i, but
+ * the challenges are hashed side by side (see Hash::UpdateMany), which pays
+ * off for batches of short transcripts such as decryption proofs.
+ *
+ * @throws std::invalid_argument if the sizes differ.
+ */
+std::vector<DLogP> CreateProofs(const std::vector<DLogS>& statements,
+                                std::vector<Hash>& hashes,
+                                const ScalarVec& ws);
+
+/**
+ * @brief Verify many DLog proofs, each with its own hash, hashing their
+ * challenges side by side.
+ * @return true if every proof is valid and false otherwise.
+ * @throws std::invalid_argument if the sizes differ.
+ */
+bool VerifyProofs(const std::vector<DLogS>& statements,
+                  std::vector<Hash>& hashes, const std::vector<DLogP>& proofs);
+
 /**
  * @brief Knowledge of equality of discrete log.
  *
@@ -65,7 +97,7 @@ struct DLogEqS {
 struct DLogEqP {
   Point T;
   Point K;
-  Scalar r;
+  PublicScalar r;
 };
 
 /**
@@ -86,6 +118,20 @@ DLogEqP CreateProof(const DLogEqS& statement, Hash& hash, const Scalar& w);
  */
 bool VerifyProof(const DLogEqS& statement, Hash& hash, const DLogEqP& proof);
 
+/**
+ * @brief Like CreateProofs for DLog statements, for DLogEq statements.
+ */
+std::vector<DLogEqP> CreateProofs(const std::vector<DLogEqS>& statements,
+                                  std::vector<Hash>& hashes,
+                                  const ScalarVec& ws);
+
+/**
+ * @brief Like VerifyProofs for DLog statements, for DLogEq statements.
+ */
+bool VerifyProofs(const std::vector<DLogEqS>& statements,
+                  std::vector<Hash>& hashes,
+                  const std::vector<DLogEqP>& proofs);
+
 /*
  * The next part of the header contains definitions of the sub-proofs needed to
  * construct proofs of correctness a shuffle. These two proofs are
@@ -119,10 +165,10 @@ struct ProductP {
   Point C0;
   Point C1;
   Point C2;
-  std::vector<Scalar> as;
-  std::vector<Scalar> bs;
-  Scalar r;
-  Scalar s;
+  PublicScalarVec as;
+  PublicScalarVec bs;
+  PublicScalar r;
+  PublicScalar s;
 };
 
 /**
@@ -135,7 +181,7 @@ struct ProductP {
  * @return a proof.
  */
 ProductP CreateProof(const CommitKey& ck, Hash& hash, const ProductS& statement,
-                     const std::vector<Scalar>& w0, const Scalar& w1);
+                     const ScalarVec& w0, const Scalar& w1);
 
 /**
  * @brief Verify a product proof.
@@ -148,21 +194,30 @@ ProductP CreateProof(const CommitKey& ck, Hash& hash, const ProductS& statement,
 bool VerifyProof(const CommitKey& ck, Hash& hash, const ProductS& statement,
                  const ProductP& proof);
 
+/**
+ * @brief A multiexp statement. It borrows the ciphertexts instead of copying
+ * them, so it must not outlive them.
+ *
+ * If the caller's transcript has already bound Es (see Transcript::Bind),
+ * Es_digest points to its digest, and the challenge absorbs that instead of
+ * hashing Es again.
+ */
 struct MultiExpS {
-  std::vector<Ctxt> Es;
+  const CtxtVector& Es;
   Ctxt E;
   Point C;
+  const Digest* Es_digest = nullptr;
 };
 
 struct MultiExpP {
   Point C0;
   Point C1;
   Ctxt E;
-  std::vector<Scalar> a;
-  Scalar r;
-  Scalar b;
-  Scalar s;
-  Scalar t;
+  PublicScalarVec a;
+  PublicScalar r;
+  PublicScalar b;
+  PublicScalar s;
+  PublicScalar t;
 };
 
 /**
@@ -177,7 +232,7 @@ struct MultiExpP {
  * @return a proof.
  */
 MultiExpP CreateProof(const CommitKey& ck, const PublicKey& pk, Hash& hash,
-                      const MultiExpS& statement, const std::vector<Scalar>& w0,
+                      const MultiExpS& statement, const ScalarVec& w0,
                       const Scalar& w1, const Scalar& w2);
 
 /**
@@ -1,5 +1,7 @@
 #include <catch2/catch.hpp>
 
+#include <algorithm>
+
 #include "curve.h"
 
 TEST_CASE("point") {
@@ -35,6 +37,32 @@ TEST_CASE("point") {
     REQUIRE(p * x == x * p);
     REQUIRE((p * x) * y == (p * y) * x);
   }
+
+  SECTION("public scalar mul") {
+    shf::Point p = shf::Point::CreateRandom();
+    shf::Scalar x = shf::Scalar::CreateRandom();
+    shf::PublicScalar px(x);
+    REQUIRE(p * px == p * x);
+    REQUIRE(px * p == p.MulVartime(px));
+    REQUIRE(shf::Point::MulGenerator(px) == shf::Point::MulGenerator(x));
+    REQUIRE((p * shf::PublicScalar()).IsInfinity());
+  }
+
+  SECTION("mul add") {
+    shf::Point p = shf::Point::CreateRandom();
+    shf::Point q = shf::Point::CreateRandom();
+    shf::Scalar x = shf::Scalar::CreateRandom();
+    shf::Scalar y = shf::Scalar::CreateRandom();
+    shf::PublicScalar px(x), py(y);
+    REQUIRE(shf::Point::MulAdd2(x, p, y, q) == p * x + q * y);
+    REQUIRE(shf::Point::MulAdd2(px, p, py, q) == p * x + q * y);
+    REQUIRE(shf::Point::MulAdd2(x, p, x, p) == p * (x + x));
+    REQUIRE(shf::Point::MulAdd2(px, p, px, p) == p * (x + x));
+    REQUIRE(shf::Point::MulAdd2(x, p, -x, p).IsInfinity());
+    REQUIRE(shf::Point::MulAdd2(px, p, shf::PublicScalar(-x), p).IsInfinity());
+    REQUIRE(shf::Point::MulAdd2(x, p, y, shf::Point()) == p * x);
+    REQUIRE(shf::Point::MulAdd2(px, shf::Point(), py, q) == q * y);
+  }
 }
 
 TEST_CASE("scalar") {
@@ -54,4 +82,127 @@ TEST_CASE("scalar") {
     shf::Scalar two = shf::Scalar::CreateFromInt(2);
     REQUIRE(a + a == two * a);
   }
+
+  SECTION("subtract") {
+    shf::Scalar a = shf::Scalar::CreateRandom();
+    shf::Scalar b = shf::Scalar::CreateRandom();
+    REQUIRE(a - b == -(b - a));
+    REQUIRE((a - a).IsZero());
+    const auto diff = a - b;
+    a -= b;
+    REQUIRE(a == diff);
+  }
+
+  SECTION("read write") {
+    // n - 1 and n, big-endian.
+    uint8_t bytes[32] = {0xFF, 0xFF, 0xFF, 0xFF, 0x00, 0x00, 0x00, 0x00,
+                         0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+                         0xBC, 0xE6, 0xFA, 0xAD, 0xA7, 0x17, 0x9E, 0x84,
+                         0xF3, 0xB9, 0xCA, 0xC2, 0xFC, 0x63, 0x25, 0x50};
+    const shf::Scalar m = shf::Scalar::Read(bytes);
+    REQUIRE(m == -shf::Scalar::CreateFromInt(1));
+    uint8_t out[32];
+    m.Write(out);
+    REQUIRE(std::equal(bytes, bytes + 32, out));
+    bytes[31] = 0x51;
+    REQUIRE(shf::Scalar::Read(bytes).IsZero());
+  }
+
+  SECTION("matches relic") {
+    bn_t n, x, y, z;
+    bn_new(n);
+    bn_new(x);
+    bn_new(y);
+    bn_new(z);
+    ec_curve_get_ord(n);
+    for (int i = 0; i < 10; ++i) {
+      const shf::Scalar a = shf::Scalar::CreateRandom();
+      const shf::Scalar b = shf::Scalar::CreateRandom();
+      uint8_t bytes[32];
+      a.Write(bytes);
+      bn_read_bin(x, bytes, 32);
+      b.Write(bytes);
+      bn_read_bin(y, bytes, 32);
+
+      uint8_t expected[32], actual[32];
+      bn_mul(z, x, y);
+      bn_mod(z, z, n);
+      bn_write_bin(expected, 32, z);
+      (a * b).Write(actual);
+      REQUIRE(std::equal(expected, expected + 32, actual));
+
+      bn_add(z, x, y);
+      bn_mod(z, z, n);
+      bn_write_bin(expected, 32, z);
+      (a + b).Write(actual);
+      REQUIRE(std::equal(expected, expected + 32, actual));
+    }
+    bn_free(n);
+    bn_free(x);
+    bn_free(y);
+    bn_free(z);
+  }
+
+  SECTION("random batch") {
+    uint8_t seed[shf::Prg::SeedSize()] = {1, 2, 3};
+    shf::Prg prg0(seed);
+    shf::Prg prg1(seed);
+    const auto a = shf::Scalar::CreateRandomBatch(100, prg0);
+    const auto b = shf::Scalar::CreateRandomBatch(100, prg1);
+    REQUIRE(a.size() == 100);
+    REQUIRE(a == b);
+    REQUIRE(a[0] != a[1]);
+    REQUIRE(shf::Scalar::CreateRandomBatch(100, prg0) != a);
+
+    const auto c = shf::Scalar::CreateRandomBatch(3);
+    const auto d = shf::Scalar::CreateRandomBatch(3);
+    REQUIRE(c != d);
+    REQUIRE(shf::Scalar::CreateRandomBatch(0).empty());
+  }
+}
+
+TEST_CASE("generator") {
+  shf::CurveInit();
+
+  shf::Scalar x = shf::Scalar::CreateRandom();
+  REQUIRE(shf::Point::MulGenerator(x) == shf::Point::Generator() * x);
+}
+
+TEST_CASE("normalize batch") {
+  shf::CurveInit();
+
+  std::vector<shf::Point> points;
+  for (std::size_t i = 0; i < 20; ++i) {
+    // sums are left in Jacobian coordinates.
+    points.emplace_back(shf::Point::CreateRandom() + shf::Point::CreateRandom());
+    if (i % 7 == 0) points.emplace_back(shf::Point());
+    if (i % 5 == 0) points.emplace_back(shf::Point::CreateRandom());
+  }
+  const auto copy = points;
+  shf::NormalizeBatch(points);
+
+  uint8_t a[64], b[64];
+  for (std::size_t i = 0; i < points.size(); ++i) {
+    REQUIRE(points[i] == copy[i]);
+    points[i].Write(a);
+    copy[i].Write(b);
+    REQUIRE(std::equal(a, a + shf::Point::ByteSize(), b));
+  }
+}
+
+TEST_CASE("affine point vector") {
+  shf::CurveInit();
+
+  std::vector<shf::Point> points;
+  for (std::size_t i = 0; i < 10; ++i) {
+    points.emplace_back(shf::Point::CreateRandom() + shf::Point::CreateRandom());
+    if (i % 4 == 0) points.emplace_back(shf::Point());
+  }
+
+  const shf::AffinePointVec affine(points);
+  REQUIRE(affine.Size() == points.size());
+  REQUIRE(affine.ByteSize() == 64 * points.size());
+  for (std::size_t i = 0; i < points.size(); ++i) REQUIRE(affine[i] == points[i]);
+  REQUIRE(affine.ToPoints() == points);
+  REQUIRE(affine[1].IsInfinity());
 }
@@ -1,6 +1,12 @@
 #include <catch2/catch.hpp>
 
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
 #include "hash.h"
+#include "prg.h"
 
 static const shf::Digest SHA3_256_empty = {
     0xa7, 0xff, 0xc6, 0xf8, 0xbf, 0x1e, 0xd7, 0x66, 0x51, 0xc1, 0x47,
@@ -17,6 +23,24 @@ static const shf::Digest SHA3_256_0xa3_200_times = {
     0x6e, 0x83, 0x24, 0xaf, 0xbf, 0xd4, 0x6c, 0xfd, 0x81, 0xb2, 0x2e,
     0x39, 0x73, 0xc6, 0x5f, 0xa1, 0xbd, 0x9d, 0xe3, 0x17, 0x87};
 
+static const shf::Digest SHA3_256_0_to_199 = {
+    0x5f, 0x72, 0x8f, 0x63, 0xbf, 0x5e, 0xe4, 0x8c, 0x77, 0xf4, 0x53,
+    0xc0, 0x49, 0x03, 0x98, 0xfa, 0x64, 0x5b, 0x8d, 0x4c, 0x4e, 0x56,
+    0xbe, 0x9a, 0x41, 0xcf, 0xec, 0x34, 0x4d, 0x6c, 0xa8, 0x99};
+
+// 0 to 199 through Hash::Legacy, i.e. SHA3-256 of every word w turned into
+// w[0] w[1] w[1] w[1] w[1] w[1] w[1] w[1].
+static const shf::Digest Legacy_0_to_199 = {
+    0xfa, 0x1c, 0x1f, 0x74, 0x74, 0x4d, 0x41, 0xb7, 0xf3, 0x35, 0x91,
+    0xf5, 0xbc, 0x76, 0x63, 0x11, 0xca, 0xa2, 0x71, 0x49, 0x75, 0x8b,
+    0xa4, 0x60, 0xc4, 0xac, 0xf6, 0x89, 0xc9, 0xa7, 0x91, 0x29};
+
+// bytes 7i + 3 for i from 0 to 999.
+static const shf::Digest SHA3_256_7i_plus_3 = {
+    0xbd, 0x8b, 0x4d, 0x76, 0x04, 0x1e, 0x01, 0x35, 0xe5, 0x3f, 0xab,
+    0x1a, 0xaf, 0x42, 0x5c, 0x7b, 0x1c, 0x12, 0x9d, 0x88, 0x78, 0xff,
+    0xb6, 0x4c, 0xc3, 0x12, 0x30, 0xcc, 0xaf, 0xd7, 0xdc, 0x7c};
+
 TEST_CASE("hash") {
   SECTION("SHA3-256 empty") {
     shf::Hash hash;
@@ -44,6 +68,29 @@ TEST_CASE("hash") {
     REQUIRE(shf::DigestEquals(hash.Finalize(), SHA3_256_0xa3_200_times));
   }
 
+  SECTION("distinct bytes") {
+    uint8_t bytes[200];
+    for (std::size_t i = 0; i < 200; ++i) bytes[i] = i;
+    REQUIRE(shf::DigestEquals(shf::Hash().Update(bytes, 200).Finalize(),
+                              SHA3_256_0_to_199));
+    REQUIRE(shf::DigestEquals(shf::Hash::Legacy().Update(bytes, 200).Finalize(),
+                              Legacy_0_to_199));
+  }
+
+  SECTION("uneven pieces") {
+    // crosses lane and block boundaries both inside and between calls.
+    uint8_t bytes[1000];
+    for (std::size_t i = 0; i < 1000; ++i) bytes[i] = 7 * i + 3;
+    shf::Hash hash;
+    std::size_t offset = 0;
+    for (std::size_t n : {1, 7, 13, 136, 3, 300, 140}) {
+      hash.Update(bytes + offset, n);
+      offset += n;
+    }
+    hash.Update(bytes + offset, 1000 - offset);
+    REQUIRE(shf::DigestEquals(hash.Finalize(), SHA3_256_7i_plus_3));
+  }
+
   SECTION("can copy state") {
     shf::Hash hash;
     hash.Update((const unsigned char *)"abc", 3);
@@ -56,3 +103,196 @@ TEST_CASE("hash") {
     REQUIRE(!shf::DigestEquals(copy.Finalize(), SHA3_256_abc));
   }
 }
+
+TEST_CASE("hash many") {
+  // eight fresh hashes, four with one prefix and one with another go through
+  // the 8-, 4- and 1-lane kernels.
+  const std::size_t n = 13;
+  const std::size_t m = 300;
+  std::vector<uint8_t> bytes(n * m);
+  for (std::size_t i = 0; i < bytes.size(); ++i) bytes[i] = 7 * i + 3;
+
+  std::vector<shf::Hash> many(n), one(n);
+  for (std::size_t i = 8; i < n; ++i) {
+    const std::size_t prefix = i < 12 ? 5 : 9;
+    many[i].Update(bytes.data(), prefix);
+    one[i].Update(bytes.data(), prefix);
+  }
+  std::vector<shf::Hash*> ptrs;
+  std::vector<const uint8_t*> data;
+  for (std::size_t i = 0; i < n; ++i) {
+    ptrs.push_back(&many[i]);
+    data.push_back(bytes.data() + i * m);
+  }
+  shf::Hash::UpdateMany(ptrs.data(), data.data(), m, n);
+  std::vector<shf::Digest> digests(n);
+  shf::Hash::FinalizeMany(digests.data(), ptrs.data(), n);
+
+  for (std::size_t i = 0; i < n; ++i) {
+    one[i].Update(data[i], m);
+    REQUIRE(shf::DigestEquals(digests[i], one[i].Finalize()));
+  }
+}
+
+TEST_CASE("hash points") {
+  shf::CurveInit();
+
+  std::vector<shf::Ctxt> ctxts;
+  for (std::size_t i = 0; i < 700; ++i)
+    ctxts.push_back({shf::Point::CreateRandom() + shf::Point::CreateRandom(),
+                     i % 100 ? shf::Point::CreateRandom() : shf::Point()});
+
+  shf::Hash one_by_one, batched;
+  for (const auto& E : ctxts) one_by_one.Update(E.U).Update(E.V);
+  batched.Update(ctxts);
+  const auto digest = one_by_one.Finalize();
+  REQUIRE(shf::DigestEquals(digest, batched.Finalize()));
+
+  shf::Hash columns;
+  columns.Update(shf::CtxtVector(ctxts));
+  REQUIRE(shf::DigestEquals(digest, columns.Finalize()));
+
+  std::vector<shf::Point> points;
+  for (const auto& E : ctxts) points.push_back(E.U);
+  shf::Hash a, b;
+  for (const auto& p : points) a.Update(p);
+  b.Update(points);
+  REQUIRE(shf::DigestEquals(a.Finalize(), b.Finalize()));
+}
+
+TEST_CASE("transcript") {
+  shf::CurveInit();
+
+  std::vector<shf::Ctxt> ctxts;
+  for (std::size_t i = 0; i < 10; ++i)
+    ctxts.push_back({shf::Point::CreateRandom(), shf::Point::CreateRandom()});
+  const shf::CtxtVector Es(ctxts);
+
+  SECTION("the hash must be fresh") {
+    for (const auto version :
+         {shf::TranscriptVersion::kV1, shf::TranscriptVersion::kV2}) {
+      shf::Hash used;
+      const uint8_t byte = 1;
+      used.Update(&byte, 1);
+      REQUIRE_THROWS_AS(shf::Transcript(used, version), std::invalid_argument);
+    }
+  }
+
+  SECTION("v1 hashes the vector") {
+    shf::Hash a, b = shf::Hash::Legacy();
+    shf::Transcript transcript(a, shf::TranscriptVersion::kV1);
+    REQUIRE(transcript.Bind(Es) == nullptr);
+    b.Update(Es);
+    REQUIRE(shf::DigestEquals(a.Finalize(), b.Finalize()));
+  }
+
+  SECTION("v2 absorbs the digest") {
+    shf::Hash a, b;
+    shf::Transcript transcript(a, shf::TranscriptVersion::kV2);
+    const shf::Digest* d = transcript.Bind(Es);
+    REQUIRE(d != nullptr);
+    REQUIRE(shf::DigestEquals(*d, shf::Hash().Update(Es).Finalize()));
+
+    const uint8_t tag = 2;
+    b.Update(&tag, 1).Update(d->data(), d->size());
+    REQUIRE(shf::DigestEquals(a.Finalize(), b.Finalize()));
+  }
+
+  SECTION("v3 absorbs the tree digest") {
+    shf::Hash a, b;
+    shf::Transcript transcript(a, shf::TranscriptVersion::kV3);
+    const shf::Digest* d = transcript.Bind(Es);
+    REQUIRE(d != nullptr);
+    REQUIRE(shf::DigestEquals(*d, shf::TreeDigest(Es)));
+
+    const uint8_t tag = 3;
+    b.Update(&tag, 1).Update(d->data(), d->size());
+    REQUIRE(shf::DigestEquals(a.Finalize(), b.Finalize()));
+  }
+
+  SECTION("tree digest") {
+    // chunk 1 gives a group of eight leaves and a group of two, chunk 3 three
+    // full leaves and a short one.
+    for (std::size_t chunk : {1, 3, 10, 64}) {
+      shf::Hash root;
+      uint8_t header[17] = {1, 10, 0, 0, 0, 0, 0, 0, 0};
+      header[9] = static_cast<uint8_t>(chunk);
+      root.Update(header, sizeof(header));
+      for (std::size_t i = 0; i < ctxts.size(); i += chunk) {
+        const auto end = ctxts.begin() + std::min(ctxts.size(), i + chunk);
+        const std::vector<shf::Ctxt> leaf(ctxts.begin() + i, end);
+        const uint8_t tag = 0;
+        const auto d = shf::Hash().Update(&tag, 1).Update(leaf).Finalize();
+        root.Update(d.data(), d.size());
+      }
+      REQUIRE(shf::DigestEquals(shf::TreeDigest(Es, chunk), root.Finalize()));
+    }
+    REQUIRE(!shf::DigestEquals(shf::TreeDigest(Es, 3), shf::TreeDigest(Es, 4)));
+    REQUIRE_THROWS_AS(shf::TreeDigest(Es, 0), std::invalid_argument);
+  }
+}
+
+TEST_CASE("prg") {
+  // AES-128 under the all-zero key of the first two counter blocks.
+  const std::vector<uint8_t> expected = {
+      0x77, 0x27, 0xa8, 0x00, 0x4e, 0xa0, 0xc9, 0x70, 0x84, 0x41, 0x89,
+      0x3d, 0x28, 0x08, 0xca, 0x94, 0x57, 0x0f, 0xee, 0xbd, 0xca, 0x7b,
+      0x0c, 0x8e, 0xf0, 0x44, 0xa2, 0xdc, 0x19, 0xfd, 0x88, 0x03};
+  shf::Prg prg;
+  std::vector<uint8_t> out(32);
+  prg.Fill(out.data(), out.size());
+  REQUIRE(out == expected);
+
+  // bulk fills, which take the pipelined paths, match one block at a time.
+  const uint8_t seed[shf::Prg::SeedSize()] = {1, 2, 3};
+  for (std::size_t n : {16, 112, 128, 272, 4096 + 48}) {
+    shf::Prg bulk(seed);
+    shf::Prg blocks(seed);
+    std::vector<uint8_t> a(n), b(n);
+    bulk.Fill(a.data(), n);
+    for (std::size_t i = 0; i < n; i += shf::Prg::BlockSize())
+      blocks.Fill(b.data() + i, shf::Prg::BlockSize());
+    REQUIRE(a == b);
+  }
+
+  // a partial block uses up its counter.
+  shf::Prg partial(seed);
+  shf::Prg whole(seed);
+  std::vector<uint8_t> a(20), b(32), c(16), d(16);
+  partial.Fill(a.data(), a.size());
+  partial.Fill(c.data(), c.size());
+  whole.Fill(b.data(), b.size());
+  whole.Fill(d.data(), d.size());
+  REQUIRE(std::equal(a.begin(), a.end(), b.begin()));
+  REQUIRE(c == d);
+
+  std::vector<uint64_t> words(5);
+  shf::Prg typed(seed);
+  typed.Fill(words);
+  shf::Prg bytes(seed);
+  std::vector<uint8_t> raw(40);
+  bytes.Fill(raw.data(), raw.size());
+  REQUIRE(std::memcmp(words.data(), raw.data(), raw.size()) == 0);
+}
+
+TEST_CASE("prg fork") {
+  const uint8_t seed[shf::Prg::SeedSize()] = {4, 5, 6};
+  shf::Prg prg(seed);
+  std::vector<uint8_t> a(64), b(64), c(64), d(64);
+  prg.Fork(1).Fill(a.data(), a.size());
+  prg.Fill(d.data(), d.size());
+  // reading from the parent does not change its forks.
+  prg.Fork(1).Fill(b.data(), b.size());
+  REQUIRE(a == b);
+  prg.Fork(2).Fill(c.data(), c.size());
+  REQUIRE(a != c);
+  REQUIRE(a != d);
+
+  // forks of forks are streams of their own too.
+  prg.Fork(1).Fork(1).Fill(b.data(), b.size());
+  REQUIRE(a != b);
+
+  const uint8_t other[shf::Prg::SeedSize()] = {4, 5, 7};
+  shf::Prg(other).Fork(1).Fill(b.data(), b.size());
+  REQUIRE(a != b);
+}
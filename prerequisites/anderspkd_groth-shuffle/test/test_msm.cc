@@ -0,0 +1,268 @@
+#include <catch2/catch.hpp>
+#include <vector>
+
+#include "commit.h"
+#include "msm.h"
+
+static shf::Point NaiveMultiExp(const std::vector<shf::Point>& bases,
+                                const std::vector<shf::Scalar>& scalars) {
+  shf::Point r;
+  for (std::size_t i = 0; i < scalars.size(); ++i) r += bases[i] * scalars[i];
+  return r;
+}
+
+TEST_CASE("msm") {
+  shf::CurveInit();
+
+  SECTION("matches naive") {
+    for (std::size_t n : {1, 3, 4, 31, 32, 100}) {
+      std::vector<shf::Point> bases;
+      std::vector<shf::Scalar> scalars;
+      for (std::size_t i = 0; i < n; ++i) {
+        bases.emplace_back(shf::Point::CreateRandom());
+        scalars.emplace_back(shf::Scalar::CreateRandom());
+      }
+      // affine infinity must survive negation in the bucket loop.
+      if (n > 3) bases[3] = shf::Point();
+      const auto expected = NaiveMultiExp(bases, scalars);
+      REQUIRE(shf::MultiExp(bases, scalars) == expected);
+      REQUIRE(shf::MultiExp(shf::AffinePointVec(bases), scalars) == expected);
+      const shf::PublicScalarVec public_scalars(scalars.begin(), scalars.end());
+      REQUIRE(shf::MultiExp(bases, public_scalars) == expected);
+      REQUIRE(shf::MultiExp(shf::AffinePointVec(bases), public_scalars) ==
+              expected);
+    }
+  }
+
+  SECTION("edge scalars") {
+    const std::size_t n = 40;
+    std::vector<shf::Point> bases;
+    std::vector<shf::Scalar> scalars;
+    const shf::Scalar minus_one = -shf::Scalar::CreateFromInt(1);
+    for (std::size_t i = 0; i < n; ++i) {
+      bases.emplace_back(shf::Point::CreateRandom());
+      if (i % 3 == 0)
+        scalars.emplace_back(shf::Scalar());
+      else if (i % 3 == 1)
+        scalars.emplace_back(minus_one);
+      else
+        scalars.emplace_back(shf::Scalar::CreateFromInt(i));
+    }
+    REQUIRE(shf::MultiExp(bases, scalars) == NaiveMultiExp(bases, scalars));
+    REQUIRE(shf::MultiExp(bases, shf::PublicScalarVec(scalars.begin(),
+                                                      scalars.end())) ==
+            NaiveMultiExp(bases, scalars));
+  }
+
+  SECTION("repeated bases") {
+    // sums then meet points equal to, or the negation of, what they hold.
+    const shf::Point P = shf::Point::CreateRandom();
+    std::vector<shf::Point> bases(300, P);
+    std::vector<shf::Scalar> scalars;
+    for (std::size_t i = 0; i < bases.size(); ++i)
+      scalars.emplace_back(i % 2 ? shf::Scalar::CreateFromInt(1)
+                                 : -shf::Scalar::CreateFromInt(1));
+    REQUIRE(shf::MultiExp(bases, scalars).IsInfinity());
+    scalars[0] = shf::Scalar::CreateFromInt(5);
+    REQUIRE(shf::MultiExp(bases, scalars) ==
+            P * shf::Scalar::CreateFromInt(6));
+  }
+
+  SECTION("uses a prefix of the bases") {
+    std::vector<shf::Point> bases;
+    std::vector<shf::Scalar> scalars;
+    for (std::size_t i = 0; i < 10; ++i) {
+      bases.emplace_back(shf::Point::CreateRandom());
+      if (i < 7) scalars.emplace_back(shf::Scalar::CreateRandom());
+    }
+    REQUIRE(shf::MultiExp(bases, scalars) == NaiveMultiExp(bases, scalars));
+    REQUIRE_THROWS(shf::MultiExp(std::vector<shf::Point>(3), scalars));
+  }
+}
+
+TEST_CASE("msm small scalars") {
+  shf::CurveInit();
+
+  for (std::size_t n : {2, 40, 300}) {
+    std::vector<shf::Point> bases;
+    std::vector<std::size_t> small;
+    std::vector<shf::Scalar> scalars;
+    for (std::size_t i = 0; i < n; ++i) {
+      bases.emplace_back(shf::Point::CreateRandom());
+      small.emplace_back((i * 7919) % (n + 5));
+      scalars.emplace_back(shf::Scalar::CreateFromInt(small.back()));
+    }
+    REQUIRE(shf::MultiExpSmall(bases, small) == NaiveMultiExp(bases, scalars));
+    const std::vector<uint32_t> compact(small.begin(), small.end());
+    REQUIRE(shf::MultiExpSmall(bases, compact) == NaiveMultiExp(bases, scalars));
+  }
+
+  std::vector<shf::Point> bases(40, shf::Point::CreateRandom());
+  REQUIRE(shf::MultiExpSmall(bases, std::vector<std::size_t>(40)).IsInfinity());
+  const std::vector<std::size_t> largest = {0xFFFFFFFF, 1, 2, 3, 4};
+  REQUIRE(shf::MultiExpSmall(bases, largest) ==
+          bases[0] * (shf::Scalar::CreateFromInt(0xFFFFFFFF) +
+                      shf::Scalar::CreateFromInt(10)));
+  const std::vector<std::size_t> too_large = {std::size_t(1) << 32, 1, 2, 3, 4};
+  REQUIRE_THROWS_AS(shf::MultiExpSmall(bases, too_large),
+                    std::invalid_argument);
+
+  shf::CommitKey ck = shf::CreateCommitKey(40);
+  const shf::Scalar r = shf::Scalar::CreateRandom();
+  std::vector<std::size_t> p(40);
+  std::vector<shf::Scalar> m;
+  for (std::size_t i = 0; i < p.size(); ++i) {
+    p[i] = p.size() - 1 - i;
+    m.emplace_back(shf::Scalar::CreateFromInt(p[i]));
+  }
+  REQUIRE(shf::Commit(ck, r, p) == shf::Commit(ck, r, m));
+  const auto Ca = shf::Commit(ck, p);
+  REQUIRE(shf::CheckCommitment(ck, Ca.C, Ca.r, m));
+}
+
+TEST_CASE("msm columns") {
+  shf::CurveInit();
+
+  const std::size_t n = 50;
+  std::vector<shf::Point> G, H;
+  std::vector<shf::Scalar> scalars;
+  for (std::size_t i = 0; i < n; ++i) {
+    G.emplace_back(shf::Point::CreateRandom());
+    H.emplace_back(shf::Point::CreateRandom());
+    scalars.emplace_back(shf::Scalar::CreateRandom());
+  }
+
+  const auto R = shf::MultiExp({G, H}, scalars);
+  REQUIRE(R.size() == 2);
+  REQUIRE(R[0] == NaiveMultiExp(G, scalars));
+  REQUIRE(R[1] == NaiveMultiExp(H, scalars));
+}
+
+TEST_CASE("sum points") {
+  shf::CurveInit();
+
+  for (std::size_t n : {0, 5, 16, 17, 1500}) {
+    std::vector<shf::Point> points;
+    for (std::size_t i = 0; i < n; ++i)
+      points.emplace_back(shf::Point::CreateRandom());
+    if (n > 3) {
+      points[1] = points[0];
+      points[2] = shf::Point();
+      points[n - 1] = -points[n - 2];
+    }
+    shf::Point expected;
+    for (const auto& p : points) expected += p;
+    REQUIRE(shf::SumPoints(points) == expected);
+    REQUIRE(shf::SumPoints(shf::AffinePointVec(points)) == expected);
+  }
+}
+
+TEST_CASE("fixed base") {
+  shf::CurveInit();
+
+  SECTION("point") {
+    const shf::Point P = shf::Point::CreateRandom();
+    for (std::size_t width : {1, 4, 8}) {
+      const shf::FixedBasePoint table(P, width);
+      const shf::Scalar s = shf::Scalar::CreateRandom();
+      REQUIRE(table.Mul(s) == P * s);
+      REQUIRE(table.Mul(-shf::Scalar::CreateFromInt(1)) == -P);
+      REQUIRE(table.Mul(shf::Scalar()).IsInfinity());
+      REQUIRE(table.Mul(shf::PublicScalar(s)) == P * s);
+      REQUIRE(table.Mul(shf::PublicScalar()).IsInfinity());
+    }
+  }
+
+  SECTION("mul many") {
+    const shf::Point P = shf::Point::CreateRandom();
+    const shf::FixedBasePoint table(P, 6);
+    std::vector<shf::Scalar> scalars;
+    for (std::size_t i = 0; i < 13; ++i)
+      scalars.emplace_back(shf::Scalar::CreateRandom());
+    scalars[4] = shf::Scalar();
+    scalars[9] = -shf::Scalar::CreateFromInt(1);
+    std::vector<shf::Point> out(scalars.size());
+    table.MulMany(scalars.data(), out.data(), scalars.size());
+    for (std::size_t i = 0; i < scalars.size(); ++i)
+      REQUIRE(out[i] == P * scalars[i]);
+  }
+
+  SECTION("table") {
+    const std::size_t n = 60;
+    std::vector<shf::Point> bases;
+    std::vector<shf::Scalar> scalars;
+    for (std::size_t i = 0; i < n; ++i) {
+      bases.emplace_back(shf::Point::CreateRandom());
+      scalars.emplace_back(shf::Scalar::CreateRandom());
+    }
+    const shf::PublicScalarVec public_scalars(scalars.begin(), scalars.end());
+    for (std::size_t width : {2, 5, 9}) {
+      const shf::FixedBaseTable table(bases, width);
+      REQUIRE(table.MultiExp(public_scalars) == NaiveMultiExp(bases, scalars));
+      const std::vector<shf::Scalar> prefix(scalars.begin(),
+                                            scalars.begin() + 2);
+      REQUIRE(table.MultiExp(shf::PublicScalarVec(prefix.begin(),
+                                                  prefix.end())) ==
+              NaiveMultiExp(bases, prefix));
+    }
+  }
+}
+
+TEST_CASE("precomputed commit key") {
+  shf::CurveInit();
+
+  const std::size_t n = 40;
+  shf::CommitKey ck = shf::CreateCommitKey(n);
+  std::vector<shf::Scalar> m;
+  for (std::size_t i = 0; i < n; ++i)
+    m.emplace_back(shf::Scalar::CreateRandom());
+  const shf::Scalar r = shf::Scalar::CreateRandom();
+  const shf::Point C = shf::Commit(ck, r, m);
+
+  shf::CommitKey pck = ck;
+  shf::Precompute(pck, {6, 4, std::size_t(1) << 30});
+  REQUIRE(pck.precomputed->G.Size() == n);
+  REQUIRE(shf::Commit(pck, r, m) == C);
+  REQUIRE(shf::CheckCommitment(pck, C, r, m));
+  const shf::PublicScalarVec pm(m.begin(), m.end());
+  REQUIRE(shf::Commit(pck, shf::PublicScalar(r), pm) == C);
+
+  // the public version shares one pass between the table for G and Es, or
+  // falls back to a plain multiexp for very short inputs.
+  std::vector<shf::Point> U, V;
+  for (std::size_t i = 0; i < n; ++i) {
+    U.emplace_back(shf::Point::CreateRandom());
+    V.emplace_back(shf::Point::CreateRandom());
+  }
+  const shf::CtxtVector Es(U, V);
+  const auto expected = shf::CommitAndDot(ck, r, m, Es);
+  REQUIRE(expected.C == C);
+  for (std::size_t size : {n, std::size_t(1)}) {
+    const std::vector<shf::Scalar> prefix(m.begin(), m.begin() + size);
+    const auto secret = shf::CommitAndDot(pck, r, prefix, Es);
+    const auto pub = shf::CommitAndDot(
+        pck, shf::PublicScalar(r),
+        shf::PublicScalarVec(prefix.begin(), prefix.end()), Es);
+    REQUIRE(pub.C == secret.C);
+    REQUIRE(pub.E.U == secret.E.U);
+    REQUIRE(pub.E.V == secret.E.V);
+  }
+  REQUIRE(shf::CommitAndDot(pck, shf::PublicScalar(r), pm, Es).E.U ==
+          expected.E.U);
+
+  // by default only H gets a table.
+  shf::CommitKey def = ck;
+  shf::Precompute(def);
+  REQUIRE(def.precomputed->G.Size() == 0);
+  REQUIRE(!def.precomputed->H.Empty());
+  REQUIRE(shf::Commit(def, r, m) == C);
+  REQUIRE(shf::Commit(def, r, m[0]) ==
+          shf::Point::MulAdd2(m[0], ck.G[0], r, ck.H));
+  REQUIRE(shf::Commit(def, r, m[0]) == shf::Commit(ck, r, m[0]));
+
+  // a table that does not fit the budget is skipped.
+  shf::CommitKey small = ck;
+  shf::Precompute(small, {6, 4, 0});
+  REQUIRE(small.precomputed->G.Size() == 0);
+  REQUIRE(shf::Commit(small, r, m) == C);
+}
@@ -0,0 +1,377 @@
+#include <catch2/catch.hpp>
+
+#include <cstring>
+#include <vector>
+
+#include "backend.h"
+#include "curve.h"
+#include "p256_batch.h"
+
+using shf::P256Backend;
+using shf::RelicBackend;
+using shf::p256::Fe;
+
+namespace {
+
+struct Affine {
+  uint8_t x[32];
+  uint8_t y[32];
+
+  bool operator==(const Affine& o) const {
+    return std::memcmp(x, o.x, 32) == 0 && std::memcmp(y, o.y, 32) == 0;
+  };
+};
+
+template <typename B>
+Affine ToBytes(const typename B::Element& p) {
+  Affine a;
+  B::WriteAffine(a.x, a.y, p);
+  return a;
+}
+
+void RandomLimbs(uint64_t k[4]) { shf::Scalar::CreateRandom().GetLimbs(k); }
+
+}  // namespace
+
+TEST_CASE("p256 field") {
+  shf::CurveInit();
+
+  uint64_t k[4];
+  RandomLimbs(k);
+  const Fe a = Fe::FromInt(k[0]) * Fe::FromInt(k[1]) + Fe::FromInt(k[2]);
+  const Fe b = Fe::FromInt(k[3]);
+
+  REQUIRE(a * a.Invert() == Fe::One());
+  REQUIRE(a - a == Fe::Zero());
+  REQUIRE(a + (-a) == Fe::Zero());
+  REQUIRE((a + b) * (a - b) == a.Square() - b.Square());
+  REQUIRE(Fe::FromInt(2) == Fe::One().Double());
+
+  uint8_t bytes[32];
+  a.Write(bytes);
+  bool reduced = false;
+  REQUIRE(Fe::Read(bytes, &reduced) == a);
+  REQUIRE(reduced);
+
+  // p itself does not encode a reduced element.
+  const uint8_t p[32] = {0xFF, 0xFF, 0xFF, 0xFF, 0x00, 0x00, 0x00, 0x01,
+                         0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+                         0x00, 0x00, 0x00, 0x00, 0xFF, 0xFF, 0xFF, 0xFF,
+                         0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+  REQUIRE(Fe::Read(p, &reduced) == Fe::Zero());
+  REQUIRE_FALSE(reduced);
+}
+
+TEST_CASE("p256 matches relic") {
+  shf::CurveInit();
+
+  P256Backend::Element g;
+  RelicBackend::Element rg;
+  P256Backend::Generator(g);
+  RelicBackend::Generator(rg);
+  REQUIRE(ToBytes<P256Backend>(g) == ToBytes<RelicBackend>(rg));
+
+  SECTION("mul") {
+    for (int i = 0; i < 10; ++i) {
+      uint64_t k[4];
+      RandomLimbs(k);
+      P256Backend::Element p, q;
+      RelicBackend::Element rp, rq;
+      P256Backend::MulGenerator(p, k);
+      RelicBackend::MulGenerator(rp, k);
+      REQUIRE(ToBytes<P256Backend>(p) == ToBytes<RelicBackend>(rp));
+
+      P256Backend::Mul(q, p, k);
+      RelicBackend::Mul(rq, rp, k);
+      REQUIRE(ToBytes<P256Backend>(q) == ToBytes<RelicBackend>(rq));
+
+      P256Backend::Mul(q, g, k);
+      REQUIRE(P256Backend::Equal(q, p));
+    }
+  }
+
+  SECTION("add") {
+    uint64_t k[4], l[4];
+    RandomLimbs(k);
+    RandomLimbs(l);
+    P256Backend::Element p, q, r;
+    RelicBackend::Element rp, rq, rr;
+    P256Backend::Mul(p, g, k);
+    P256Backend::Mul(q, g, l);
+    RelicBackend::Mul(rp, rg, k);
+    RelicBackend::Mul(rq, rg, l);
+    // make both operands projective.
+    P256Backend::Double(p, p);
+    P256Backend::Double(q, q);
+    RelicBackend::Double(rp, rp);
+    RelicBackend::Double(rq, rq);
+
+    P256Backend::Add(r, p, q);
+    RelicBackend::Add(rr, rp, rq);
+    REQUIRE(ToBytes<P256Backend>(r) == ToBytes<RelicBackend>(rr));
+
+    P256Backend::Sub(r, p, q);
+    RelicBackend::Sub(rr, rp, rq);
+    REQUIRE(ToBytes<P256Backend>(r) == ToBytes<RelicBackend>(rr));
+
+    // P + P, P - P and mixed additions.
+    P256Backend::Add(r, p, p);
+    P256Backend::Double(q, p);
+    REQUIRE(P256Backend::Equal(r, q));
+    P256Backend::Sub(r, p, p);
+    REQUIRE(P256Backend::IsInfinity(r));
+    P256Backend::Element* ptrs[] = {&q};
+    P256Backend::NormalizeBatch(ptrs, 1);
+    REQUIRE(P256Backend::IsNormalized(q));
+    P256Backend::Add(r, p, q);
+    P256Backend::Element t;
+    P256Backend::Add(t, p, p);
+    P256Backend::Add(t, t, p);
+    REQUIRE(P256Backend::Equal(r, t));
+  }
+
+  SECTION("zero and order") {
+    uint64_t zero[4] = {0, 0, 0, 0};
+    uint64_t order[4] = {0xF3B9CAC2FC632551, 0xBCE6FAADA7179E84,
+                         0xFFFFFFFFFFFFFFFF, 0xFFFFFFFF00000000};
+    P256Backend::Element p;
+    P256Backend::MulGenerator(p, zero);
+    REQUIRE(P256Backend::IsInfinity(p));
+    P256Backend::MulGenerator(p, order);
+    REQUIRE(P256Backend::IsInfinity(p));
+    P256Backend::Mul(p, g, order);
+    REQUIRE(P256Backend::IsInfinity(p));
+  }
+
+  SECTION("vartime") {
+    uint64_t ks[5][4] = {{0, 0, 0, 0},
+                         {1, 0, 0, 0},
+                         {0x1F, 0, 0, 0},
+                         // n - 1
+                         {0xF3B9CAC2FC632550, 0xBCE6FAADA7179E84,
+                          0xFFFFFFFFFFFFFFFF, 0xFFFFFFFF00000000},
+                         {0, 0, 0, 0}};
+    RandomLimbs(ks[4]);
+    for (const auto& k : ks) {
+      P256Backend::Element p, q;
+      RelicBackend::Element rp, rq;
+      P256Backend::MulGenerator(p, k);
+      P256Backend::MulGeneratorVartime(q, k);
+      REQUIRE(P256Backend::Equal(p, q));
+      RelicBackend::MulGeneratorVartime(rp, k);
+      REQUIRE(ToBytes<P256Backend>(q) == ToBytes<RelicBackend>(rp));
+
+      P256Backend::Double(p, g);
+      P256Backend::Mul(q, p, k);
+      P256Backend::MulVartime(p, p, k);
+      REQUIRE(P256Backend::Equal(p, q));
+      RelicBackend::Double(rp, rg);
+      RelicBackend::MulVartime(rq, rp, k);
+      REQUIRE(ToBytes<P256Backend>(q) == ToBytes<RelicBackend>(rq));
+    }
+  }
+
+  SECTION("mul add") {
+    uint64_t k[4], l[4];
+    RandomLimbs(k);
+    RandomLimbs(l);
+    P256Backend::Element p, q, r, s;
+    RelicBackend::Element rp, rq, rr;
+    P256Backend::MulGenerator(p, k);
+    P256Backend::Double(q, g);
+    RelicBackend::MulGenerator(rp, k);
+    RelicBackend::Double(rq, rg);
+
+    P256Backend::MulAdd2(r, k, p, l, q);
+    P256Backend::MulAdd2Vartime(s, k, p, l, q);
+    REQUIRE(P256Backend::Equal(r, s));
+    RelicBackend::MulAdd2(rr, k, rp, l, rq);
+    REQUIRE(ToBytes<P256Backend>(r) == ToBytes<RelicBackend>(rr));
+    RelicBackend::MulAdd2Vartime(rr, k, rp, l, rq);
+    REQUIRE(ToBytes<P256Backend>(r) == ToBytes<RelicBackend>(rr));
+  }
+
+  SECTION("mul many") {
+    const std::size_t n = 70;
+    uint64_t k[4];
+    RandomLimbs(k);
+    std::vector<P256Backend::Element> ps(n), qs(n);
+    std::vector<RelicBackend::Element> rps(n), rqs(n);
+    for (std::size_t i = 0; i < n; ++i) {
+      uint64_t l[4];
+      RandomLimbs(l);
+      P256Backend::MulGenerator(ps[i], l);
+      RelicBackend::MulGenerator(rps[i], l);
+    }
+    P256Backend::Infinity(ps[3]);
+    RelicBackend::Infinity(rps[3]);
+    P256Backend::Double(ps[5], g);
+    RelicBackend::Double(rps[5], rg);
+
+    P256Backend::MulMany(qs.data(), k, ps.data(), n);
+    RelicBackend::MulMany(rqs.data(), k, rps.data(), n);
+    for (std::size_t i = 0; i < n; ++i) {
+      P256Backend::Element q;
+      P256Backend::Mul(q, ps[i], k);
+      REQUIRE(P256Backend::Equal(q, qs[i]));
+      REQUIRE(ToBytes<P256Backend>(qs[i]) == ToBytes<RelicBackend>(rqs[i]));
+    }
+
+    uint64_t zero[4] = {0, 0, 0, 0};
+    P256Backend::MulMany(ps.data(), zero, ps.data(), n);
+    for (const auto& p : ps) REQUIRE(P256Backend::IsInfinity(p));
+  }
+
+  SECTION("add affine batch") {
+    const std::size_t n = 8;
+    std::vector<P256Backend::Affine> a(n), b(n), r(n);
+    std::vector<RelicBackend::Affine> ra(n), rb(n), rr(n);
+    for (std::size_t i = 0; i < n; ++i) {
+      uint64_t k[4], l[4];
+      RandomLimbs(k);
+      RandomLimbs(l);
+      P256Backend::Element p, q;
+      RelicBackend::Element rp, rq;
+      P256Backend::MulGenerator(p, k);
+      P256Backend::MulGenerator(q, l);
+      RelicBackend::MulGenerator(rp, k);
+      RelicBackend::MulGenerator(rq, l);
+      // doubling, a sum at infinity and infinite operands.
+      if (i == 1) q = p, rq = rp;
+      if (i == 2) P256Backend::Negate(q, p), RelicBackend::Negate(rq, rp);
+      if (i == 3) P256Backend::Infinity(p), RelicBackend::Infinity(rp);
+      if (i == 4) P256Backend::Infinity(q), RelicBackend::Infinity(rq);
+      P256Backend::ToAffine(a[i], p);
+      P256Backend::ToAffine(b[i], q);
+      RelicBackend::ToAffine(ra[i], rp);
+      RelicBackend::ToAffine(rb[i], rq);
+    }
+
+    P256Backend::AddAffineBatch(r.data(), a.data(), b.data(), n);
+    RelicBackend::AddAffineBatch(rr.data(), ra.data(), rb.data(), n);
+    for (std::size_t i = 0; i < n; ++i) {
+      P256Backend::Element p, q, s;
+      RelicBackend::Element rs;
+      P256Backend::FromAffine(p, a[i]);
+      P256Backend::FromAffine(q, b[i]);
+      P256Backend::Add(s, p, q);
+      P256Backend::FromAffine(p, r[i]);
+      REQUIRE(P256Backend::Equal(p, s));
+      RelicBackend::FromAffine(rs, rr[i]);
+      REQUIRE(ToBytes<P256Backend>(p) == ToBytes<RelicBackend>(rs));
+    }
+    REQUIRE(P256Backend::IsInfinity(r[2]));
+
+    // in place, as SumPoints uses it.
+    P256Backend::AddAffineBatch(a.data(), a.data(), b.data(), n);
+    for (std::size_t i = 0; i < n; ++i) {
+      REQUIRE(a[i].x == r[i].x);
+      REQUIRE(a[i].y == r[i].y);
+    }
+  }
+
+  SECTION("compressed") {
+    for (int i = 0; i < 20; ++i) {
+      uint64_t k[4];
+      RandomLimbs(k);
+      P256Backend::Element p, q;
+      RelicBackend::Element rp;
+      P256Backend::MulGenerator(p, k);
+      RelicBackend::MulGenerator(rp, k);
+      uint8_t a[33], b[33];
+      P256Backend::WriteCompressed(a, p);
+      RelicBackend::WriteCompressed(b, rp);
+      REQUIRE(std::memcmp(a, b, 33) == 0);
+      REQUIRE(P256Backend::ReadCompressed(q, b));
+      REQUIRE(P256Backend::Equal(p, q));
+    }
+  }
+}
+
+TEST_CASE("p256 batch") {
+  shf::CurveInit();
+  namespace p256 = shf::p256;
+  constexpr std::size_t kLanes = p256::Batch::kLanes;
+  INFO(p256::BatchKernel());
+
+  p256::Jacobian ps[kLanes], qs[kLanes], expected[kLanes];
+  p256::Affine as[kLanes];
+  for (std::size_t i = 0; i < kLanes; ++i) {
+    uint64_t k[4];
+    RandomLimbs(k);
+    ps[i] = p256::Double(p256::MulGenerator(k));
+    RandomLimbs(k);
+    as[i] = p256::ToAffine(p256::MulGenerator(k));
+  }
+  // an infinity lane, a doubling lane and a lane that adds up to infinity.
+  ps[1] = p256::Infinity();
+  as[2] = p256::ToAffine(ps[2]);
+  as[3] = p256::ToAffine(p256::Negate(ps[3]));
+  const uint32_t skip = 1u << 5;
+
+  const p256::Jacobian* in[kLanes];
+  p256::Jacobian* out[kLanes];
+  for (std::size_t i = 0; i < kLanes; ++i) {
+    in[i] = &ps[i];
+    out[i] = &qs[i];
+  }
+
+  SECTION("add mixed") {
+    p256::Batch batch;
+    batch.Load(in);
+    batch.AddMixed(as, skip);
+    batch.Store(out);
+    for (std::size_t i = 0; i < kLanes; ++i) {
+      expected[i] = (skip >> i) & 1 ? ps[i] : p256::AddMixed(ps[i], as[i]);
+      REQUIRE(p256::Equal(qs[i], expected[i]));
+    }
+    REQUIRE(p256::IsInfinity(qs[3]));
+  }
+
+  SECTION("double") {
+    p256::Batch batch;
+    batch.Load(in);
+    batch.Double();
+    batch.Double();
+    batch.Store(out);
+    for (std::size_t i = 0; i < kLanes; ++i)
+      REQUIRE(p256::Equal(qs[i], p256::Double(p256::Double(ps[i]))));
+  }
+
+  SECTION("starts at infinity") {
+    p256::Batch batch;
+    batch.AddMixed(as, 0);
+    batch.Store(out);
+    for (std::size_t i = 0; i < kLanes; ++i)
+      REQUIRE(p256::Equal(qs[i], p256::FromAffine(as[i])));
+  }
+
+  SECTION("mul generator many") {
+    const std::size_t n = 11;
+    std::vector<uint64_t> ks(4 * n);
+    for (std::size_t i = 0; i < n; ++i) RandomLimbs(&ks[4 * i]);
+    ks[0] = ks[1] = ks[2] = ks[3] = 0;
+    std::vector<p256::Jacobian> rs(n);
+    p256::MulGeneratorMany(rs.data(), ks.data(), n);
+    for (std::size_t i = 0; i < n; ++i)
+      REQUIRE(p256::Equal(rs[i], p256::MulGenerator(&ks[4 * i])));
+  }
+}
+
+TEST_CASE("uncompressed points") {
+  shf::CurveInit();
+
+  const shf::Point p = shf::Point::CreateRandom();
+  uint8_t bytes[shf::Point::UncompressedByteSize()];
+  p.WriteUncompressed(bytes);
+  REQUIRE(bytes[0] == 0x04);
+  REQUIRE(shf::Point::ReadUncompressed(bytes) == p);
+
+  shf::Point inf;
+  inf.WriteUncompressed(bytes);
+  REQUIRE(shf::Point::ReadUncompressed(bytes).IsInfinity());
+
+  p.WriteUncompressed(bytes);
+  bytes[10] ^= 1;
+  REQUIRE_THROWS_AS(shf::Point::ReadUncompressed(bytes), std::invalid_argument);
+}
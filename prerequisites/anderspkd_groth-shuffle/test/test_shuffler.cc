@@ -1,11 +1,60 @@
 #define CATCH_CONFIG_ENABLE_BENCHMARKING
 #include <catch2/catch.hpp>
+#include <cstdint>
+#include <map>
 #include <vector>
 
 #include "shuffler.h"
 
 #define ENABLE_BENCHMARKS 0
 
+template <typename Index>
+static bool IsPermutation(const std::vector<Index>& p) {
+  std::vector<bool> seen(p.size());
+  for (const auto i : p) {
+    if (i >= p.size() || seen[i]) return false;
+    seen[i] = true;
+  }
+  return true;
+}
+
+TEST_CASE("permutation") {
+  const uint8_t seed[shf::Prg::SeedSize()] = {3};
+
+  // the largest size goes through MergeShuffle with a partial last run.
+  for (std::size_t n : {0, 1, 2, 1000, (1 << 22) + 12345}) {
+    shf::Prg prg0(seed), prg1(seed);
+    const auto p = shf::CreatePermutation(n, prg0);
+    const auto q = shf::CreateCompactPermutation(n, prg1);
+    REQUIRE(p.size() == n);
+    REQUIRE(IsPermutation(p));
+    REQUIRE(std::equal(p.begin(), p.end(), q.begin(), q.end()));
+  }
+
+  SECTION("uniform") {
+    // all 24 permutations of four elements should show up about 1000 times.
+    shf::Prg prg;
+    std::map<shf::Permutation, int> counts;
+    for (int i = 0; i < 24000; ++i) counts[shf::CreatePermutation(4, prg)]++;
+    REQUIRE(counts.size() == 24);
+    for (const auto& c : counts) {
+      REQUIRE(c.second > 850);
+      REQUIRE(c.second < 1150);
+    }
+  }
+
+  SECTION("permute") {
+    shf::Prg prg;
+    const auto p = shf::CreateCompactPermutation(100, prg);
+    std::vector<int> v(100);
+    for (int i = 0; i < 100; ++i) v[i] = 3 * i;
+    const auto pv = shf::Permute(v, p);
+    for (std::size_t i = 0; i < 100; ++i) REQUIRE(pv[i] == 3 * int(p[i]));
+    REQUIRE_THROWS_AS(shf::Permute(v, shf::CompactPermutation(99)),
+                      std::invalid_argument);
+  }
+}
+
 TEST_CASE("shuffle") {
   shf::CurveInit();
 
@@ -39,12 +88,12 @@ TEST_CASE("shuffle") {
 #endif
 
   auto shuffled = shuffle_proof.permuted;
-  REQUIRE(shuffled.size() == ctxts.size());
+  REQUIRE(shuffled.Size() == ctxts.size());
 
   // brute-force check that all permuted ciphertexts are also re-randomized.
   bool good = true;
   for (std::size_t i = 0; i < ctxts.size(); i++) {
-    for (std::size_t j = i + 1; j < shuffled.size(); j++) {
+    for (std::size_t j = i + 1; j < shuffled.Size(); j++) {
       good &= ctxts[i].V != shuffled[j].V;
       good &= ctxts[i].U != shuffled[j].U;
     }
@@ -61,4 +110,57 @@ TEST_CASE("shuffle") {
   };
 #endif
   REQUIRE(correct);
+
+  // a shuffler without a table for G proves and verifies the same way.
+  shf::Shuffler untabled(pk, ck, prg, shf::TranscriptVersion::kV2,
+                         {0, 8, 0});
+  shf::Hash hu;
+  const auto untabled_proof = untabled.Shuffle(ctxts, hu);
+  shf::Hash hu0, hu1;
+  REQUIRE(untabled.VerifyShuffle(ctxts, untabled_proof, hu0));
+  REQUIRE(shuffler.VerifyShuffle(ctxts, untabled_proof, hu1));
+}
+
+TEST_CASE("shuffle transcript versions") {
+  shf::CurveInit();
+
+  const std::size_t n = 40;
+  const auto ck = shf::CreateCommitKey(n);
+  const auto pk = shf::CreatePublicKey(shf::CreateSecretKey());
+
+  std::vector<shf::Ctxt> ctxts;
+  for (std::size_t i = 0; i < n; ++i)
+    ctxts.emplace_back(shf::Encrypt(pk, shf::Point::CreateRandom()));
+  const shf::CtxtVector Es(ctxts);
+
+  shf::Prg prg;
+  shf::Shuffler v1(pk, ck, prg, shf::TranscriptVersion::kV1);
+  shf::Shuffler v2(pk, ck, prg, shf::TranscriptVersion::kV2);
+
+  shf::Hash hp;
+  const auto proof = v2.Shuffle(Es, hp);
+  REQUIRE(proof.version == shf::TranscriptVersion::kV2);
+
+  shf::Hash hv;
+  REQUIRE(v2.VerifyShuffle(Es, proof, hv));
+
+  shf::Hash hp1, hv1;
+  const auto proof1 = v1.Shuffle(Es, hp1);
+  REQUIRE(proof1.version == shf::TranscriptVersion::kV1);
+  REQUIRE(v1.VerifyShuffle(Es, proof1, hv1));
+
+  // the verifier must use the prover's version.
+  shf::Hash hv2;
+  REQUIRE_FALSE(v1.VerifyShuffle(Es, proof, hv2));
+  shf::ShuffleP relabeled = proof;
+  relabeled.version = shf::TranscriptVersion::kV1;
+  shf::Hash hv3;
+  REQUIRE_FALSE(v1.VerifyShuffle(Es, relabeled, hv3));
+
+  shf::Shuffler v3(pk, ck, prg, shf::TranscriptVersion::kV3);
+  shf::Hash hp3, hv4, hv5;
+  const auto proof3 = v3.Shuffle(Es, hp3);
+  REQUIRE(proof3.version == shf::TranscriptVersion::kV3);
+  REQUIRE(v3.VerifyShuffle(Es, proof3, hv4));
+  REQUIRE_FALSE(v2.VerifyShuffle(Es, proof3, hv5));
 }
@@ -0,0 +1,114 @@
+#include <catch2/catch.hpp>
+
+#include <atomic>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "hash.h"
+#include "msm.h"
+#include "shuffler.h"
+#include "thread_pool.h"
+
+TEST_CASE("thread pool") {
+  shf::ThreadPool pool(4);
+  REQUIRE(pool.Size() == 4);
+  REQUIRE(pool.Parts(100, 30) == 3);
+  REQUIRE(pool.Parts(10, 30) == 1);
+  REQUIRE(pool.Parts(1000, 30) == 4);
+  REQUIRE_THROWS_AS(shf::ThreadPool(0), std::invalid_argument);
+
+  SECTION("parallel for") {
+    std::vector<std::atomic<int>> calls(1000);
+    pool.ParallelFor(calls.size(), [&](std::size_t i) { ++calls[i]; });
+    for (const auto& c : calls) REQUIRE(c == 1);
+  }
+
+  SECTION("nested") {
+    std::atomic<std::size_t> sum{0};
+    pool.ParallelFor(8, [&](std::size_t i) {
+      pool.ParallelFor(100, [&](std::size_t j) { sum += i * 100 + j; });
+    });
+    REQUIRE(sum == 800 * 799 / 2);
+  }
+
+  SECTION("reduce in order") {
+    const auto digits = pool.ParallelReduce(
+        10, std::string(), [](std::size_t i) { return std::to_string(i); },
+        [](std::string a, const std::string& b) { return a + b; });
+    REQUIRE(digits == "0123456789");
+  }
+
+  SECTION("exceptions") {
+    std::atomic<int> calls{0};
+    REQUIRE_THROWS_AS(pool.ParallelFor(100,
+                                       [&](std::size_t i) {
+                                         ++calls;
+                                         if (i == 17)
+                                           throw std::runtime_error("17");
+                                       }),
+                      std::runtime_error);
+    REQUIRE(calls == 100);
+  }
+}
+
+TEST_CASE("library on several threads") {
+  shf::CurveInit();
+
+  // sizes that split into several pieces of the library's parallel loops.
+  const std::size_t n = 3 * 4096 + 5;
+  const uint8_t seed[shf::Prg::SeedSize()] = {7};
+  const auto scalars = [&] {
+    shf::Prg prg(seed);
+    return shf::Scalar::CreateRandomBatch(n, prg);
+  };
+  const auto ck = shf::CreateCommitKey(n);
+  std::vector<shf::Ctxt> ctxts;
+  for (std::size_t i = 0; i < 100; ++i)
+    ctxts.push_back({shf::Point::CreateRandom(), shf::Point::CreateRandom()});
+  const shf::CtxtVector Es(ctxts);
+
+  const auto one = scalars();
+  const auto msm = shf::MultiExp(ck.G, one);
+  const auto sum = shf::SumPoints(ck.G);
+  const auto many = shf::MulMany(one[0], ck.G);
+  const auto tree = shf::TreeDigest(Es, 3);
+
+  shf::SetThreadCount(4);
+  REQUIRE(shf::DefaultThreadPool().Size() == 4);
+  const auto four = scalars();
+  REQUIRE(std::equal(one.begin(), one.end(), four.begin()));
+  REQUIRE(shf::MultiExp(ck.G, four) == msm);
+  REQUIRE(shf::SumPoints(ck.G) == sum);
+  REQUIRE(shf::MulMany(four[0], ck.G) == many);
+  REQUIRE(shf::DigestEquals(shf::TreeDigest(Es, 3), tree));
+
+  shf::CommitKey pre = ck;
+  shf::Precompute(pre, {0, 8, std::size_t(1) << 30});
+  REQUIRE(shf::Commit(pre, shf::Scalar(), four) ==
+          shf::Commit(ck, shf::Scalar(), one));
+
+  const auto pk = shf::CreatePublicKey(shf::CreateSecretKey());
+  shf::Prg prg;
+  shf::Shuffler shuffler(pk, shf::CreateCommitKey(Es.Size()), prg);
+  shf::Hash hp, hv;
+  const auto proof = shuffler.Shuffle(Es, hp);
+  REQUIRE(shuffler.VerifyShuffle(Es, proof, hv));
+
+  shf::SetThreadCount(1);
+  REQUIRE(shf::DefaultThreadPool().Size() == 1);
+}
+
+TEST_CASE("concurrent callers") {
+  std::vector<std::thread> threads;
+  std::vector<shf::Scalar> drawn(8);
+  for (std::size_t t = 0; t < drawn.size(); ++t)
+    threads.emplace_back([&, t] {
+      shf::CurveInit();
+      drawn[t] = shf::Scalar::CreateRandom();
+    });
+  for (auto& thread : threads) thread.join();
+  // each thread seeds its own generator.
+  for (std::size_t t = 1; t < drawn.size(); ++t) REQUIRE(drawn[t] != drawn[0]);
+}
@@ -1,6 +1,7 @@
 #include <catch2/catch.hpp>
 
 #include "curve.h"
+#include "shuffler.h"
 #include "zkp.h"
 
 TEST_CASE("dlog") {
@@ -26,10 +27,21 @@ TEST_CASE("dlog") {
     REQUIRE(!shf::DigestEquals(digest_zero, digest_prover));
 
     shf::DLogP bad_proof = {shf::Point::CreateRandom(),
-                           shf::Scalar::CreateRandom()};
+                           shf::PublicScalar(shf::Scalar::CreateRandom())};
     shf::Hash h;
     REQUIRE(!shf::VerifyProof(stmt, h, bad_proof));
   }
+
+  SECTION("legacy hash") {
+    shf::Scalar x = shf::Scalar::CreateRandom();
+    shf::DLogS stmt = {shf::Point::Generator(), x * shf::Point::Generator()};
+    shf::Hash hash_prover = shf::Hash::Legacy();
+    const auto proof = shf::CreateProof(stmt, hash_prover, x);
+    shf::Hash legacy = shf::Hash::Legacy();
+    REQUIRE(shf::VerifyProof(stmt, legacy, proof));
+    shf::Hash sha3;
+    REQUIRE(!shf::VerifyProof(stmt, sha3, proof));
+  }
 }
 
 TEST_CASE("dlogeq") {
@@ -55,6 +67,63 @@ TEST_CASE("dlogeq") {
   }
 }
 
+TEST_CASE("batch proofs") {
+  shf::CurveInit();
+
+  // enough proofs to fill the wide hash kernels and leave a remainder.
+  const std::size_t n = 11;
+  const auto xs = shf::Scalar::CreateRandomBatch(n);
+
+  SECTION("dlog") {
+    std::vector<shf::DLogS> stmts;
+    for (const auto& x : xs) {
+      const auto G = shf::Point::CreateRandom();
+      stmts.push_back({G, x * G});
+    }
+    std::vector<shf::Hash> hash_prover(n), hash_verifier(n);
+    auto proofs = shf::CreateProofs(stmts, hash_prover, xs);
+    REQUIRE(shf::VerifyProofs(stmts, hash_verifier, proofs));
+
+    for (std::size_t i = 0; i < n; ++i) {
+      shf::Hash h;
+      REQUIRE(shf::VerifyProof(stmts[i], h, proofs[i]));
+      const auto digest = h.Finalize();
+      REQUIRE(shf::DigestEquals(hash_prover[i].Finalize(), digest));
+      REQUIRE(shf::DigestEquals(hash_verifier[i].Finalize(), digest));
+    }
+
+    proofs[7].r = shf::PublicScalar(shf::Scalar::CreateRandom());
+    std::vector<shf::Hash> hashes(n);
+    REQUIRE(!shf::VerifyProofs(stmts, hashes, proofs));
+
+    std::vector<shf::Hash> too_few(n - 1);
+    REQUIRE_THROWS_AS(shf::VerifyProofs(stmts, too_few, proofs),
+                      std::invalid_argument);
+  }
+
+  SECTION("dlogeq") {
+    std::vector<shf::DLogEqS> stmts;
+    for (const auto& x : xs) {
+      const auto G = shf::Point::CreateRandom();
+      const auto H = shf::Point::CreateRandom();
+      stmts.push_back({G, x * G, H, x * H});
+    }
+    std::vector<shf::Hash> hash_prover(n), hash_verifier(n);
+    auto proofs = shf::CreateProofs(stmts, hash_prover, xs);
+    REQUIRE(shf::VerifyProofs(stmts, hash_verifier, proofs));
+
+    for (std::size_t i = 0; i < n; ++i) {
+      shf::Hash h;
+      REQUIRE(shf::VerifyProof(stmts[i], h, proofs[i]));
+      REQUIRE(shf::DigestEquals(hash_prover[i].Finalize(), h.Finalize()));
+    }
+
+    proofs[0].K = shf::Point::CreateRandom();
+    std::vector<shf::Hash> hashes(n);
+    REQUIRE(!shf::VerifyProofs(stmts, hashes, proofs));
+  }
+}
+
 TEST_CASE("product") {
   shf::CurveInit();
 
@@ -94,6 +163,108 @@ static inline shf::Ctxt RandomizeAndDot(const std::vector<shf::Ctxt>& Es,
   return E;
 }
 
+TEST_CASE("precomputed encryption") {
+  shf::CurveInit();
+
+  const auto sk = shf::CreateSecretKey();
+  const auto pk = shf::CreatePublicKey(sk);
+  const shf::PrecomputedPublicKey ppk(pk);
+
+  const auto m = shf::Point::CreateRandom();
+  const auto r = shf::Scalar::CreateRandom();
+  const auto E = shf::Encrypt(ppk, m, r);
+  const auto F = shf::Encrypt(pk, m, r);
+  REQUIRE(E.U == F.U);
+  REQUIRE(E.V == F.V);
+  REQUIRE(shf::Decrypt(sk, E) == m);
+
+  std::vector<shf::Point> ms;
+  std::vector<shf::Ctxt> mEs;
+  for (std::size_t i = 0; i < 70; ++i) {
+    ms.emplace_back(i % 7 ? shf::Point::CreateRandom() : shf::Point());
+    mEs.emplace_back(shf::Encrypt(pk, ms.back()));
+  }
+  // randomness 0 leaves U at infinity.
+  mEs.emplace_back(shf::Encrypt(pk, m, shf::Scalar()));
+  ms.emplace_back(m);
+  REQUIRE(shf::Decrypt(sk, shf::CtxtVector(mEs)) == ms);
+
+  std::vector<shf::Ctxt> Es = RandomCtxts(10);
+  std::vector<shf::Scalar> rs(10);
+  for (auto& s : rs) s = shf::Scalar::CreateRandom();
+  const auto Fs = shf::ReEncrypt(ppk, Es, rs);
+  for (std::size_t i = 0; i < Es.size(); ++i) {
+    const auto G = shf::Add(Es[i], shf::Encrypt(pk, shf::Point(), rs[i]));
+    REQUIRE(Fs[i].U == G.U);
+    REQUIRE(Fs[i].V == G.V);
+  }
+}
+
+TEST_CASE("ctxt vector") {
+  shf::CurveInit();
+
+  const auto pk = shf::CreatePublicKey(shf::CreateSecretKey());
+  const shf::PrecomputedPublicKey ppk(pk);
+
+  std::vector<shf::Ctxt> Es = RandomCtxts(20);
+  Es[3].U = shf::Point();
+  const shf::CtxtVector v(Es);
+  REQUIRE(v.Size() == Es.size());
+  for (std::size_t i = 0; i < Es.size(); ++i) {
+    REQUIRE(v[i].U == Es[i].U);
+    REQUIRE(v[i].V == Es[i].V);
+  }
+
+  SECTION("permute") {
+    shf::Prg prg;
+    const auto p = shf::CreatePermutation(Es.size(), prg);
+    const auto pv = shf::Permute(v, p);
+    const auto pEs = shf::Permute(Es, p);
+    for (std::size_t i = 0; i < Es.size(); ++i) {
+      REQUIRE(pv[i].U == pEs[i].U);
+      REQUIRE(pv[i].V == pEs[i].V);
+    }
+    REQUIRE_THROWS_AS(v.Permute(shf::Permutation{0, 1}), std::invalid_argument);
+  }
+
+  SECTION("reencrypt and dot") {
+    std::vector<shf::Scalar> rs(Es.size());
+    for (auto& s : rs) s = shf::Scalar::CreateRandom();
+    const auto Fs = shf::ReEncrypt(ppk, Es, rs);
+    const auto Fv = shf::ReEncrypt(ppk, v, rs);
+    for (std::size_t i = 0; i < Es.size(); ++i) {
+      REQUIRE(Fv[i].U == Fs[i].U);
+      REQUIRE(Fv[i].V == Fs[i].V);
+    }
+    const auto D = shf::Dot(rs, Es);
+    const auto Dv = shf::Dot(rs, v);
+    REQUIRE(D.U == Dv.U);
+    REQUIRE(D.V == Dv.V);
+  }
+
+  SECTION("sum") {
+    shf::Ctxt S = Es[0];
+    for (std::size_t i = 1; i < Es.size(); ++i) S = shf::Add(S, Es[i]);
+    const auto T = shf::SumCtxts(Es);
+    const auto Tv = shf::SumCtxts(v);
+    REQUIRE(T.U == S.U);
+    REQUIRE(T.V == S.V);
+    REQUIRE(Tv.U == S.U);
+    REQUIRE(Tv.V == S.V);
+  }
+
+  SECTION("write and read") {
+    std::vector<uint8_t> bytes(v.ByteSize());
+    v.Write(bytes.data());
+    const auto w = shf::CtxtVector::Read(bytes.data(), v.Size());
+    REQUIRE(w.Size() == v.Size());
+    for (std::size_t i = 0; i < v.Size(); ++i) {
+      REQUIRE(w[i].U == v[i].U);
+      REQUIRE(w[i].V == v[i].V);
+    }
+  }
+}
+
 TEST_CASE("multiexp") {
   shf::CurveInit();
 